@@ -33,7 +33,14 @@
 
 #include "config.h"
 #include "live/livequeue.h"
+#include "live/livetrace.h"
+#include "live/timeshiftbuffer.h"
+#include "net/msgcompressor.h"
+#include "net/reactor.h"
+#include "net/sendqueue.h"
+#include "net/workerpool.h"
 #include "recordings/recordingscache.h"
+#include "xvdr/xvdrclient.h"
 
 cXVDRServerConfig::cXVDRServerConfig()
 {
@@ -58,11 +65,38 @@ void cXVDRServerConfig::Load() {
   cLiveQueue::RemoveTimeShiftFiles();
 }
 
+void cXVDRServerConfig::LoadDictionary(const char* FileName)
+{
+  cString file = (FileName[0] == '/') ? cString(FileName) : AddDirectory(ConfigDirectory, FileName);
+
+  if(!MsgCompressor::loadDictionary(file))
+  {
+    ERRORLOG("Unable to load compression dictionary %s", (const char*)file);
+    return;
+  }
+
+  INFOLOG("Loaded compression dictionary %s (id %u)", (const char*)file, MsgCompressor::dictionaryId());
+}
+
 bool cXVDRServerConfig::Parse(const char* Name, const char* Value)
 {
   if     (!strcasecmp(Name, "TimeShiftDir")) cLiveQueue::SetTimeShiftDir(Value);
   else if(!strcasecmp(Name, "MaxTimeShiftSize")) cLiveQueue::SetBufferSize(strtoull(Value, NULL, 10));
+  else if(!strcasecmp(Name, "TimeShiftMemory")) cLiveQueue::SetTimeShiftMemory(strtoull(Value, NULL, 10));
+  else if(!strcasecmp(Name, "TimeShiftDirectIO")) cTimeShiftBuffer::SetDirectIO(atoi(Value) != 0);
   else if(!strcasecmp(Name, "PiconsURL")) PiconsURL = Value;
+  else if(!strcasecmp(Name, "SendBatchSize")) cLiveQueue::SetSendBatchSize(strtoul(Value, NULL, 10));
+  else if(!strcasecmp(Name, "SendLatency")) cLiveQueue::SetSendLatency(atoi(Value));
+  else if(!strcasecmp(Name, "LiveQueueTime")) cLiveQueue::SetQueueTime(atoi(Value));
+  else if(!strcasecmp(Name, "LiveQueueSize")) cLiveQueue::SetQueueSize(strtoul(Value, NULL, 10));
+  else if(!strcasecmp(Name, "LiveQueueMemory")) cLiveQueue::SetQueueMemory(strtoull(Value, NULL, 10));
+  else if(!strcasecmp(Name, "SendBufferSize")) cSendQueue::SetBufferSize(atoi(Value));
+  else if(!strcasecmp(Name, "SendLowWatermark")) cSendQueue::SetLowWatermark(atoi(Value));
+  else if(!strcasecmp(Name, "CompressionDictionary")) LoadDictionary(Value);
+  else if(!strcasecmp(Name, "ReactorThreads")) cReactor::SetThreads(atoi(Value));
+  else if(!strcasecmp(Name, "RequestThreads")) cWorkerPool::SetThreads(atoi(Value));
+  else if(!strcasecmp(Name, "SlowRequestTime")) cXVDRClient::SetSlowRequestTime(atoi(Value));
+  else if(!strcasecmp(Name, "TraceSampleRate")) cLiveTrace::SetSampleRate(atoi(Value));
   else return false;
 
   return true;
@@ -78,6 +78,8 @@ protected:
 
   bool Parse(const char* Name, const char* Value);
 
+  void LoadDictionary(const char* FileName);
+
 public:
 
   // Remote server settings
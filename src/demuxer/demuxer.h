@@ -188,12 +188,15 @@ enum eStreamType
 #define PKT_P_FRAME 2
 #define PKT_B_FRAME 3
 #define PKT_NTYPES  4
+class MsgSegment;
+
 struct sStreamPacket
 {
   sStreamPacket() {
     frametype = 0;
     type = stNONE;
     content = scNONE;
+    segment = NULL;
   }
 
   eStreamType type;
@@ -210,6 +213,9 @@ struct sStreamPacket
 
   uint8_t  *data;
   int       size;
+
+  // buffer holding "data" (if set the data can be sent without copying)
+  MsgSegment *segment;
 };
 
 class cLiveStreamer;
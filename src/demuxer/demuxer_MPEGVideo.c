@@ -27,6 +27,7 @@
 
 #include "config/config.h"
 #include "live/livestreamer.h"
+#include "net/msgsegment.h"
 #include "bitstream.h"
 #include "demuxer_MPEGVideo.h"
 
@@ -56,6 +57,7 @@ const unsigned int mpeg2video_framedurations[16] = {
 cParserMPEG2Video::cParserMPEG2Video(cTSDemuxer *demuxer)
  : cParser(demuxer)
 {
+  m_pictureSegment    = NULL;
   m_pictureBuffer     = NULL;
   m_pictureBufferSize = 0;
   m_pictureBufferPtr  = 0;
@@ -71,9 +73,10 @@ cParserMPEG2Video::cParserMPEG2Video(cTSDemuxer *demuxer)
 
 cParserMPEG2Video::~cParserMPEG2Video()
 {
-  if (m_pictureBuffer)
+  if (m_pictureSegment)
   {
-    free(m_pictureBuffer);
+    m_pictureSegment->unref();
+    m_pictureSegment = NULL;
     m_pictureBuffer = NULL;
   }
 }
@@ -82,16 +85,20 @@ void cParserMPEG2Video::Parse(unsigned char *data, int size, bool pusi)
 {
   uint32_t startcode = m_StartCond;
 
-  if (m_pictureBuffer == NULL)
+  if (m_pictureSegment == NULL)
   {
-    m_pictureBufferSize   = 4000;
-    m_pictureBuffer       = (uint8_t*)malloc(m_pictureBufferSize);
+    m_pictureSegment      = MsgSegment::create(4000);
+    m_pictureBuffer       = m_pictureSegment ? m_pictureSegment->data() : NULL;
+    m_pictureBufferSize   = m_pictureSegment ? m_pictureSegment->size() : 0;
   }
 
-  if (m_pictureBufferPtr + size + 4 >= m_pictureBufferSize)
+  if (m_pictureSegment && m_pictureBufferPtr + size + 4 >= m_pictureBufferSize)
   {
-    m_pictureBufferSize  += size * 4;
-    m_pictureBuffer       = (uint8_t*)realloc(m_pictureBuffer, m_pictureBufferSize);
+    if (!m_pictureSegment->resize(m_pictureBufferSize + size * 4, m_pictureBufferPtr))
+      return;
+
+    m_pictureBuffer       = m_pictureSegment->data();
+    m_pictureBufferSize   = m_pictureSegment->size();
   }
 
   for (int i = 0; i < size; i++)
@@ -115,6 +122,14 @@ void cParserMPEG2Video::Parse(unsigned char *data, int size, bool pusi)
     {
       /* Reset packet parser upon length error or if parser tells us so */
       m_pictureBufferPtr = 0;
+
+      /* no new buffer after sending the picture, drop the data */
+      if (!m_pictureBuffer)
+      {
+        m_StartCode = 0;
+        break;
+      }
+
       m_pictureBuffer[m_pictureBufferPtr++] = startcode >> 24;
       m_pictureBuffer[m_pictureBufferPtr++] = startcode >> 16;
       m_pictureBuffer[m_pictureBufferPtr++] = startcode >> 8;
@@ -195,6 +210,7 @@ bool cParserMPEG2Video::Parse_MPEG2Video(size_t len, uint32_t next_startcode, in
         m_StreamPacket->data      = m_pictureBuffer;
         m_StreamPacket->size      = m_pictureBufferPtr - 4;
         m_StreamPacket->duration  = m_FrameDuration;
+        m_StreamPacket->segment   = m_pictureSegment;
 
         // check if packet has a valid PTS
         if(m_StreamPacket->pts == DVD_NOPTS_VALUE)
@@ -203,11 +219,17 @@ bool cParserMPEG2Video::Parse_MPEG2Video(size_t len, uint32_t next_startcode, in
         m_demuxer->SendPacket(m_StreamPacket);
 
         // remove packet
-        free(m_StreamPacket->data);
         delete m_StreamPacket;
         m_StreamPacket = NULL;
 
-        m_pictureBuffer = (uint8_t*)malloc(m_pictureBufferSize);
+        // the picture is still referenced by the queued packet, continue with a new buffer
+        if (m_pictureSegment->shared())
+        {
+          m_pictureSegment->unref();
+          m_pictureSegment    = MsgSegment::create(m_pictureBufferSize);
+          m_pictureBuffer     = m_pictureSegment ? m_pictureSegment->data() : NULL;
+          m_pictureBufferSize = m_pictureSegment ? m_pictureSegment->size() : 0;
+        }
 
         /* If we know the frame duration, increase DTS accordingly */
         m_curDTS += m_FrameDuration;
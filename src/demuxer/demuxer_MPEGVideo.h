@@ -35,6 +35,7 @@ class cBitstream;
 class cParserMPEG2Video : public cParser
 {
 private:
+  MsgSegment     *m_pictureSegment;
   uint8_t        *m_pictureBuffer;
   int             m_pictureBufferSize;
   int             m_pictureBufferPtr;
@@ -27,6 +27,7 @@
 
 #include "config/config.h"
 #include "live/livestreamer.h"
+#include "net/msgsegment.h"
 #include "bitstream.h"
 #include "demuxer_h264.h"
 
@@ -53,6 +54,7 @@ static const int h264_lev2cpbsize[][2] =
 cParserH264::cParserH264(cTSDemuxer *demuxer)
  : cParser(demuxer)
 {
+  m_pictureSegment    = NULL;
   m_pictureBuffer     = NULL;
   m_pictureBufferSize = 0;
   m_pictureBufferPtr  = 0;
@@ -74,28 +76,35 @@ cParserH264::cParserH264(cTSDemuxer *demuxer)
 
 cParserH264::~cParserH264()
 {
-  if (m_pictureBuffer)
-    free(m_pictureBuffer);
+  if (m_pictureSegment)
+    m_pictureSegment->unref();
 }
 
 void cParserH264::Parse(unsigned char *data, int size, bool pusi)
 {
   uint32_t startcode = m_StartCond;
 
-  if (m_pictureBuffer == NULL)
+  if (m_pictureSegment == NULL)
   {
-    m_pictureBufferSize   = 80000;
-    m_pictureBuffer       = (uint8_t*)malloc(m_pictureBufferSize);
+    m_pictureSegment      = MsgSegment::create(80000);
+    m_pictureBuffer       = m_pictureSegment ? m_pictureSegment->data() : NULL;
+    m_pictureBufferSize   = m_pictureSegment ? m_pictureSegment->size() : 0;
   }
 
-  if (m_pictureBufferPtr + size + 4 >= m_pictureBufferSize)
+  if (m_pictureSegment && m_pictureBufferPtr + size + 4 >= m_pictureBufferSize)
   {
-    m_pictureBufferSize  += size * 4;
-    m_pictureBuffer       = (uint8_t*)realloc(m_pictureBuffer, m_pictureBufferSize);
+    if (!m_pictureSegment->resize(m_pictureBufferSize + size * 4, m_pictureBufferPtr))
+      return;
+
+    m_pictureBuffer       = m_pictureSegment->data();
+    m_pictureBufferSize   = m_pictureSegment->size();
   }
 
   for (int i = 0; i < size; i++)
   {
+    if (!m_pictureBuffer)
+      break;
+
     m_pictureBuffer[m_pictureBufferPtr++] = data[i];
     startcode = startcode << 8 | data[i];
 
@@ -112,6 +121,14 @@ void cParserH264::Parse(unsigned char *data, int size, bool pusi)
     {
       /* Reset packet parser upon length error or if parser tells us so */
       m_pictureBufferPtr = 0;
+
+      /* no new buffer after sending the picture, drop the data */
+      if (!m_pictureBuffer)
+      {
+        m_StartCode = 0;
+        break;
+      }
+
       m_pictureBuffer[m_pictureBufferPtr++] = startcode >> 24;
       m_pictureBuffer[m_pictureBufferPtr++] = startcode >> 16;
       m_pictureBuffer[m_pictureBufferPtr++] = startcode >> 8;
@@ -209,10 +226,21 @@ bool cParserH264::Parse_H264(size_t len, uint32_t next_startcode, int sc_offset)
       return true;
 
     // send packet
-    m_FoundFrame        = false;
-    m_StreamPacket.data = m_pictureBuffer;
-    m_StreamPacket.size = m_pictureBufferPtr;
+    m_FoundFrame           = false;
+    m_StreamPacket.data    = m_pictureBuffer;
+    m_StreamPacket.size    = m_pictureBufferPtr;
+    m_StreamPacket.segment = m_pictureSegment;
     m_demuxer->SendPacket(&m_StreamPacket);
+    m_StreamPacket.segment = NULL;
+
+    // the picture is still referenced by the queued packet, continue with a new buffer
+    if (m_pictureSegment->shared())
+    {
+      m_pictureSegment->unref();
+      m_pictureSegment    = MsgSegment::create(m_pictureBufferSize);
+      m_pictureBuffer     = m_pictureSegment ? m_pictureSegment->data() : NULL;
+      m_pictureBufferSize = m_pictureSegment ? m_pictureSegment->size() : 0;
+    }
 
     return true;
   }
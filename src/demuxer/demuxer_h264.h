@@ -64,6 +64,7 @@ private:
     NAL_END_SEQ = 0x0A  // End of Sequence
   };
 
+  MsgSegment     *m_pictureSegment;
   uint8_t        *m_pictureBuffer;
   int             m_pictureBufferSize;
   int             m_pictureBufferPtr;
@@ -27,165 +27,412 @@
 #include <unistd.h>
 
 #include "config/config.h"
+#include "net/metrics.h"
 #include "net/msgpacket.h"
-#include "net/socketlock.h"
+#include "net/sendqueue.h"
 #include "livequeue.h"
+#include "livetrace.h"
+#include "timeshiftstore.h"
+
+// lower limit of the send queue backlog (bytes)
+#define MIN_BACKLOG (16*1024)
+
+// lower limit of the byte budget of a queue
+#define MIN_QUEUE_SIZE (256*1024)
 
 cString cLiveQueue::TimeShiftDir = "/video";
 uint64_t cLiveQueue::BufferSize = 1024*1024*1024;
-
-cLiveQueue::cLiveQueue(int sock) : m_socket(sock), m_readfd(-1), m_writefd(-1)
+uint64_t cLiveQueue::TimeShiftMemory = 32*1024*1024;
+uint32_t cLiveQueue::SendBatchSize = 128*1024;
+int cLiveQueue::SendLatency = 20;
+int cLiveQueue::QueueTime = 2000;
+uint32_t cLiveQueue::QueueSize = 8*1024*1024;
+uint64_t cLiveQueue::QueueMemory = 64*1024*1024;
+volatile uint64_t cLiveQueue::TotalBytes = 0;
+
+cLiveQueue::cLiveQueue(cSendQueue* queue, cLiveTrace* trace) : m_sendqueue(queue), m_trace(trace), m_timeshift(NULL)
 {
   m_pause = false;
+  m_videoDropped = false;
+  m_bytes = 0;
+  m_dropped = 0;
+  m_lastDTS = DVD_NOPTS_VALUE;
+  m_rateStart = DVD_NOPTS_VALUE;
+  m_rateBytes = 0;
+  m_bitrate = 0;
+  m_corked = false;
 }
 
 cLiveQueue::~cLiveQueue()
 {
   DEBUGLOG("Deleting LiveQueue");
-  m_cond.Signal();
-  Cancel(3);
+  m_sendqueue->SetWaiter(NULL, 0);
+  cReactor::GetInstance().Remove(this);
   Cleanup();
   CloseTimeShift();
 }
 
+bool cLiveQueue::Start()
+{
+  // woken up by Notify() and the send queue of the connection
+  if(!cReactor::GetInstance().Add(this, -1, 0))
+  {
+    ERRORLOG("Unable to register LiveQueue");
+    return false;
+  }
+
+  INFOLOG("LiveQueue started");
+  return true;
+}
+
 void cLiveQueue::Cleanup()
 {
   cMutexLock lock(&m_lock);
   while(!empty())
+    delete Pop();
+}
+
+void cLiveQueue::Push(MsgPacket* p, int frametype, int64_t dts, int64_t pts)
+{
+  sQueuedPacket q = { p, frametype, dts, pts };
+  push_back(q);
+
+  uint32_t length = p->getPacketLength();
+  m_bytes += length;
+  __sync_fetch_and_add(&TotalBytes, length);
+
+  if(dts == DVD_NOPTS_VALUE)
+    return;
+
+  m_lastDTS = dts;
+
+  // bytes per second of media time (restarted on discontinuities)
+  if(m_rateStart == DVD_NOPTS_VALUE || dts < m_rateStart || dts - m_rateStart > 10 * DVD_TIME_BASE)
   {
-    delete front();
-    pop();
+    m_rateStart = dts;
+    m_rateBytes = 0;
+  }
+
+  m_rateBytes += length;
+
+  if(dts - m_rateStart >= DVD_TIME_BASE)
+  {
+    uint32_t rate = (uint32_t)(m_rateBytes * DVD_TIME_BASE / (dts - m_rateStart));
+    m_bitrate = (m_bitrate == 0) ? rate : (3 * (uint64_t)m_bitrate + rate) / 4;
+    m_rateStart = dts;
+    m_rateBytes = 0;
   }
 }
 
+MsgPacket* cLiveQueue::Pop()
+{
+  MsgPacket* p = front().packet;
+  pop_front();
+
+  uint32_t length = p->getPacketLength();
+  m_bytes -= length;
+  __sync_fetch_and_sub(&TotalBytes, length);
+
+  return p;
+}
+
+cLiveQueue::iterator cLiveQueue::Remove(iterator i)
+{
+  uint32_t length = i->packet->getPacketLength();
+  m_bytes -= length;
+  __sync_fetch_and_sub(&TotalBytes, length);
+
+  Drop(i->packet);
+  return erase(i);
+}
+
 void cLiveQueue::Request()
 {
   cMutexLock lock(&m_lock);
 
-  // read packet from storage
-  MsgPacket* p = MsgPacket::read(m_readfd, 1000);
-
-  // check for buffer overrun
-  if(p == NULL)
-  {
-    // ring-buffer overrun ?
-    off_t pos = lseek(m_readfd, 0, SEEK_CUR);
-    if(pos < (off_t)BufferSize)
-      return;
+  if(m_timeshift == NULL)
+    return;
 
-    lseek(m_readfd, 0, SEEK_SET);
-    p = MsgPacket::read(m_readfd, 1000);
-  }
+  // read packet from storage
+  MsgPacket* p = m_timeshift->Read(m_cursor);
 
   // no packet
   if(p == NULL)
     return;
 
   // put packet into queue
-  push(p);
+  Push(p, 0, DVD_NOPTS_VALUE);
 
-  m_cond.Signal();
+  cReactor::GetInstance().Notify(this);
 }
 
-bool cLiveQueue::Add(MsgPacket* p)
+bool cLiveQueue::Add(MsgPacket* p, int frametype, int64_t dts, int64_t pts)
 {
   cMutexLock lock(&m_lock);
 
   // in timeshift mode ?
-  if(m_pause || (!m_pause && m_writefd != -1))
+  if(m_timeshift != NULL)
   {
-    // write packet
-    if(!p->write(m_writefd, 1000))
-    {
-      DEBUGLOG("Unable to write packet into timeshift ringbuffer !");
-      return false;
-    }
+    uint32_t length = p->getPacketLength();
 
-    // ring-buffer overrun ?
-    off_t length = lseek(m_writefd, 0, SEEK_CUR);
-    if(length >= (off_t)BufferSize)
+    // kept in memory or queued for the timeshift writer (if we are writing the
+    // shared storage, otherwise the store keeps it only for a writer handover)
+    if(m_timeshift->Write(this, p, frametype, dts, pts))
     {
-      // truncate to current position
-      if(ftruncate(m_writefd, length) == 0)
-        lseek(m_writefd, 0, SEEK_SET);
+      cMetrics::Add(cMetrics::TimeshiftWrites, 1, m_sendqueue->Metrics());
+      cMetrics::Add(cMetrics::TimeshiftBytes, length, m_sendqueue->Metrics());
     }
+
     return true;
   }
 
   // queue too long ?
-  if (size() > 100) {
-    delete p;
+  while(IsFull() && MakeRoom())
+    ;
+
+  if(IsFull())
+  {
+    if(frametype != 0)
+      m_videoDropped = true;
+
+    Drop(p);
+    return false;
+  }
+
+  // an I-frame doesn't depend on dropped video (MakeRoom() may have set the
+  // flag again while making room for it)
+  if(frametype == PKT_I_FRAME)
+    m_videoDropped = false;
+
+  // after video has been dropped, the frames are useless up to the next I-frame
+  if(m_videoDropped && frametype != 0)
+  {
+    Drop(p);
     return false;
   }
 
   // add packet to queue
-  push(p);
-  m_cond.Signal();
+  Push(p, frametype, dts, pts);
+  cReactor::GetInstance().Notify(this);
 
   return true;
 }
 
-void cLiveQueue::Action()
+uint32_t cLiveQueue::ByteBudget()
 {
-  INFOLOG("LiveQueue started");
+  if(m_bitrate == 0)
+    return QueueSize;
+
+  // twice the media budget at the measured bitrate, bursts of big frames need some headroom
+  uint64_t budget = (uint64_t)m_bitrate * QueueTime / 500;
+
+  if(budget < MIN_QUEUE_SIZE)
+    return MIN_QUEUE_SIZE;
 
-  // wait for first packet
-  m_cond.Wait(0);
+  return (budget > QueueSize) ? QueueSize : (uint32_t)budget;
+}
+
+int64_t cLiveQueue::Span()
+{
+  if(m_lastDTS == DVD_NOPTS_VALUE)
+    return 0;
 
-  while(Running())
+  for(iterator i = begin(); i != end(); i++)
   {
-    MsgPacket* p = NULL;
+    if(i->dts != DVD_NOPTS_VALUE)
+      return (m_lastDTS > i->dts) ? m_lastDTS - i->dts : 0;
+  }
 
-    m_lock.Lock();
+  return 0;
+}
 
-    // just wait if we are paused
-    if(m_pause)
-    {
-      m_lock.Unlock();
-      m_cond.Wait(0);
-      m_lock.Lock();
-    }
+bool cLiveQueue::IsFull()
+{
+  if(empty())
+    return false;
 
-    // check packet queue
-    if(size() > 0)
+  return (m_bytes >= ByteBudget() || Span() >= (int64_t)QueueTime * 1000 || TotalBytes >= QueueMemory);
+}
+
+bool cLiveQueue::GetStatus(sQueueStatus& status)
+{
+  cMutexLock lock(&m_lock);
+
+  if(m_pause)
+    return false;
+
+  status.packets = size();
+  status.bytes = m_bytes;
+  status.maxbytes = ByteBudget();
+  status.time = (uint32_t)(Span() / 1000);
+  status.maxtime = QueueTime;
+  status.bitrate = m_bitrate;
+  status.dropped = m_dropped;
+
+  return true;
+}
+
+bool cLiveQueue::MakeRoom()
+{
+  // B-frames first, no other frame depends on them
+  for(iterator i = begin(); i != end(); i++)
+  {
+    if(i->frametype == PKT_B_FRAME)
     {
-      p = front();
-      pop();
+      Remove(i);
+      return true;
     }
+  }
 
-    m_lock.Unlock();
+  // then the oldest P-frame and all frames depending on it (up to the next I-frame)
+  iterator i = begin();
+
+  while(i != end() && i->frametype != PKT_P_FRAME)
+    i++;
 
-    // no packets to send
-    if(p == NULL)
+  if(i == end())
+    return false;
+
+  while(i != end() && i->frametype != PKT_I_FRAME)
+  {
+    if(i->frametype == 0)
     {
-      m_cond.Wait(3000);
+      i++;
       continue;
     }
 
-    // send packet
-    write(p);
-    delete p;
+    i = Remove(i);
   }
 
-  INFOLOG("LiveQueue stopped");
+  // no I-frame queued, drop the incoming frames until the next one
+  if(i == end())
+    m_videoDropped = true;
+
+  return true;
 }
 
-bool cLiveQueue::write(MsgPacket* packet)
+void cLiveQueue::Drop(MsgPacket* p)
 {
-  cSocketLock locks(m_socket);
-  while(!packet->write(m_socket, 50) && Running())
-    ;
+  cMetrics::Add(cMetrics::PacketsDropped, 1, m_sendqueue->Metrics());
+  m_dropped++;
+  delete p;
+}
+
+void cLiveQueue::OnEvent(int events)
+{
+  m_lock.Lock();
+
+  // just wait if we are paused or there's nothing to send
+  if(m_pause || empty())
+  {
+    m_lock.Unlock();
+    Flush();
+    return;
+  }
+
+  m_lock.Unlock();
+
+  // don't pile up packets in the send queue, wait until the client has caught up
+  uint32_t limit = BacklogLimit();
+
+  if(m_sendqueue->Backlog() > limit)
+  {
+    m_sendqueue->SetWaiter(this, limit / 2);
+    return;
+  }
+
+  m_lock.Lock();
+
+  // drain the packet queue up to the batch size
+  MsgPacket* batch[256];
+  int count = 0;
+  uint32_t bytes = 0;
+
+  while(!empty() && count < 256 && (count == 0 || bytes < SendBatchSize))
+  {
+    MsgPacket* p = Pop();
+    bytes += p->getPacketLength();
+    batch[count++] = p;
+  }
+
+  bool more = !empty();
+
+  m_lock.Unlock();
+
+  // cork the socket while more packets are waiting, but not longer than the latency budget
+  if(more && !m_corked)
+  {
+    m_corked = true;
+    m_corkTime.Set(0);
+  }
+  else if(more && m_corkTime.Elapsed() >= (uint64_t)SendLatency)
+    more = false;
+
+  // hand the packets over to the send queue
+  for(int i = 0; i < count; i++)
+  {
+    int flags = (more && i == count - 1) ? cSendQueue::More : 0;
+
+    if(m_trace != NULL && m_trace->Stage(batch[i]->getUID(), cLiveTrace::Send))
+      flags |= cSendQueue::Trace;
+
+    m_sendqueue->Send(batch[i], flags);
+  }
+
+  if(!more)
+    m_corked = false;
+
+  // continue with the next batch
+  cMutexLock lock(&m_lock);
+  if(!empty())
+    cReactor::GetInstance().Notify(this);
+}
+
+uint32_t cLiveQueue::BacklogLimit()
+{
+  // about the latency budget of data at the measured throughput of the client,
+  // the rest waits here where it can still be dropped
+  uint64_t limit = (uint64_t)m_sendqueue->Throughput() * SendLatency / 1000;
+
+  if(limit == 0 || limit > SendBatchSize)
+    return SendBatchSize;
+
+  return (limit < MIN_BACKLOG) ? MIN_BACKLOG : (uint32_t)limit;
+}
+
+void cLiveQueue::Flush()
+{
+  if(!m_corked)
+    return;
+
+  m_sendqueue->Flush();
+  m_corked = false;
+}
+
+bool cLiveQueue::OpenTimeShift()
+{
+  m_timeshift = cTimeShiftStore::Acquire((const char*)m_timeshiftKey, TimeShiftDir, BufferSize, TimeShiftMemory);
+
+  if(m_timeshift == NULL)
+  {
+    ERRORLOG("Failed to create timeshift ringbuffer !");
+    return false;
+  }
+
   return true;
 }
 
 void cLiveQueue::CloseTimeShift()
 {
-  close(m_readfd);
-  m_readfd = -1;
-  close(m_writefd);
-  m_writefd = -1;
+  cTimeShiftStore::Release(m_timeshift, this);
+  m_timeshift = NULL;
+  m_cursor.Reset();
+}
 
-  unlink(m_storage);
+void cLiveQueue::SetTimeShiftKey(const cString& key)
+{
+  cMutexLock lock(&m_lock);
+  m_timeshiftKey = key;
 }
 
 bool cLiveQueue::Pause(bool on)
@@ -196,44 +443,112 @@ bool cLiveQueue::Pause(bool on)
   if(!on)
   {
     m_pause = false;
-    m_cond.Signal();
+    cReactor::GetInstance().Notify(this);
     return true;
   }
 
   if(m_pause)
     return false;
 
-  // create offline storage
-  if(m_readfd == -1)
-  {
-    m_storage = cString::sprintf("%s/xvdr-ringbuffer-%05i.data", (const char*)TimeShiftDir, m_socket);
-    DEBUGLOG("FILE: %s", (const char*)m_storage);
+  m_pause = true;
 
-    m_readfd = open(m_storage, O_CREAT | O_RDONLY, 0644);
-    m_writefd = open(m_storage, O_CREAT | O_WRONLY, 0644);
-    lseek(m_readfd, 0, SEEK_SET);
-    lseek(m_writefd, 0, SEEK_SET);
+  // already timeshifting, the queued packets have been read from the storage
+  if(m_timeshift != NULL)
+    return true;
 
-    if(m_readfd == -1) {
-      ERRORLOG("Failed to create timeshift ringbuffer !");
-    }
+  // create offline storage (the file is created when the memory budget is exhausted)
+  if(!OpenTimeShift())
+  {
+    m_pause = false;
+    return false;
   }
 
-  m_pause = true;
+  // another client is already recording the stream, continue reading after
+  // the packets we have queued
+  if(m_timeshift->Join(m_cursor, m_lastDTS))
+  {
+    DEBUGLOG("Joined shared timeshift buffer (%i packets queued)", size());
+    return true;
+  }
 
-  // push all packets from the queue to the offline storage
-  DEBUGLOG("Writing %i packets into timeshift buffer", size());
+  // move all packets from the queue to the storage
+  DEBUGLOG("Moving %i packets into timeshift buffer", size());
 
   while(!empty())
   {
-    MsgPacket* p = front();
+    int frametype = front().frametype;
+    int64_t dts = front().dts;
+    int64_t pts = front().pts;
 
-    p->write(m_writefd, 1000);
-    delete p;
+    m_timeshift->Write(this, Pop(), frametype, dts, pts);
+  }
 
-    pop();
+  return true;
+}
+
+int64_t cLiveQueue::Seek(int64_t pts)
+{
+  cMutexLock lock(&m_lock);
+
+  if(m_timeshift == NULL)
+    return DVD_NOPTS_VALUE;
+
+  int64_t rc = m_timeshift->Seek(m_cursor, pts);
+
+  // the packets already taken from the old position are obsolete
+  if(rc != DVD_NOPTS_VALUE)
+  {
+    while(!empty())
+      delete Pop();
+  }
+
+  return rc;
+}
+
+int64_t cLiveQueue::SeekRelative(int ms)
+{
+  int64_t first = DVD_NOPTS_VALUE;
+  int64_t position = DVD_NOPTS_VALUE;
+  int64_t live = DVD_NOPTS_VALUE;
+
+  if(!GetWindow(first, position, live))
+    return DVD_NOPTS_VALUE;
+
+  if(position == DVD_NOPTS_VALUE)
+    position = live;
+
+  if(position == DVD_NOPTS_VALUE)
+    return DVD_NOPTS_VALUE;
+
+  return Seek(position + (int64_t)ms * DVD_TIME_BASE / 1000);
+}
+
+int64_t cLiveQueue::SeekLive()
+{
+  cMutexLock lock(&m_lock);
+
+  if(m_timeshift == NULL)
+    return DVD_NOPTS_VALUE;
+
+  int64_t rc = m_timeshift->SeekLive(m_cursor);
+
+  if(rc != DVD_NOPTS_VALUE)
+  {
+    while(!empty())
+      delete Pop();
   }
 
+  return rc;
+}
+
+bool cLiveQueue::GetWindow(int64_t& first, int64_t& position, int64_t& live)
+{
+  cMutexLock lock(&m_lock);
+
+  if(m_timeshift == NULL)
+    return false;
+
+  m_timeshift->GetWindow(m_cursor, first, position, live);
   return true;
 }
 
@@ -249,6 +564,42 @@ void cLiveQueue::SetBufferSize(uint64_t s)
   DEBUGLOG("BUFFSERIZE: %llu bytes", BufferSize);
 }
 
+void cLiveQueue::SetTimeShiftMemory(uint64_t bytes)
+{
+  TimeShiftMemory = bytes;
+  DEBUGLOG("TIMESHIFTMEMORY: %llu bytes", TimeShiftMemory);
+}
+
+void cLiveQueue::SetSendBatchSize(uint32_t s)
+{
+  SendBatchSize = s;
+  DEBUGLOG("SENDBATCHSIZE: %u bytes", SendBatchSize);
+}
+
+void cLiveQueue::SetSendLatency(int ms)
+{
+  SendLatency = ms;
+  DEBUGLOG("SENDLATENCY: %i ms", SendLatency);
+}
+
+void cLiveQueue::SetQueueTime(int ms)
+{
+  QueueTime = ms;
+  DEBUGLOG("LIVEQUEUETIME: %i ms", QueueTime);
+}
+
+void cLiveQueue::SetQueueSize(uint32_t bytes)
+{
+  QueueSize = bytes;
+  DEBUGLOG("LIVEQUEUESIZE: %u bytes", QueueSize);
+}
+
+void cLiveQueue::SetQueueMemory(uint64_t bytes)
+{
+  QueueMemory = bytes;
+  DEBUGLOG("LIVEQUEUEMEMORY: %llu bytes", QueueMemory);
+}
+
 void cLiveQueue::RemoveTimeShiftFiles()
 {
   DIR* dir = opendir((const char*)TimeShiftDir);
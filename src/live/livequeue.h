@@ -25,58 +25,169 @@
 #ifndef XVDR_LIVEQUEUE_H
 #define XVDR_LIVEQUEUE_H
 
-#include <queue>
+#include <deque>
 #include <vdr/thread.h>
+#include <vdr/tools.h>
+
+#include "demuxer/demuxer.h"
+#include "net/reactor.h"
+#include "timeshiftbuffer.h"
 
 class MsgPacket;
+class cSendQueue;
+class cLiveTrace;
+class cTimeShiftStore;
+
+struct sQueuedPacket
+{
+  MsgPacket* packet;
+  int frametype;      // PKT_I_FRAME, PKT_P_FRAME, PKT_B_FRAME for video frames, 0 otherwise
+  int64_t dts;        // DVD_NOPTS_VALUE for packets without media time
+  int64_t pts;        // PTS of video frames, DVD_NOPTS_VALUE otherwise
+};
+
+struct sQueueStatus
+{
+  uint32_t packets;   // queued packets
+  uint32_t bytes;     // queued bytes
+  uint32_t maxbytes;  // byte budget of the queue
+  uint32_t time;      // queued media (ms)
+  uint32_t maxtime;   // media budget of the queue (ms)
+  uint32_t bitrate;   // measured media bitrate (bytes/s)
+  uint32_t dropped;   // packets dropped since the start
+};
 
-class cLiveQueue : public cThread, protected std::queue<MsgPacket*>
+class cLiveQueue : public cReactorHandler, protected std::deque<sQueuedPacket>
 {
 public:
 
-  cLiveQueue(int s);
+  cLiveQueue(cSendQueue* queue, cLiveTrace* trace = NULL);
 
   virtual ~cLiveQueue();
 
-  bool Add(MsgPacket* p);
+  bool Start();
+
+  // frametype and PTS of video frames (PKT_*), 0 for all other packets
+  bool Add(MsgPacket* p, int frametype = 0, int64_t dts = DVD_NOPTS_VALUE, int64_t pts = DVD_NOPTS_VALUE);
+
+  // returns false while paused
+  bool GetStatus(sQueueStatus& status);
 
   void Request();
 
   bool Pause(bool on = true);
 
+  // queues with the same key share their timeshift storage
+  void SetTimeShiftKey(const cString& key);
+
+  // timeshift positions (video PTS), DVD_NOPTS_VALUE if not timeshifting or
+  // there's no keyframe to go to
+  int64_t Seek(int64_t pts);
+
+  int64_t SeekRelative(int ms);
+
+  int64_t SeekLive();
+
+  bool GetWindow(int64_t& first, int64_t& position, int64_t& live);
+
   static void SetTimeShiftDir(const cString& dir);
 
   static void SetBufferSize(uint64_t s);
 
+  static void SetTimeShiftMemory(uint64_t bytes);
+
+  static void SetSendBatchSize(uint32_t s);
+
+  static void SetSendLatency(int ms);
+
+  static void SetQueueTime(int ms);
+
+  static void SetQueueSize(uint32_t bytes);
+
+  static void SetQueueMemory(uint64_t bytes);
+
   static void RemoveTimeShiftFiles();
 
 protected:
 
-  void Action();
+  void OnEvent(int events);
 
   void Cleanup();
 
-  bool write(MsgPacket* packet);
+  void Flush();
+
+  uint32_t BacklogLimit();
+
+  bool IsFull();
+
+  bool MakeRoom();
+
+  void Drop(MsgPacket* p);
+
+  void Push(MsgPacket* p, int frametype, int64_t dts, int64_t pts = DVD_NOPTS_VALUE);
+
+  MsgPacket* Pop();
+
+  iterator Remove(iterator i);
+
+  uint32_t ByteBudget();
+
+  int64_t Span();
+
+  bool OpenTimeShift();
 
   void CloseTimeShift();
 
-  int m_socket;
+  cSendQueue* m_sendqueue;
+
+  cLiveTrace* m_trace;
+
+  cTimeShiftStore* m_timeshift;
 
-  int m_readfd;
+  sTimeShiftCursor m_cursor;
 
-  int m_writefd;
+  cString m_timeshiftKey;
 
   bool m_pause;
 
+  bool m_videoDropped;
+
+  uint32_t m_bytes;
+
+  uint32_t m_dropped;
+
+  int64_t m_lastDTS;
+
+  // media bitrate measurement
+  int64_t m_rateStart;
+
+  uint64_t m_rateBytes;
+
+  uint32_t m_bitrate;
+
   cMutex m_lock;
 
-  cCondWait m_cond;
+  bool m_corked;
 
-  cString m_storage;
+  cTimeMs m_corkTime;
 
   static cString TimeShiftDir;
 
   static uint64_t BufferSize;
+
+  static uint64_t TimeShiftMemory;
+
+  static uint32_t SendBatchSize;
+
+  static int SendLatency;
+
+  static int QueueTime;
+
+  static uint32_t QueueSize;
+
+  static uint64_t QueueMemory;
+
+  static volatile uint64_t TotalBytes;
 };
 
 #endif // XVDR_LIVEQUEUE_H
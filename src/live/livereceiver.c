@@ -24,8 +24,10 @@
  */
 
 #include "config/config.h"
+#include "net/metrics.h"
 #include "livereceiver.h"
 #include "livestreamer.h"
+#include "livetrace.h"
 
 cLiveReceiver::cLiveReceiver(cLiveStreamer *Streamer, const cChannel* channel, int Priority)
  : cReceiver(channel, Priority)
@@ -43,8 +45,14 @@ void cLiveReceiver::Receive(uchar *Data, int Length)
 {
   int p = m_Streamer->Put(Data, Length);
 
+  if (m_Streamer->m_Trace != NULL && p > 0)
+    m_Streamer->m_Trace->Received(p);
+
   if (p != Length)
+  {
     m_Streamer->ReportOverflow(Length - p);
+    cMetrics::Add(cMetrics::RingOverflows, Length - p, m_Streamer->Metrics());
+  }
 }
 
 inline void cLiveReceiver::Activate(bool On)
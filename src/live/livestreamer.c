@@ -40,8 +40,10 @@
 #endif
 
 #include "config/config.h"
+#include "net/metrics.h"
 #include "net/msgpacket.h"
-#include "net/socketlock.h"
+#include "net/msgsegment.h"
+#include "net/sendqueue.h"
 #include "xvdr/xvdrcommand.h"
 #include "tools/hash.h"
 
@@ -49,19 +51,41 @@
 #include "livepatfilter.h"
 #include "livereceiver.h"
 #include "livequeue.h"
+#include "livetrace.h"
 #include "channelcache.h"
 
-cLiveStreamer::cLiveStreamer(uint32_t timeout)
+// limits of a batch of frames (XVDR_STREAM_MUXBATCH)
+#define MUXBATCH_MAXSIZE     8192
+#define MUXBATCH_MAXCOUNT    16
+#define MUXBATCH_MAXDURATION (DVD_TIME_BASE / 10)
+
+// receiver ring buffer, sized for the measured bitrate of the channel (ms of data)
+#define RINGBUFFER_TIME      2000
+#define RINGBUFFER_MINSIZE   MEGABYTE(1)
+#define RINGBUFFER_MAXSIZE   MEGABYTE(5)
+
+std::map<uint32_t, uint32_t> cLiveStreamer::m_Bitrates;
+cMutex cLiveStreamer::m_BitratesLock;
+
+cLiveStreamer::cLiveStreamer(const cChannel *channel, uint32_t timeout)
  : cThread("cLiveStreamer stream processor")
- , cRingBufferLinear(MEGABYTE(5), TS_SIZE*2, true)
+ , cRingBufferLinear(BufferSize(channel), TS_SIZE*2, true)
  , m_scanTimeout(timeout)
 {
   m_Channel         = NULL;
   m_Priority        = 0;
   m_socket          = -1;
+  m_SendQueue       = NULL;
   m_Device          = NULL;
   m_Receiver        = NULL;
   m_Queue           = NULL;
+  m_Trace           = NULL;
+  m_MuxBatching     = false;
+  m_MuxBatch        = NULL;
+  m_MuxBatchCount   = 0;
+  m_MuxBatchDTS     = 0;
+  m_DeltaTimestamps = false;
+  m_QueueStatus     = false;
   m_PatFilter       = NULL;
   m_Frontend        = -1;
   m_startup         = true;
@@ -142,8 +166,18 @@ cLiveStreamer::~cLiveStreamer()
     m_Frontend = -1;
   }
 
+  if (m_Queue != NULL)
+    cMetrics::Add(cMetrics::Streams, -1, Metrics());
+
+  delete m_MuxBatch;
   delete m_Queue;
 
+  if (m_Trace != NULL)
+  {
+    m_SendQueue->SetTracer(NULL);
+    delete m_Trace;
+  }
+
   DEBUGLOG("Finished to delete live streamer (took %llu ms)", t.Elapsed());
 }
 
@@ -162,12 +196,19 @@ void cLiveStreamer::Action(void)
   cTimeMs last_info;
   last_info.Set(0);
 
+  cTimeMs last_status;
+  cTimeMs rate_time;
+  uint64_t rate_bytes = 0;
+
   while (Running())
   {
     size = 0;
     used = 0;
     buf = Get(size);
 
+    if (m_Trace != NULL && buf != NULL)
+      m_Trace->ChunkRead();
+
     if (!m_Receiver->IsAttached())
     {
       INFOLOG("returning from streamer thread, receiver is no more attached");
@@ -181,9 +222,12 @@ void cLiveStreamer::Action(void)
       m_SignalLost = true;
     }
 
-    // no data
+    // no data, don't hold back collected frames
     if (buf == NULL || size <= TS_SIZE)
+    {
+      flushMuxBatch();
       continue;
+    }
 
     /* Make sure we are looking at a TS packet */
     while (size > TS_SIZE)
@@ -204,6 +248,9 @@ void cLiveStreamer::Action(void)
 
       unsigned int ts_pid = TsPid(buf);
 
+      if (m_Trace != NULL)
+        m_Trace->SetOffset(used + TS_SIZE);
+
       m_FilterMutex.Lock();
       cTSDemuxer *demuxer = FindStreamDemuxer(ts_pid);
       if (demuxer)
@@ -217,17 +264,31 @@ void cLiveStreamer::Action(void)
       used += TS_SIZE;
     }
     Del(used);
+    rate_bytes += used;
+
+    if (m_Trace != NULL)
+      m_Trace->Consumed(used);
+
+    if(m_QueueStatus && last_status.Elapsed() >= 1000 && IsReady())
+    {
+      last_status.Set(0);
+      sendQueueStatus();
+    }
 
     if(last_info.Elapsed() >= 10*1000 && IsReady())
     {
       last_info.Set(0);
       sendStreamInfo();
       sendSignalInfo();
+
+      StoreBitrate(m_uid, (uint32_t)(rate_bytes * 1000 / rate_time.Elapsed()));
+      rate_time.Set(0);
+      rate_bytes = 0;
     }
   }
 }
 
-bool cLiveStreamer::StreamChannel(const cChannel *channel, int priority, int sock, MsgPacket *resp)
+bool cLiveStreamer::StreamChannel(const cChannel *channel, int priority, int sock, cSendQueue* queue, MsgPacket *resp)
 {
   if (channel == NULL)
   {
@@ -239,6 +300,7 @@ bool cLiveStreamer::StreamChannel(const cChannel *channel, int priority, int soc
   m_Channel  = channel;
   m_Priority = priority;
   m_socket   = sock;
+  m_SendQueue = queue;
   m_uid      = CreateChannelUID(m_Channel);
 
   // check if any device is able to decrypt the channel - code taken from VDR
@@ -295,20 +357,29 @@ bool cLiveStreamer::StreamChannel(const cChannel *channel, int priority, int soc
   }
 
   // Send the OK response here, that it is before the Stream end message
-  resp->put_U32(XVDR_RET_OK);
-
-  {
-    cSocketLock locks(m_socket);
-    resp->write(sock, 3000);
-  }
+  MsgPacket* ok = new MsgPacket(resp->getMsgID(), resp->getType(), resp->getUID());
+  ok->setProtocolVersion(resp->getProtocolVersion());
+  ok->put_U32(XVDR_RET_OK);
+  m_SendQueue->Send(ok);
 
   // create send queue
   if (m_Queue == NULL)
   {
-    m_Queue = new cLiveQueue(m_socket);
+    // trace the pipeline if sampling is enabled
+    if (cLiveTrace::GetSampleRate() > 0)
+    {
+      cMetricSet* metrics = Metrics();
+      m_Trace = new cLiveTrace((metrics != NULL) ? metrics->GetName() : "");
+      m_SendQueue->SetTracer(m_Trace);
+    }
+
+    m_Queue = new cLiveQueue(m_SendQueue, m_Trace);
     m_Queue->Start();
+    cMetrics::Add(cMetrics::Streams, 1, Metrics());
   }
 
+  updateTimeShiftKey();
+
   m_PatFilter = new cLivePatFilter(this, m_Channel);
   m_Receiver = new cLiveReceiver(this, m_Channel, m_Priority);
 
@@ -407,25 +478,134 @@ void cLiveStreamer::sendStreamPacket(sStreamPacket *pkt)
   if(m_SignalLost)
     return;
 
-  // initialise stream packet
-  MsgPacket* packet = new MsgPacket(XVDR_STREAM_MUXPKT, XVDR_CHANNEL_STREAM);
+  bool traced = (m_Trace != NULL && m_Trace->Sample());
+
+  // small frames are collected, a video frame sends the pending ones first
+  if(m_MuxBatching && pkt->content != scVIDEO)
+  {
+    batchStreamPacket(pkt, traced);
+    m_last_tick.Set(0);
+    return;
+  }
+
+  flushMuxBatch();
+
+  // initialise stream packet (pid + pts + dts + size + payload)
+  int payloadsize = (pkt->segment != NULL) ? 0 : pkt->size;
+  MsgPacket* packet = new MsgPacket(XVDR_STREAM_MUXPKT, XVDR_CHANNEL_STREAM, 0, 22 + payloadsize);
   packet->disablePayloadCheckSum();
 
-  // write stream data
-  packet->put_U16(pkt->pid);
-  packet->put_S64(pkt->pts);
-  packet->put_S64(pkt->dts);
+  putStreamPacket(packet, pkt, false);
 
-  // write payload into stream packet
-  packet->put_U32(pkt->size);
-  packet->put_Blob(pkt->data, pkt->size);
+  if(traced)
+  {
+    m_Trace->Begin(packet->getUID());
+    m_Trace->Stage(packet->getUID(), cLiveTrace::Queue);
+  }
 
-  m_Queue->Add(packet);
+  cMetrics::Add(cMetrics::StreamPackets, 1, Metrics());
+  if(pkt->content == scVIDEO)
+    m_Queue->Add(packet, pkt->frametype, pkt->dts, pkt->pts);
+  else
+    m_Queue->Add(packet, 0, pkt->dts);
   m_last_tick.Set(0);
 }
 
+void cLiveStreamer::batchStreamPacket(sStreamPacket *pkt, bool traced)
+{
+  // keep the latency of the batch bounded (in stream time)
+  if(m_MuxBatch != NULL && pkt->dts - m_MuxBatchDTS > MUXBATCH_MAXDURATION)
+    flushMuxBatch();
+
+  if(m_MuxBatch == NULL)
+  {
+    m_MuxBatch = new MsgPacket(XVDR_STREAM_MUXBATCH, XVDR_CHANNEL_STREAM, 0, 22 * MUXBATCH_MAXCOUNT);
+    m_MuxBatch->disablePayloadCheckSum();
+    m_MuxBatchCount = 0;
+    m_MuxBatchDTS = pkt->dts;
+  }
+
+  putStreamPacket(m_MuxBatch, pkt, true);
+  m_MuxBatchCount++;
+
+  if(traced)
+    m_Trace->Begin(m_MuxBatch->getUID());
+
+  if(m_MuxBatchCount >= MUXBATCH_MAXCOUNT || m_MuxBatch->getPayloadLength() >= MUXBATCH_MAXSIZE)
+    flushMuxBatch();
+}
+
+void cLiveStreamer::flushMuxBatch()
+{
+  if(m_MuxBatch == NULL)
+    return;
+
+  if(m_Trace != NULL)
+    m_Trace->Stage(m_MuxBatch->getUID(), cLiveTrace::Queue);
+
+  cMetrics::Add(cMetrics::StreamPackets, 1, Metrics());
+  m_Queue->Add(m_MuxBatch, 0, m_MuxBatchDTS);
+  m_MuxBatch = NULL;
+  m_MuxBatchCount = 0;
+  m_MuxRefs.clear();
+}
+
+void cLiveStreamer::putStreamPacket(MsgPacket* packet, sStreamPacket *pkt, bool batch)
+{
+  if(!m_DeltaTimestamps)
+  {
+    // pid + pts + dts + size
+    packet->put_U16(pkt->pid);
+    packet->put_S64(pkt->pts);
+    packet->put_S64(pkt->dts);
+    packet->put_U32(pkt->size);
+  }
+  else
+  {
+    // deltas only refer to frames within the same packet,
+    // so the client can still decode if packets are dropped
+    std::map<int, sMuxRef>::iterator ref = batch ? m_MuxRefs.find(pkt->pid) : m_MuxRefs.end();
+    bool delta = (ref != m_MuxRefs.end());
+    uint8_t flags = 0;
+
+    if(pkt->pts == pkt->dts)
+      flags |= XVDR_MUXPKT_PTSEQUALSDTS;
+    if(delta && pkt->duration == ref->second.duration)
+      flags |= XVDR_MUXPKT_SAMEDURATION;
+    if(delta)
+      flags |= XVDR_MUXPKT_DELTADTS;
+
+    packet->put_U8(flags);
+    packet->put_VarU64(pkt->pid);
+    packet->put_VarS64(delta ? pkt->dts - ref->second.dts : pkt->dts);
+
+    if(!(flags & XVDR_MUXPKT_PTSEQUALSDTS))
+      packet->put_VarS64(pkt->pts - pkt->dts);
+    if(!(flags & XVDR_MUXPKT_SAMEDURATION))
+      packet->put_VarU64(pkt->duration);
+
+    packet->put_VarU64(pkt->size);
+
+    if(batch)
+    {
+      sMuxRef& r = m_MuxRefs[pkt->pid];
+      r.dts = pkt->dts;
+      r.duration = pkt->duration;
+    }
+  }
+
+  // write payload into stream packet (reference the parser buffer if possible)
+  if(pkt->segment != NULL)
+    packet->put_Segment(pkt->segment, pkt->data - pkt->segment->data(), pkt->size);
+  else
+    packet->put_Blob(pkt->data, pkt->size);
+}
+
 void cLiveStreamer::sendStreamChange()
 {
+  // frames of the old stream layout go first
+  flushMuxBatch();
+
   MsgPacket* resp = new MsgPacket(XVDR_STREAM_CHANGE, XVDR_CHANNEL_STREAM);
 
   DEBUGLOG("sendStreamChange");
@@ -539,11 +719,78 @@ void cLiveStreamer::sendStreamChange()
 
 void cLiveStreamer::sendStatus(int status)
 {
+  flushMuxBatch();
+
   MsgPacket* packet = new MsgPacket(XVDR_STREAM_STATUS, XVDR_CHANNEL_STREAM);
   packet->put_U32(status);
   m_Queue->Add(packet);
 }
 
+void cLiveStreamer::sendQueueStatus()
+{
+  sQueueStatus status;
+
+  // nothing is sent while the client is paused
+  if(!m_Queue->GetStatus(status))
+    return;
+
+  // reported directly, it shouldn't wait in the queue it describes
+  MsgPacket* packet = new MsgPacket(XVDR_STREAM_QUEUESTATUS, XVDR_CHANNEL_STREAM);
+  packet->put_U32(status.packets);
+  packet->put_U32(status.bytes);
+  packet->put_U32(status.maxbytes);
+  packet->put_U32(status.time);
+  packet->put_U32(status.maxtime);
+  packet->put_U32(status.bitrate);
+  packet->put_U32(status.dropped);
+
+  m_SendQueue->Send(packet);
+}
+
+int cLiveStreamer::BufferSize(const cChannel *channel)
+{
+  uint32_t bitrate = 0;
+
+  if (channel != NULL)
+  {
+    cMutexLock lock(&m_BitratesLock);
+    std::map<uint32_t, uint32_t>::iterator i = m_Bitrates.find(CreateChannelUID(channel));
+
+    if (i != m_Bitrates.end())
+      bitrate = i->second;
+  }
+
+  // unknown channels get the full size
+  if (bitrate == 0)
+    return RINGBUFFER_MAXSIZE;
+
+  uint64_t size = (uint64_t)bitrate * RINGBUFFER_TIME / 1000;
+
+  if (size < RINGBUFFER_MINSIZE)
+    return RINGBUFFER_MINSIZE;
+
+  return (size > RINGBUFFER_MAXSIZE) ? RINGBUFFER_MAXSIZE : (int)size;
+}
+
+void cLiveStreamer::StoreBitrate(uint32_t uid, uint32_t bitrate)
+{
+  cMutexLock lock(&m_BitratesLock);
+
+  // rates above this would only size the buffer beyond its maximum
+  if (bitrate > (uint64_t)RINGBUFFER_MAXSIZE * 1000 / RINGBUFFER_TIME)
+    bitrate = (uint64_t)RINGBUFFER_MAXSIZE * 1000 / RINGBUFFER_TIME;
+
+  // follow a new peak at once, the buffer has to take the busiest part
+  // of the program. let it decay slowly afterwards (1/8 per sample), so a
+  // single spike doesn't oversize the buffer of this channel for good.
+  uint32_t& stored = m_Bitrates[uid];
+
+  if (bitrate >= stored)
+    stored = bitrate;
+  else
+    stored -= (stored - bitrate) / 8;
+}
+
 void cLiveStreamer::sendSignalInfo()
 {
   /* If no frontend is found m_Frontend is set to -2, in this case
@@ -779,6 +1026,28 @@ void cLiveStreamer::reorderStreams(int lang, eStreamType type)
   m_FilterMutex.Unlock();
 }
 
+cMetricSet* cLiveStreamer::Metrics()
+{
+  return (m_SendQueue != NULL) ? m_SendQueue->Metrics() : NULL;
+}
+
+void cLiveStreamer::SetMuxBatching(bool on)
+{
+  m_MuxBatching = on;
+  updateTimeShiftKey();
+}
+
+void cLiveStreamer::SetDeltaTimestamps(bool on)
+{
+  m_DeltaTimestamps = on;
+  updateTimeShiftKey();
+}
+
+void cLiveStreamer::SetQueueStatus(bool on)
+{
+  m_QueueStatus = on;
+}
+
 void cLiveStreamer::SetLanguage(int lang, eStreamType streamtype)
 {
   if(lang == -1)
@@ -786,6 +1055,18 @@ void cLiveStreamer::SetLanguage(int lang, eStreamType streamtype)
 
   m_LanguageIndex = lang;
   m_LangStreamType = streamtype;
+  updateTimeShiftKey();
+}
+
+void cLiveStreamer::updateTimeShiftKey()
+{
+  if(m_Queue == NULL || m_Channel == NULL)
+    return;
+
+  // clients share the timeshift storage if they receive the same packets
+  m_Queue->SetTimeShiftKey(cString::sprintf("%s-%i-%i-%i-%i",
+    *m_Channel->GetChannelID().ToString(),
+    m_MuxBatching, m_DeltaTimestamps, m_LanguageIndex, m_LangStreamType));
 }
 
 bool cLiveStreamer::IsReady()
@@ -833,3 +1114,35 @@ void cLiveStreamer::RequestPacket()
 
   m_Queue->Request();
 }
+
+int64_t cLiveStreamer::Seek(int64_t pts)
+{
+  if(m_Queue == NULL)
+    return DVD_NOPTS_VALUE;
+
+  return m_Queue->Seek(pts);
+}
+
+int64_t cLiveStreamer::SeekRelative(int ms)
+{
+  if(m_Queue == NULL)
+    return DVD_NOPTS_VALUE;
+
+  return m_Queue->SeekRelative(ms);
+}
+
+int64_t cLiveStreamer::SeekLive()
+{
+  if(m_Queue == NULL)
+    return DVD_NOPTS_VALUE;
+
+  return m_Queue->SeekLive();
+}
+
+bool cLiveStreamer::GetTimeShiftWindow(int64_t& first, int64_t& position, int64_t& live)
+{
+  if(m_Queue == NULL)
+    return false;
+
+  return m_Queue->GetWindow(first, position, live);
+}
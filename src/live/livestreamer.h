@@ -36,6 +36,7 @@
 
 #include "demuxer/demuxer.h"
 #include <list>
+#include <map>
 
 class cChannel;
 class cLiveReceiver;
@@ -43,6 +44,9 @@ class cTSDemuxer;
 class MsgPacket;
 class cLivePatFilter;
 class cLiveQueue;
+class cSendQueue;
+class cMetricSet;
+class cLiveTrace;
 
 class cLiveStreamer : public cThread
                     , public cRingBufferLinear
@@ -51,6 +55,7 @@ private:
   friend class cTSDemuxer;
   friend class cLivePatFilter;
   friend class cChannelCache;
+  friend class cLiveReceiver;
 
   void Detach(void);
   void Attach(void);
@@ -59,10 +64,18 @@ private:
   void reorderStreams(int lang, eStreamType type);
 
   void sendStreamPacket(sStreamPacket *pkt);
+  void batchStreamPacket(sStreamPacket *pkt, bool traced);
+  void putStreamPacket(MsgPacket* packet, sStreamPacket *pkt, bool batch);
+  void flushMuxBatch();
   void sendStreamChange();
   void sendSignalInfo();
   void sendStreamInfo();
   void sendStatus(int status);
+  void sendQueueStatus();
+  void updateTimeShiftKey();
+
+  static int BufferSize(const cChannel *channel);
+  static void StoreBitrate(uint32_t uid, uint32_t bitrate);
 
   const cChannel   *m_Channel;                      /*!> Channel to stream */
   cDevice          *m_Device;                       /*!> The receiving device the channel depents to */
@@ -71,6 +84,7 @@ private:
   int               m_Priority;                     /*!> The priority over other streamers */
   std::list<cTSDemuxer*> m_Demuxers;
   int               m_socket;                       /*!> The socket class to communicate with client */
+  cSendQueue       *m_SendQueue;                    /*!> Outbound queue of the client connection */
   int               m_Frontend;                     /*!> File descriptor to access used receiving device  */
   dvb_frontend_info m_FrontendInfo;                 /*!> DVB Information about the receiving device (DVB only) */
   v4l2_capability   m_vcap;                         /*!> PVR Information about the receiving device (pvrinput only) */
@@ -84,24 +98,50 @@ private:
   int               m_LanguageIndex;
   eStreamType       m_LangStreamType;
   cLiveQueue*       m_Queue;
+  cLiveTrace*       m_Trace;                        /*!> Sampled stage timestamps (NULL if tracing is off) */
+  bool              m_MuxBatching;                  /*!> Collect small frames into XVDR_STREAM_MUXBATCH packets */
+  MsgPacket*        m_MuxBatch;                     /*!> Pending batch of frames */
+  int               m_MuxBatchCount;
+  int64_t           m_MuxBatchDTS;                  /*!> DTS of the first frame in the batch */
+  bool              m_DeltaTimestamps;              /*!> Compact mux packet records (XVDR_MUXPKT_*) */
+  bool              m_QueueStatus;                  /*!> Send XVDR_STREAM_QUEUESTATUS every second */
+
+  struct sMuxRef
+  {
+    int64_t dts;
+    int     duration;
+  };
+
+  std::map<int, sMuxRef> m_MuxRefs;                 /*!> Previous frame of each pid in the batch */
   uint32_t          m_uid;
 
+  static std::map<uint32_t, uint32_t> m_Bitrates;  /*!> Decaying peak TS bitrate of the channels (bytes/s) */
+  static cMutex     m_BitratesLock;
+
 protected:
   virtual void Action(void);
   void RequestStreamChange();
 
 public:
-  cLiveStreamer(uint32_t timeout = 0);
+  cLiveStreamer(const cChannel *channel, uint32_t timeout = 0);
   virtual ~cLiveStreamer();
 
   void Activate(bool On);
 
-  bool StreamChannel(const cChannel *channel, int priority, int sock, MsgPacket* resp);
+  bool StreamChannel(const cChannel *channel, int priority, int sock, cSendQueue* queue, MsgPacket* resp);
   bool IsReady();
   bool IsStarting() { return m_startup; }
   void SetLanguage(int lang, eStreamType streamtype = stAC3);
+  void SetMuxBatching(bool on);
+  void SetDeltaTimestamps(bool on);
+  void SetQueueStatus(bool on);
+  cMetricSet* Metrics();
   void Pause(bool on);
   void RequestPacket();
+  int64_t Seek(int64_t pts);
+  int64_t SeekRelative(int ms);
+  int64_t SeekLive();
+  bool GetTimeShiftWindow(int64_t& first, int64_t& position, int64_t& live);
 
 };
 
@@ -0,0 +1,338 @@
+/*
+ *      vdr-plugin-xvdr - XBMC server plugin for VDR
+ *
+ *      Copyright (C) 2012 Alexander Pipelka
+ *
+ *      http://www.xbmc.org
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "config/config.h"
+#include "net/msgpacket.h"
+#include "livetrace.h"
+
+// traces of packets older than this have been dropped on the way (us)
+#define TRACE_EXPIRE 10000000
+
+int cLiveTrace::SampleRate = 0;
+cLatencyHistogram cLiveTrace::Latency[cLiveTrace::StageCount];
+cMutex cLiveTrace::Lock;
+cLiveTrace* cLiveTrace::Traces = NULL;
+int cLiveTrace::NextId = 1;
+
+// names of the time spent before reaching a stage
+static const char* stagenames[cLiveTrace::StageCount] = {
+  "total",
+  "ringbuffer",
+  "demux",
+  "mux",
+  "livequeue",
+  "sendqueue"
+};
+
+cLiveTrace::cLiveTrace(const std::string& name) : m_name(name), m_receivedHead(0), m_writepos(0), m_receivedTail(0), m_readpos(0), m_readtime(0), m_offset(0), m_count(0), m_active(0), m_ringHead(0)
+{
+  memset((void*)m_received, 0, sizeof(m_received));
+  memset((void*)m_inflight, 0, sizeof(m_inflight));
+  memset((void*)m_ring, 0, sizeof(m_ring));
+
+  cMutexLock lock(&Lock);
+
+  m_id = NextId++;
+  m_next = Traces;
+  Traces = this;
+}
+
+cLiveTrace::~cLiveTrace()
+{
+  cMutexLock lock(&Lock);
+
+  for(cLiveTrace** p = &Traces; *p != NULL; p = &(*p)->m_next)
+  {
+    if(*p == this)
+    {
+      *p = m_next;
+      break;
+    }
+  }
+}
+
+void cLiveTrace::SetSampleRate(int n)
+{
+  SampleRate = (n < 0) ? 0 : n;
+  DEBUGLOG("TRACESAMPLERATE: %i", SampleRate);
+}
+
+int cLiveTrace::GetSampleRate()
+{
+  return SampleRate;
+}
+
+cLatencyHistogram* cLiveTrace::GetHistogram(int stage)
+{
+  return (stage >= 0 && stage < StageCount) ? &Latency[stage] : NULL;
+}
+
+const char* cLiveTrace::StageName(int stage)
+{
+  return (stage >= 0 && stage < StageCount) ? stagenames[stage] : "";
+}
+
+void cLiveTrace::Received(int bytes)
+{
+  uint64_t now = cMetrics::Now();
+  uint32_t head = m_receivedHead;
+
+  m_writepos += bytes;
+
+  // the device delivers single TS packets, log one entry per millisecond
+  if(head > 0 && now - m_received[(head - 1) % ReceiveLog].time < 1000)
+  {
+    m_received[(head - 1) % ReceiveLog].end = m_writepos;
+    return;
+  }
+
+  sReceived& r = m_received[head % ReceiveLog];
+  r.time = now;
+  r.end = m_writepos;
+
+  __sync_synchronize();
+  m_receivedHead = head + 1;
+}
+
+void cLiveTrace::ChunkRead()
+{
+  m_readtime = cMetrics::Now();
+}
+
+uint64_t cLiveTrace::ReceiveTime(uint64_t pos)
+{
+  uint32_t head = m_receivedHead;
+  __sync_synchronize();
+
+  // older entries have been overwritten, the oldest one gives a lower bound
+  if(head - m_receivedTail >= ReceiveLog)
+    m_receivedTail = head - ReceiveLog + 1;
+
+  while(m_receivedTail != head)
+  {
+    sReceived& r = m_received[m_receivedTail % ReceiveLog];
+
+    if(r.end >= pos)
+      return (r.time < m_readtime) ? r.time : m_readtime;
+
+    m_receivedTail++;
+  }
+
+  return m_readtime;
+}
+
+bool cLiveTrace::Sample()
+{
+  return (SampleRate > 0 && ++m_count % SampleRate == 0);
+}
+
+cLiveTrace::sInFlight* cLiveTrace::Find(uint32_t uid)
+{
+  for(int i = 0; i < MaxInFlight; i++)
+  {
+    if(m_inflight[i].uid == uid)
+      return &m_inflight[i];
+  }
+
+  return NULL;
+}
+
+void cLiveTrace::Begin(uint32_t uid)
+{
+  // a batch carrying more than one sampled frame is traced once
+  if(uid == 0 || Find(uid) != NULL)
+    return;
+
+  uint64_t now = cMetrics::Now();
+  sInFlight* f = NULL;
+
+  for(int i = 0; i < MaxInFlight && f == NULL; i++)
+  {
+    uint32_t old = m_inflight[i].uid;
+
+    if(old == 0 && __sync_bool_compare_and_swap(&m_inflight[i].uid, 0, uid))
+    {
+      f = &m_inflight[i];
+      __sync_fetch_and_add(&m_active, 1);
+    }
+    // take over the slot of a packet which never made it to the socket
+    else if(old != 0 && now - m_inflight[i].created > TRACE_EXPIRE && __sync_bool_compare_and_swap(&m_inflight[i].uid, old, uid))
+      f = &m_inflight[i];
+  }
+
+  if(f == NULL)
+    return;
+
+  memset(f->time, 0, sizeof(f->time));
+  f->created = now;
+  f->time[Receive] = ReceiveTime(m_readpos + m_offset);
+  f->time[Read] = m_readtime;
+  f->time[Parse] = now;
+}
+
+bool cLiveTrace::Stage(uint32_t uid, int stage)
+{
+  if(m_active == 0)
+    return false;
+
+  sInFlight* f = Find(uid);
+
+  if(f == NULL)
+    return false;
+
+  f->time[stage] = cMetrics::Now();
+  return true;
+}
+
+void cLiveTrace::Written(MsgPacket* p)
+{
+  if(m_active == 0)
+    return;
+
+  sInFlight* f = Find(p->getUID());
+
+  if(f == NULL)
+    return;
+
+  f->time[Write] = cMetrics::Now();
+  Finish(f);
+}
+
+void cLiveTrace::Finish(sInFlight* f)
+{
+  for(int i = Read; i < StageCount; i++)
+  {
+    if(f->time[i] != 0 && f->time[i - 1] != 0)
+      Latency[i].Add((f->time[i] > f->time[i - 1]) ? f->time[i] - f->time[i - 1] : 0);
+  }
+
+  Latency[Receive].Add(f->time[Write] - f->time[Receive]);
+
+  // only the writer of the connection finishes traces, readers check the sequence
+  sSlot& s = m_ring[m_ringHead % RingSize];
+
+  __sync_fetch_and_add(&s.seq, 1);
+  s.record.uid = f->uid;
+  memcpy(s.record.time, f->time, sizeof(s.record.time));
+  __sync_fetch_and_add(&s.seq, 1);
+
+  m_ringHead++;
+
+  __sync_lock_release(&f->uid);
+  __sync_fetch_and_sub(&m_active, 1);
+}
+
+void cLiveTrace::GetRecords(std::vector<sRecord>& records)
+{
+  for(int i = 0; i < RingSize; i++)
+  {
+    uint32_t seq = m_ring[i].seq;
+    __sync_synchronize();
+
+    // empty or being written
+    if(seq == 0 || (seq & 1))
+      continue;
+
+    sRecord r = m_ring[i].record;
+    __sync_synchronize();
+
+    if(m_ring[i].seq == seq)
+      records.push_back(r);
+  }
+}
+
+static std::string escape(const std::string& s)
+{
+  std::string result;
+
+  for(std::string::const_iterator i = s.begin(); i != s.end(); i++)
+  {
+    if(*i == '"' || *i == '\\')
+      result += '\\';
+
+    if((unsigned char)*i >= 0x20)
+      result += *i;
+  }
+
+  return result;
+}
+
+int cLiveTrace::Dump(const char* filename)
+{
+  FILE* f = fopen(filename, "w");
+
+  if(f == NULL)
+  {
+    ERRORLOG("Unable to create trace file '%s'", filename);
+    return -1;
+  }
+
+  int count = 0;
+  const char* separator = "";
+
+  fprintf(f, "{\"traceEvents\":[");
+
+  cMutexLock lock(&Lock);
+
+  for(cLiveTrace* t = Traces; t != NULL; t = t->m_next)
+  {
+    // one process per stream, one thread per stage
+    fprintf(f, "%s\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%i,\"args\":{\"name\":\"%s\"}}", separator, t->m_id, escape(t->m_name).c_str());
+    separator = ",";
+
+    for(int i = Read; i < StageCount; i++)
+      fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%i,\"tid\":%i,\"args\":{\"name\":\"%s\"}}", t->m_id, i, stagenames[i]);
+
+    std::vector<sRecord> records;
+    t->GetRecords(records);
+
+    for(std::vector<sRecord>::iterator r = records.begin(); r != records.end(); r++)
+    {
+      for(int i = Read; i < StageCount; i++)
+      {
+        if(r->time[i] == 0 || r->time[i - 1] == 0)
+          continue;
+
+        uint64_t duration = (r->time[i] > r->time[i - 1]) ? r->time[i] - r->time[i - 1] : 0;
+
+        fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"live\",\"ph\":\"X\",\"pid\":%i,\"tid\":%i,\"ts\":%llu,\"dur\":%llu,\"args\":{\"uid\":%u}}",
+                stagenames[i], t->m_id, i, (unsigned long long)r->time[i - 1], (unsigned long long)duration, r->uid);
+        count++;
+      }
+    }
+  }
+
+  fprintf(f, "\n]}\n");
+
+  if(fclose(f) != 0)
+  {
+    ERRORLOG("Unable to write trace file '%s'", filename);
+    return -1;
+  }
+
+  return count;
+}
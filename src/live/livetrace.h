@@ -0,0 +1,191 @@
+/*
+ *      vdr-plugin-xvdr - XBMC server plugin for VDR
+ *
+ *      Copyright (C) 2012 Alexander Pipelka
+ *
+ *      http://www.xbmc.org
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef XVDR_LIVETRACE_H
+#define XVDR_LIVETRACE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <vdr/thread.h>
+
+#include "net/metrics.h"
+#include "net/sendqueue.h"
+
+class MsgPacket;
+
+// Sampled stage timestamps of the live pipeline
+// (receiver -> ring buffer -> demuxer -> live queue -> send queue -> socket).
+// Every n-th stream packet is traced. Its timestamps are collected in a small table of
+// packets in flight (matched by the packet uid) and moved into a fixed size ring of
+// finished traces once the packet has been written to the socket. The stream path
+// doesn't take any locks, untraced packets only cost a counter check.
+
+class cLiveTrace : public cSendTracer
+{
+public:
+
+  enum Stage
+  {
+    Receive,          // data put into the ring buffer by the receiver
+    Read,             // data taken from the ring buffer by the streamer thread
+    Parse,            // frame assembled by the demuxer
+    Queue,            // packet handed over to the live queue
+    Send,             // packet handed over to the send queue
+    Write,            // packet written to the socket
+    StageCount
+  };
+
+  enum
+  {
+    RingSize = 1024,  // finished traces kept per stream
+    MaxInFlight = 16, // traced packets on their way to the client
+    ReceiveLog = 256  // recent receiver writes (ring buffer position -> time)
+  };
+
+  struct sRecord
+  {
+    uint32_t uid;
+    uint64_t time[StageCount];
+  };
+
+  cLiveTrace(const std::string& name);
+
+  virtual ~cLiveTrace();
+
+  // receiver thread: bytes have been put into the ring buffer
+  void Received(int bytes);
+
+  // streamer thread: a chunk has been taken from the ring buffer
+  void ChunkRead();
+
+  // streamer thread: end of the TS packet being processed (offset into the chunk)
+  void SetOffset(int offset) { m_offset = offset; }
+
+  // streamer thread: bytes of the chunk have been consumed
+  void Consumed(int bytes) { m_readpos += bytes; }
+
+  // streamer thread: trace this frame ?
+  bool Sample();
+
+  // streamer thread: start a trace for the packet carrying the current frame
+  void Begin(uint32_t uid);
+
+  // record a stage of a traced packet (returns false if the packet isn't traced)
+  bool Stage(uint32_t uid, int stage);
+
+  // send queue: a traced packet has been written
+  void Written(MsgPacket* p);
+
+  // finished traces
+  void GetRecords(std::vector<sRecord>& records);
+
+  const std::string& Name() { return m_name; }
+
+  // latency of a stage (time since the previous stage), the first stage holds the total
+  static cLatencyHistogram* GetHistogram(int stage);
+
+  static const char* StageName(int stage);
+
+  // trace every n-th stream packet (0 = off)
+  static void SetSampleRate(int n);
+
+  static int GetSampleRate();
+
+  // write the finished traces of all streams as Chrome trace (JSON), returns the number of events
+  static int Dump(const char* filename);
+
+private:
+
+  struct sInFlight
+  {
+    volatile uint32_t uid;
+    uint64_t created;
+    uint64_t time[StageCount];
+  };
+
+  struct sReceived
+  {
+    volatile uint64_t end;
+    volatile uint64_t time;
+  };
+
+  struct sSlot
+  {
+    volatile uint32_t seq;
+    sRecord record;
+  };
+
+  sInFlight* Find(uint32_t uid);
+
+  uint64_t ReceiveTime(uint64_t pos);
+
+  void Finish(sInFlight* f);
+
+  std::string m_name;
+
+  int m_id;
+
+  cLiveTrace* m_next;
+
+  // receiver log (written by the receiver, read by the streamer)
+  sReceived m_received[ReceiveLog];
+
+  volatile uint32_t m_receivedHead;
+
+  uint64_t m_writepos;
+
+  // streamer state
+  uint32_t m_receivedTail;
+
+  uint64_t m_readpos;
+
+  uint64_t m_readtime;
+
+  int m_offset;
+
+  uint32_t m_count;
+
+  // packets in flight
+  sInFlight m_inflight[MaxInFlight];
+
+  volatile int m_active;
+
+  // finished traces (seqlock per slot)
+  sSlot m_ring[RingSize];
+
+  volatile uint32_t m_ringHead;
+
+  static int SampleRate;
+
+  static cLatencyHistogram Latency[StageCount];
+
+  static cMutex Lock;
+
+  static cLiveTrace* Traces;
+
+  static int NextId;
+};
+
+#endif // XVDR_LIVETRACE_H
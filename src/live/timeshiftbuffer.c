@@ -0,0 +1,779 @@
+/*
+ *      vdr-plugin-xvdr - XBMC server plugin for VDR
+ *
+ *      Copyright (C) 2012 Alexander Pipelka
+ *
+ *      http://www.xbmc.org
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config/config.h"
+#include "demuxer/demuxer.h"
+#include "net/metrics.h"
+#include "net/msgpacket.h"
+#include "xvdr/xvdrcommand.h"
+#include "timeshiftbuffer.h"
+
+#define TIMESHIFT_MAGIC "XVDRTSB2"
+
+// the ring starts on a page boundary after the header
+#define HEADER_SIZE 4096
+
+// O_DIRECT needs buffers, offsets and sizes aligned to the logical block size
+#define ALIGNMENT 4096
+
+// blocks waiting for the writer thread (per buffer)
+#define MAX_PENDING 8
+
+// written after the last record of a block
+#define END_MARKER 0xFFFFFFFF
+
+#define NO_SEQUENCE ((uint64_t)-1)
+
+bool cTimeShiftBuffer::DirectIO = false;
+
+static cLatencyHistogram writeLatency;
+
+static bool preallocate(int fd, uint64_t size)
+{
+#ifdef __FreeBSD__
+  return (posix_fallocate(fd, 0, size) == 0);
+#else
+  return (fallocate(fd, 0, 0, size) == 0);
+#endif
+}
+
+static uint8_t* allocAligned(uint32_t size)
+{
+  void* p = NULL;
+
+  if(posix_memalign(&p, ALIGNMENT, size) != 0)
+    return NULL;
+
+  memset(p, 0, size);
+  return (uint8_t*)p;
+}
+
+sTimeShiftCursor::sTimeShiftCursor() : resend(NULL)
+{
+  Reset();
+}
+
+sTimeShiftCursor::~sTimeShiftCursor()
+{
+  delete resend;
+}
+
+void sTimeShiftCursor::Reset()
+{
+  delete resend;
+
+  read = 0;
+  position = DVD_NOPTS_VALUE;
+  skip = DVD_NOPTS_VALUE;
+  resend = NULL;
+  layout = NO_SEQUENCE;
+  overruns = 0;
+}
+
+cTimeShiftBuffer::cTimeShiftBuffer(cMetricSet* metrics) : cThread("VDR XVDR Timeshift"), m_fd(-1), m_size(0), m_fileFailed(false), m_metrics(metrics), m_memoryFirst(0), m_memoryBytes(0), m_memoryLimit(0), m_next(0), m_lastDTS(DVD_NOPTS_VALUE), m_live(DVD_NOPTS_VALUE), m_dropped(0), m_videoDropped(false), m_blocks(0), m_nextBlock(0), m_current(NULL), m_readblock(NULL), m_readnumber(NO_SEQUENCE), m_header(NULL)
+{
+}
+
+cTimeShiftBuffer::~cTimeShiftBuffer()
+{
+  Close();
+}
+
+bool cTimeShiftBuffer::Open(const char* filename, uint64_t size, uint64_t memory)
+{
+  Close();
+
+  m_filename = filename;
+  m_size = size;
+  m_fileFailed = false;
+  m_memoryFirst = 0;
+  m_memoryBytes = 0;
+  m_memoryLimit = memory;
+  m_next = 0;
+  m_lastDTS = DVD_NOPTS_VALUE;
+  m_live = DVD_NOPTS_VALUE;
+  m_dropped = 0;
+  m_videoDropped = false;
+
+  if(memory == 0)
+    return OpenFile();
+
+  return true;
+}
+
+bool cTimeShiftBuffer::OpenFile()
+{
+  int flags = O_CREAT | O_RDWR | O_TRUNC;
+  const char* filename = m_filename;
+
+#ifdef O_DIRECT
+  if(DirectIO)
+  {
+    m_fd = open(filename, flags | O_DIRECT, 0644);
+
+    // not supported by all filesystems (tmpfs)
+    if(m_fd == -1 && errno == EINVAL)
+      INFOLOG("O_DIRECT not supported for '%s', using buffered writes", filename);
+  }
+#endif
+
+  if(m_fd == -1)
+    m_fd = open(filename, flags, 0644);
+
+  if(m_fd == -1)
+  {
+    ERRORLOG("Unable to create timeshift buffer '%s' (%i)", filename, errno);
+    m_fileFailed = true;
+    return false;
+  }
+
+  m_blocks = m_size / BlockSize;
+
+  if(m_blocks < 2)
+    m_blocks = 2;
+
+  uint64_t total = HEADER_SIZE + m_blocks * BlockSize;
+
+  // reserve the blocks up front, so the file doesn't fragment while the ring is written
+  if(!preallocate(m_fd, total))
+  {
+    DEBUGLOG("Unable to preallocate timeshift buffer (%i)", errno);
+
+    if(ftruncate(m_fd, total) == -1)
+    {
+      ERRORLOG("Unable to resize timeshift buffer '%s' (%i)", filename, errno);
+      CloseFile();
+      m_fileFailed = true;
+      return false;
+    }
+  }
+
+  m_header = allocAligned(HEADER_SIZE);
+  m_readblock = allocAligned(BlockSize);
+
+  if(m_header == NULL || m_readblock == NULL)
+  {
+    ERRORLOG("Unable to allocate timeshift buffer");
+    CloseFile();
+    m_fileFailed = true;
+    return false;
+  }
+
+  m_nextBlock = 0;
+  m_readnumber = NO_SEQUENCE;
+
+  WriteHeader(0);
+
+  Start();
+
+  INFOLOG("Timeshift buffer '%s' created (%llu blocks of %u bytes)", filename, (unsigned long long)m_blocks, BlockSize);
+  return true;
+}
+
+void cTimeShiftBuffer::CloseFile()
+{
+  // let the writer finish the current block
+  cThread::Cancel(-1);
+  m_blockLock.Lock();
+  m_blockReady.Broadcast();
+  m_blockLock.Unlock();
+  cThread::Cancel(10);
+
+  if(m_fd != -1)
+  {
+    close(m_fd);
+    unlink(m_filename);
+  }
+
+  // the queued blocks are lost
+  for(std::deque<sBlock*>::iterator i = m_pending.begin(); i != m_pending.end(); i++)
+  {
+    cMetrics::Add(cMetrics::TimeshiftQueue, -BlockSize, m_metrics);
+    m_free.push_back(*i);
+  }
+
+  if(m_current != NULL)
+    m_free.push_back(m_current);
+
+  for(std::vector<sBlock*>::iterator i = m_free.begin(); i != m_free.end(); i++)
+  {
+    free((*i)->data);
+    delete *i;
+  }
+
+  free(m_readblock);
+  free(m_header);
+
+  m_fd = -1;
+  m_current = NULL;
+  m_readblock = NULL;
+  m_header = NULL;
+  m_readnumber = NO_SEQUENCE;
+  m_pending.clear();
+  m_free.clear();
+  m_failed.clear();
+  m_index.clear();
+}
+
+void cTimeShiftBuffer::Close()
+{
+  CloseFile();
+
+  for(std::deque<sMemoryEntry>::iterator i = m_memory.begin(); i != m_memory.end(); i++)
+    delete i->packet;
+
+  for(std::deque<std::pair<uint64_t, MsgPacket*> >::iterator i = m_changes.begin(); i != m_changes.end(); i++)
+    delete i->second;
+
+  m_memory.clear();
+  m_memoryBytes = 0;
+  m_changes.clear();
+  m_keyframes.clear();
+}
+
+void cTimeShiftBuffer::WriteHeader(uint64_t written)
+{
+  sHeader header;
+
+  memcpy(header.magic, TIMESHIFT_MAGIC, sizeof(header.magic));
+  header.size = m_blocks * BlockSize;
+  header.blocksize = BlockSize;
+  header.count = (written < m_blocks) ? written : m_blocks;
+  header.head = (written % m_blocks) * BlockSize;
+  header.tail = ((written - header.count) % m_blocks) * BlockSize;
+
+  // the header is written as a full (aligned) block
+  memcpy(m_header, &header, sizeof(header));
+
+  if(pwrite(m_fd, m_header, HEADER_SIZE, 0) != HEADER_SIZE)
+    DEBUGLOG("Unable to write timeshift buffer header (%i)", errno);
+}
+
+void cTimeShiftBuffer::Write(MsgPacket* p, int frametype, int64_t dts, int64_t pts)
+{
+  uint64_t seq = m_next++;
+
+  if(dts != DVD_NOPTS_VALUE)
+    m_lastDTS = dts;
+
+  if(pts != DVD_NOPTS_VALUE)
+  {
+    m_live = pts;
+
+    if(frametype == PKT_I_FRAME)
+    {
+      sKeyFrame k = { pts, seq };
+      m_keyframes.push_back(k);
+    }
+  }
+
+  // keep a copy of the stream layout, a seek may skip it
+  if(p->getMsgID() == XVDR_STREAM_CHANGE && p->getType() == XVDR_CHANNEL_STREAM)
+  {
+    MsgPacket* change = p->clone();
+
+    if(change != NULL)
+      m_changes.push_back(std::make_pair(seq, change));
+  }
+
+  sMemoryEntry e = { p, frametype, dts, pts };
+  m_memory.push_back(e);
+  m_memoryBytes += p->getPacketLength();
+
+  // move the oldest packets into the file
+  while(m_memoryBytes > m_memoryLimit && !m_memory.empty())
+    Spill();
+
+  Trim();
+}
+
+void cTimeShiftBuffer::Spill()
+{
+  sMemoryEntry e = m_memory.front();
+  uint64_t seq = m_memoryFirst;
+
+  m_memory.pop_front();
+  m_memoryFirst++;
+  m_memoryBytes -= e.packet->getPacketLength();
+
+  // without a file the packets in memory are all we have
+  if(m_fd == -1 && !m_fileFailed)
+  {
+    INFOLOG("Timeshift memory exhausted, continuing in '%s'", (const char*)m_filename);
+    OpenFile();
+  }
+
+  if(m_fd == -1)
+  {
+    delete e.packet;
+    return;
+  }
+
+  // after video has been dropped, the frames are useless up to the next I-frame
+  bool video = (e.frametype != 0);
+  bool stored = (!video || !m_videoDropped || e.frametype == PKT_I_FRAME) && Append(e.packet, seq, e.dts, e.pts);
+
+  if(video)
+    m_videoDropped = !stored;
+
+  if(!stored)
+  {
+    cMetrics::Add(cMetrics::TimeshiftDropped, 1, m_metrics);
+    m_dropped++;
+
+    // a seek mustn't go to a keyframe we haven't stored
+    if(e.frametype == PKT_I_FRAME)
+    {
+      for(std::deque<sKeyFrame>::iterator i = m_keyframes.begin(); i != m_keyframes.end() && i->seq <= seq; i++)
+      {
+        if(i->seq == seq)
+        {
+          m_keyframes.erase(i);
+          break;
+        }
+      }
+    }
+  }
+
+  delete e.packet;
+}
+
+bool cTimeShiftBuffer::Append(MsgPacket* p, uint64_t seq, int64_t dts, int64_t pts)
+{
+  uint32_t length = p->getPacketLength();
+  uint32_t need = sizeof(uint32_t) + length;
+
+  if(need > BlockSize)
+  {
+    ERRORLOG("Packet too big for the timeshift buffer (%u bytes)", length);
+    return false;
+  }
+
+  if((m_current == NULL || m_current->used + need > BlockSize) && !NextBlock())
+    return false;
+
+  uint8_t* record = m_current->data + m_current->used;
+
+  memcpy(record, &length, sizeof(length));
+  p->copy(record + sizeof(length));
+
+  sIndexEntry e = { seq, m_current->number, m_current->used, length, dts, pts };
+  m_index.push_back(e);
+
+  m_current->used += need;
+  return true;
+}
+
+bool cTimeShiftBuffer::NextBlock()
+{
+  sBlock* block = NULL;
+
+  {
+    cMutexLock lock(&m_blockLock);
+
+    // the writer thread is behind, don't pile up more blocks
+    if(m_pending.size() >= MAX_PENDING)
+      return false;
+
+    if(!m_free.empty())
+    {
+      block = m_free.back();
+      m_free.pop_back();
+    }
+
+    // hand the full block over to the writer
+    if(m_current != NULL)
+    {
+      if(m_current->used + sizeof(uint32_t) <= BlockSize)
+      {
+        uint32_t marker = END_MARKER;
+        memcpy(m_current->data + m_current->used, &marker, sizeof(marker));
+      }
+
+      m_pending.push_back(m_current);
+      m_blockReady.Broadcast();
+
+      cMetrics::Add(cMetrics::TimeshiftQueue, BlockSize, m_metrics);
+      m_current = NULL;
+    }
+  }
+
+  if(block == NULL)
+  {
+    block = new sBlock;
+    block->data = allocAligned(BlockSize);
+
+    if(block->data == NULL)
+    {
+      ERRORLOG("Unable to allocate timeshift block");
+      delete block;
+      return false;
+    }
+  }
+
+  block->number = m_nextBlock++;
+  block->used = 0;
+
+  // the block takes the slot of the oldest one in the ring
+  while(!m_index.empty() && m_index.front().block + m_blocks <= block->number)
+    m_index.pop_front();
+
+  m_current = block;
+  return true;
+}
+
+void cTimeShiftBuffer::Action()
+{
+  uint64_t written = 0;
+
+  m_blockLock.Lock();
+
+  while(Running())
+  {
+    if(m_pending.empty())
+    {
+      m_blockReady.TimedWait(m_blockLock, 1000);
+      continue;
+    }
+
+    // the block stays queued (readable) until it has been written
+    sBlock* block = m_pending.front();
+
+    m_blockLock.Unlock();
+    bool rc = WriteBlock(block);
+    m_blockLock.Lock();
+
+    if(!rc)
+      m_failed.insert(block->number);
+
+    // forget the failures of overwritten blocks
+    while(!m_failed.empty() && *m_failed.begin() + m_blocks <= block->number)
+      m_failed.erase(m_failed.begin());
+
+    m_pending.pop_front();
+    m_free.push_back(block);
+
+    cMetrics::Add(cMetrics::TimeshiftQueue, -BlockSize, m_metrics);
+
+    written = block->number + 1;
+
+    m_blockLock.Unlock();
+    WriteHeader(written);
+    m_blockLock.Lock();
+  }
+
+  m_blockLock.Unlock();
+}
+
+bool cTimeShiftBuffer::WriteBlock(sBlock* block)
+{
+  uint64_t start = cMetrics::Now();
+  off_t offset = HEADER_SIZE + (block->number % m_blocks) * BlockSize;
+
+  // always the full block, O_DIRECT doesn't take partial blocks
+  ssize_t rc = pwrite(m_fd, block->data, BlockSize, offset);
+
+  writeLatency.Add(cMetrics::Now() - start);
+
+  if(rc != BlockSize)
+  {
+    ERRORLOG("Unable to write into timeshift buffer (%i)", errno);
+    return false;
+  }
+
+  return true;
+}
+
+bool cTimeShiftBuffer::LoadBlock(uint64_t number)
+{
+  if(m_readnumber == number)
+    return true;
+
+  {
+    cMutexLock lock(&m_blockLock);
+
+    if(m_failed.find(number) != m_failed.end())
+      return false;
+  }
+
+  off_t offset = HEADER_SIZE + (number % m_blocks) * BlockSize;
+
+  if(pread(m_fd, m_readblock, BlockSize, offset) != BlockSize)
+  {
+    ERRORLOG("Unable to read from timeshift buffer (%i)", errno);
+    m_readnumber = NO_SEQUENCE;
+    return false;
+  }
+
+  m_readnumber = number;
+  return true;
+}
+
+MsgPacket* cTimeShiftBuffer::Fetch(uint64_t seq, int64_t& dts, int64_t& pts)
+{
+  // still in memory ?
+  if(seq >= m_memoryFirst)
+  {
+    if(seq >= m_next)
+      return NULL;
+
+    sMemoryEntry& e = m_memory[seq - m_memoryFirst];
+    dts = e.dts;
+    pts = e.pts;
+
+    // the packet stays here (a seek may come back to it)
+    return e.packet->clone();
+  }
+
+  // find the record in the file index
+  size_t lo = 0;
+  size_t hi = m_index.size();
+
+  while(lo < hi)
+  {
+    size_t mid = (lo + hi) / 2;
+
+    if(m_index[mid].seq < seq)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if(lo == m_index.size() || m_index[lo].seq != seq)
+    return NULL;
+
+  sIndexEntry& e = m_index[lo];
+  uint32_t offset = e.offset + sizeof(uint32_t);
+
+  dts = e.dts;
+  pts = e.pts;
+
+  // block not written yet ?
+  if(m_current != NULL && m_current->number == e.block)
+    return MsgPacket::restore(m_current->data + offset, e.length);
+
+  {
+    cMutexLock lock(&m_blockLock);
+
+    for(std::deque<sBlock*>::iterator i = m_pending.begin(); i != m_pending.end(); i++)
+    {
+      if((*i)->number == e.block)
+        return MsgPacket::restore((*i)->data + offset, e.length);
+    }
+  }
+
+  if(!LoadBlock(e.block))
+    return NULL;
+
+  return MsgPacket::restore(m_readblock + offset, e.length);
+}
+
+uint64_t cTimeShiftBuffer::Oldest()
+{
+  return m_index.empty() ? m_memoryFirst : m_index.front().seq;
+}
+
+void cTimeShiftBuffer::Trim()
+{
+  uint64_t oldest = Oldest();
+
+  while(!m_keyframes.empty() && m_keyframes.front().seq < oldest)
+    m_keyframes.pop_front();
+
+  // the layout of the oldest packet is still needed
+  while(m_changes.size() > 1 && m_changes[1].first <= oldest)
+  {
+    delete m_changes.front().second;
+    m_changes.pop_front();
+  }
+}
+
+void cTimeShiftBuffer::Join(sTimeShiftCursor& c, int64_t dts)
+{
+  c.Reset();
+  c.read = m_next;
+  c.skip = dts;
+
+  if(dts == DVD_NOPTS_VALUE)
+    return;
+
+  // go back to the first packet the reader hasn't received (if it is behind)
+  for(uint64_t seq = m_next; seq > m_memoryFirst; seq--)
+  {
+    int64_t d = m_memory[seq - 1 - m_memoryFirst].dts;
+
+    if(d != DVD_NOPTS_VALUE && d <= dts)
+      return;
+
+    c.read = seq - 1;
+  }
+
+  for(std::deque<sIndexEntry>::reverse_iterator i = m_index.rbegin(); i != m_index.rend(); i++)
+  {
+    if(i->dts != DVD_NOPTS_VALUE && i->dts <= dts)
+      return;
+
+    c.read = i->seq;
+  }
+}
+
+MsgPacket* cTimeShiftBuffer::Read(sTimeShiftCursor& c)
+{
+  if(c.resend != NULL)
+  {
+    MsgPacket* p = c.resend;
+    c.resend = NULL;
+    return p;
+  }
+
+  uint64_t oldest = Oldest();
+
+  if(c.read < oldest)
+  {
+    c.overruns += oldest - c.read;
+    c.read = oldest;
+  }
+
+  while(c.read < m_next)
+  {
+    int64_t dts = DVD_NOPTS_VALUE;
+    int64_t pts = DVD_NOPTS_VALUE;
+    uint64_t seq = c.read++;
+    MsgPacket* p = Fetch(seq, dts, pts);
+
+    // lost with its block, continue with the next packet
+    if(p == NULL)
+    {
+      c.overruns++;
+      continue;
+    }
+
+    // the reader is ahead of the writer, it has received these packets live
+    if(c.skip != DVD_NOPTS_VALUE && dts != DVD_NOPTS_VALUE)
+    {
+      if(dts <= c.skip)
+      {
+        delete p;
+        continue;
+      }
+
+      c.skip = DVD_NOPTS_VALUE;
+    }
+
+    if(pts != DVD_NOPTS_VALUE)
+      c.position = pts;
+
+    if(p->getMsgID() == XVDR_STREAM_CHANGE && p->getType() == XVDR_CHANNEL_STREAM)
+      c.layout = seq;
+
+    return p;
+  }
+
+  return NULL;
+}
+
+uint32_t cTimeShiftBuffer::Available(sTimeShiftCursor& c)
+{
+  uint64_t oldest = Oldest();
+  uint64_t start = (c.read > oldest) ? c.read : oldest;
+
+  return (uint32_t)(m_next - start) + (c.resend != NULL ? 1 : 0);
+}
+
+void cTimeShiftBuffer::SeekTo(sTimeShiftCursor& c, uint64_t seq)
+{
+  // the stream layout at the new position
+  std::pair<uint64_t, MsgPacket*>* layout = NULL;
+
+  for(std::deque<std::pair<uint64_t, MsgPacket*> >::iterator i = m_changes.begin(); i != m_changes.end() && i->first < seq; i++)
+    layout = &(*i);
+
+  delete c.resend;
+  c.resend = NULL;
+
+  // send it first if the client has a different one
+  if(layout != NULL && layout->first != c.layout)
+  {
+    c.resend = layout->second->clone();
+    c.layout = layout->first;
+  }
+
+  c.read = seq;
+  c.skip = DVD_NOPTS_VALUE;
+}
+
+int64_t cTimeShiftBuffer::Seek(sTimeShiftCursor& c, int64_t pts)
+{
+  if(m_keyframes.empty())
+    return DVD_NOPTS_VALUE;
+
+  std::deque<sKeyFrame>::iterator k = m_keyframes.begin();
+
+  for(std::deque<sKeyFrame>::iterator i = m_keyframes.begin(); i != m_keyframes.end(); i++)
+  {
+    if(i->pts <= pts)
+      k = i;
+  }
+
+  SeekTo(c, k->seq);
+  c.position = k->pts;
+
+  return k->pts;
+}
+
+int64_t cTimeShiftBuffer::SeekLive(sTimeShiftCursor& c)
+{
+  if(m_keyframes.empty())
+    return DVD_NOPTS_VALUE;
+
+  SeekTo(c, m_keyframes.back().seq);
+  c.position = m_keyframes.back().pts;
+
+  return c.position;
+}
+
+void cTimeShiftBuffer::GetWindow(sTimeShiftCursor& c, int64_t& first, int64_t& position, int64_t& live)
+{
+  first = m_keyframes.empty() ? DVD_NOPTS_VALUE : m_keyframes.front().pts;
+  position = c.position;
+  live = m_live;
+}
+
+void cTimeShiftBuffer::SetDirectIO(bool on)
+{
+  DirectIO = on;
+  DEBUGLOG("TIMESHIFTDIRECTIO: %s", DirectIO ? "on" : "off");
+}
+
+cLatencyHistogram& cTimeShiftBuffer::WriteLatency()
+{
+  return writeLatency;
+}
@@ -0,0 +1,259 @@
+/*
+ *      vdr-plugin-xvdr - XBMC server plugin for VDR
+ *
+ *      Copyright (C) 2012 Alexander Pipelka
+ *
+ *      http://www.xbmc.org
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef XVDR_TIMESHIFTBUFFER_H
+#define XVDR_TIMESHIFTBUFFER_H
+
+#include <stdint.h>
+#include <deque>
+#include <set>
+#include <vector>
+#include <vdr/thread.h>
+#include <vdr/tools.h>
+
+class MsgPacket;
+class cMetricSet;
+class cLatencyHistogram;
+
+// Read position of a client in a timeshift buffer.
+
+struct sTimeShiftCursor
+{
+  sTimeShiftCursor();
+
+  ~sTimeShiftCursor();
+
+  void Reset();
+
+  uint64_t read;              // sequence number of the next packet to read
+  int64_t position;           // PTS of the last video frame read
+  int64_t skip;               // skip packets up to this DTS (already received live)
+  MsgPacket* resend;          // stream change to send before the next packet
+  uint64_t layout;            // sequence number of the last stream change read
+  uint64_t overruns;          // packets lost before they have been read
+};
+
+// Timeshift storage.
+// Every packet gets a sequence number. The newest packets are kept in memory (up to
+// the memory budget), older ones are moved into a ring file which is created when
+// the budget is exceeded for the first time.
+// The file is preallocated and starts with a small header (head / tail offsets),
+// followed by a ring of blocks. Packets are collected as records (U32 length, packet
+// data) in aligned blocks in memory. A full block is handed over to the writer
+// thread, which writes it with a single pwrite (optionally with O_DIRECT, so the
+// timeshift data doesn't push recordings out of the page cache). The oldest blocks
+// are overwritten when the ring is full.
+// The positions of the packets and the video keyframes (PTS) are kept in indexes in
+// memory. Every reader has its own cursor, which can be moved to any keyframe still
+// stored.
+// Only the writer thread runs on its own, all other calls must be serialized by the
+// caller (the timeshift store).
+
+class cTimeShiftBuffer : public cThread
+{
+public:
+
+  enum
+  {
+    BlockSize = 1024*1024
+  };
+
+  cTimeShiftBuffer(cMetricSet* metrics = NULL);
+
+  virtual ~cTimeShiftBuffer();
+
+  // the file is created when more than "memory" bytes are stored (0 creates it now)
+  bool Open(const char* filename, uint64_t size, uint64_t memory);
+
+  void Close();
+
+  // append a packet (takes the ownership), frametype and PTS of video frames
+  void Write(MsgPacket* p, int frametype, int64_t dts, int64_t pts);
+
+  // DTS of the last packet written
+  int64_t LastDTS() { return m_lastDTS; }
+
+  bool IsEmpty() { return (m_next == 0); }
+
+  // place a new cursor after the packets up to dts (received live by the reader)
+  void Join(sTimeShiftCursor& c, int64_t dts);
+
+  // next packet to read (NULL if there is none)
+  MsgPacket* Read(sTimeShiftCursor& c);
+
+  // packets not yet read
+  uint32_t Available(sTimeShiftCursor& c);
+
+  // packets dropped because the writer thread didn't keep up
+  uint64_t Dropped() { return m_dropped; }
+
+  // move the cursor to the last keyframe at or before pts (the first keyframe if
+  // pts is older), returns the PTS of the keyframe (DVD_NOPTS_VALUE if there is
+  // no keyframe)
+  int64_t Seek(sTimeShiftCursor& c, int64_t pts);
+
+  // move the cursor to the newest keyframe
+  int64_t SeekLive(sTimeShiftCursor& c);
+
+  // PTS of the oldest keyframe, of the last video frame read and of the newest one
+  void GetWindow(sTimeShiftCursor& c, int64_t& first, int64_t& position, int64_t& live);
+
+  static void SetDirectIO(bool on);
+
+  // time (us) of the block writes of all buffers
+  static cLatencyHistogram& WriteLatency();
+
+protected:
+
+  struct sHeader
+  {
+    char     magic[8];
+    uint64_t size;            // size of the ring (bytes)
+    uint64_t blocksize;       // size of a block (bytes)
+    uint64_t head;            // offset of the next block
+    uint64_t tail;            // offset of the oldest block
+    uint64_t count;           // blocks in the ring
+  };
+
+  struct sBlock
+  {
+    uint8_t* data;
+    uint64_t number;          // sequence number (slot number % m_blocks in the ring)
+    uint32_t used;
+  };
+
+  struct sIndexEntry
+  {
+    uint64_t seq;             // sequence number of the packet
+    uint64_t block;           // sequence number of the block
+    uint32_t offset;          // offset of the record in the block
+    uint32_t length;          // length of the packet
+    int64_t dts;
+    int64_t pts;
+  };
+
+  struct sMemoryEntry
+  {
+    MsgPacket* packet;
+    int frametype;
+    int64_t dts;
+    int64_t pts;
+  };
+
+  struct sKeyFrame
+  {
+    int64_t pts;
+    uint64_t seq;
+  };
+
+  void Action();
+
+  bool OpenFile();
+
+  void CloseFile();
+
+  void Spill();
+
+  bool Append(MsgPacket* p, uint64_t seq, int64_t dts, int64_t pts);
+
+  MsgPacket* Fetch(uint64_t seq, int64_t& dts, int64_t& pts);
+
+  void SeekTo(sTimeShiftCursor& c, uint64_t seq);
+
+  uint64_t Oldest();
+
+  void Trim();
+
+  bool NextBlock();
+
+  bool WriteBlock(sBlock* block);
+
+  bool LoadBlock(uint64_t number);
+
+  void WriteHeader(uint64_t written);
+
+  int m_fd;
+
+  cString m_filename;
+
+  uint64_t m_size;
+
+  bool m_fileFailed;
+
+  cMetricSet* m_metrics;
+
+  // packets in memory (the newest ones)
+  std::deque<sMemoryEntry> m_memory;
+
+  uint64_t m_memoryFirst;     // sequence number of the first packet in memory
+
+  uint64_t m_memoryBytes;
+
+  uint64_t m_memoryLimit;
+
+  // packets in the file
+  std::deque<sIndexEntry> m_index;
+
+  std::deque<sKeyFrame> m_keyframes;
+
+  // stream changes (copies), the last one before the oldest packet is kept
+  std::deque<std::pair<uint64_t, MsgPacket*> > m_changes;
+
+  uint64_t m_next;            // sequence number of the next packet
+
+  int64_t m_lastDTS;
+
+  int64_t m_live;
+
+  uint64_t m_dropped;
+
+  bool m_videoDropped;        // video is dropped up to the next I-frame
+
+  uint64_t m_blocks;          // number of blocks in the ring
+
+  uint64_t m_nextBlock;       // sequence number of the next block
+
+  sBlock* m_current;          // block being filled
+
+  uint8_t* m_readblock;       // last block read from the file
+
+  uint64_t m_readnumber;
+
+  uint8_t* m_header;          // aligned header block
+
+  // shared with the writer thread
+  cMutex m_blockLock;
+
+  cCondVar m_blockReady;
+
+  std::deque<sBlock*> m_pending;      // blocks waiting to be written
+
+  std::vector<sBlock*> m_free;
+
+  std::set<uint64_t> m_failed;        // blocks which couldn't be written
+
+  static bool DirectIO;
+};
+
+#endif // XVDR_TIMESHIFTBUFFER_H
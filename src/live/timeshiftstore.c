@@ -0,0 +1,237 @@
+/*
+ *      vdr-plugin-xvdr - XBMC server plugin for VDR
+ *
+ *      Copyright (C) 2012 Alexander Pipelka
+ *
+ *      http://www.xbmc.org
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include "config/config.h"
+#include "demuxer/demuxer.h"
+#include "net/metrics.h"
+#include "net/msgpacket.h"
+#include "timeshiftstore.h"
+
+// tail of packets kept for a handover (media time and maximum packet count)
+#define TAIL_TIME    (2 * DVD_TIME_BASE)
+#define TAIL_PACKETS 1000
+
+cTimeShiftStore::StoreMap cTimeShiftStore::Stores;
+cMutex cTimeShiftStore::StoresLock;
+int cTimeShiftStore::Serial = 0;
+
+cTimeShiftStore::cTimeShiftStore(const std::string& key) : m_key(key), m_readers(0), m_writer(NULL)
+{
+}
+
+cTimeShiftStore::~cTimeShiftStore()
+{
+  for(std::map<const void*, Tail>::iterator i = m_tails.begin(); i != m_tails.end(); i++)
+    ClearTail(i->second);
+
+  m_buffer.Close();
+}
+
+void cTimeShiftStore::ClearTail(Tail& tail)
+{
+  for(Tail::iterator i = tail.begin(); i != tail.end(); i++)
+    delete i->packet;
+
+  tail.clear();
+}
+
+cTimeShiftStore* cTimeShiftStore::Acquire(const std::string& key, const char* dir, uint64_t size, uint64_t memory)
+{
+  cMutexLock lock(&StoresLock);
+
+  StoreMap::iterator i = Stores.find(key);
+
+  if(i != Stores.end())
+  {
+    cMutexLock storelock(&i->second->m_lock);
+    i->second->m_readers++;
+
+    INFOLOG("Joining timeshift of '%s' (%i readers)", key.c_str(), i->second->m_readers);
+    return i->second;
+  }
+
+  // the name must stay unique as long as the store exists
+  cString filename = cString::sprintf("%s/xvdr-ringbuffer-%05i.data", dir, ++Serial);
+  DEBUGLOG("FILE: %s", (const char*)filename);
+
+  cTimeShiftStore* store = new cTimeShiftStore(key);
+
+  if(!store->m_buffer.Open(filename, size, memory))
+  {
+    delete store;
+    return NULL;
+  }
+
+  store->m_readers = 1;
+  Stores[key] = store;
+
+  return store;
+}
+
+void cTimeShiftStore::Release(cTimeShiftStore* store, const void* reader)
+{
+  if(store == NULL)
+    return;
+
+  cMutexLock lock(&StoresLock);
+
+  {
+    cMutexLock storelock(&store->m_lock);
+
+    if(store->m_writer == reader)
+      store->m_writer = NULL;
+
+    std::map<const void*, Tail>::iterator i = store->m_tails.find(reader);
+
+    if(i != store->m_tails.end())
+    {
+      store->ClearTail(i->second);
+      store->m_tails.erase(i);
+    }
+
+    if(--store->m_readers > 0)
+      return;
+  }
+
+  INFOLOG("Removing timeshift of '%s'", store->m_key.c_str());
+
+  Stores.erase(store->m_key);
+  delete store;
+}
+
+bool cTimeShiftStore::Join(sTimeShiftCursor& c, int64_t dts)
+{
+  cMutexLock lock(&m_lock);
+
+  if(m_buffer.IsEmpty())
+  {
+    c.Reset();
+    return false;
+  }
+
+  m_buffer.Join(c, dts);
+  return true;
+}
+
+bool cTimeShiftStore::Write(const void* reader, MsgPacket* p, int frametype, int64_t dts, int64_t pts)
+{
+  cMutexLock lock(&m_lock);
+
+  if(m_writer == reader)
+  {
+    m_buffer.Write(p, frametype, dts, pts);
+    return true;
+  }
+
+  // keep the recent packets, we may have to continue for the writer
+  Tail& tail = m_tails[reader];
+  sTailEntry e = { p, frametype, dts, pts };
+  tail.push_back(e);
+
+  while(!tail.empty() && (tail.size() > TAIL_PACKETS || (dts != DVD_NOPTS_VALUE && tail.front().dts != DVD_NOPTS_VALUE && dts - tail.front().dts > TAIL_TIME)))
+  {
+    delete tail.front().packet;
+    tail.pop_front();
+  }
+
+  if(m_writer != NULL)
+    return false;
+
+  return TakeOver(reader, tail);
+}
+
+bool cTimeShiftStore::TakeOver(const void* reader, Tail& tail)
+{
+  int64_t last = m_buffer.LastDTS();
+  Tail::iterator start = tail.begin();
+  bool found = false;
+  bool newer = false;
+
+  // continue after the last packet the previous writer has stored
+  if(last != DVD_NOPTS_VALUE)
+  {
+    for(Tail::iterator i = tail.begin(); i != tail.end(); i++)
+    {
+      if(i->dts == DVD_NOPTS_VALUE)
+        continue;
+
+      if(i->dts <= last)
+      {
+        start = i + 1;
+        found = true;
+        newer = false;
+      }
+      else
+        newer = true;
+    }
+
+    // we are behind the previous writer, wait until we have something new
+    if(!newer)
+      return false;
+
+    if(!found)
+    {
+      INFOLOG("Timeshift of '%s' continues with a gap", m_key.c_str());
+      cMetrics::Add(cMetrics::TimeshiftDropped, 1);
+    }
+  }
+
+  for(Tail::iterator i = tail.begin(); i != tail.end(); i++)
+  {
+    if(i < start)
+      delete i->packet;
+    else
+      m_buffer.Write(i->packet, i->frametype, i->dts, i->pts);
+  }
+
+  tail.clear();
+  m_tails.erase(reader);
+
+  m_writer = reader;
+  return true;
+}
+
+MsgPacket* cTimeShiftStore::Read(sTimeShiftCursor& c)
+{
+  cMutexLock lock(&m_lock);
+  return m_buffer.Read(c);
+}
+
+int64_t cTimeShiftStore::Seek(sTimeShiftCursor& c, int64_t pts)
+{
+  cMutexLock lock(&m_lock);
+  return m_buffer.Seek(c, pts);
+}
+
+int64_t cTimeShiftStore::SeekLive(sTimeShiftCursor& c)
+{
+  cMutexLock lock(&m_lock);
+  return m_buffer.SeekLive(c);
+}
+
+void cTimeShiftStore::GetWindow(sTimeShiftCursor& c, int64_t& first, int64_t& position, int64_t& live)
+{
+  cMutexLock lock(&m_lock);
+  m_buffer.GetWindow(c, first, position, live);
+}
@@ -0,0 +1,115 @@
+/*
+ *      vdr-plugin-xvdr - XBMC server plugin for VDR
+ *
+ *      Copyright (C) 2012 Alexander Pipelka
+ *
+ *      http://www.xbmc.org
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef XVDR_TIMESHIFTSTORE_H
+#define XVDR_TIMESHIFTSTORE_H
+
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vdr/thread.h>
+
+#include "timeshiftbuffer.h"
+
+// Timeshift storage shared by the clients watching the same stream.
+// The stream packets of clients with the same channel and stream options are
+// identical, so a single timeshift buffer is written for all of them. One client
+// (the writer) stores its packets. The other clients keep a short tail of their
+// recent packets (a few seconds), so when the writer leaves, the next of them
+// adding a packet continues from its tail right after the DTS of the last packet
+// stored. If the tail doesn't reach back that far, the missing packets are lost
+// and the gap is counted as a dropped timeshift packet.
+// Every client reads with its own cursor. The store is deleted (and the file
+// removed) when the last client has left.
+
+class cTimeShiftStore
+{
+public:
+
+  // store of the stream with the given key (created if needed)
+  static cTimeShiftStore* Acquire(const std::string& key, const char* dir, uint64_t size, uint64_t memory);
+
+  // leave the store, the last reader deletes it
+  static void Release(cTimeShiftStore* store, const void* reader);
+
+  // place the cursor of a new reader, which has received the packets up to dts.
+  // returns false if the store is empty.
+  bool Join(sTimeShiftCursor& c, int64_t dts);
+
+  // store a packet of a reader (takes the ownership), returns false if the
+  // packet hasn't been stored (yet), because the reader isn't the writer
+  bool Write(const void* reader, MsgPacket* p, int frametype, int64_t dts, int64_t pts);
+
+  MsgPacket* Read(sTimeShiftCursor& c);
+
+  int64_t Seek(sTimeShiftCursor& c, int64_t pts);
+
+  int64_t SeekLive(sTimeShiftCursor& c);
+
+  void GetWindow(sTimeShiftCursor& c, int64_t& first, int64_t& position, int64_t& live);
+
+protected:
+
+  cTimeShiftStore(const std::string& key);
+
+  virtual ~cTimeShiftStore();
+
+  struct sTailEntry
+  {
+    MsgPacket* packet;
+    int frametype;
+    int64_t dts;
+    int64_t pts;
+  };
+
+  typedef std::deque<sTailEntry> Tail;
+
+  void ClearTail(Tail& tail);
+
+  bool TakeOver(const void* reader, Tail& tail);
+
+  std::string m_key;
+
+  cMutex m_lock;
+
+  cTimeShiftBuffer m_buffer;
+
+  int m_readers;
+
+  const void* m_writer;
+
+  // recent packets of the readers not writing
+  std::map<const void*, Tail> m_tails;
+
+  typedef std::map<std::string, cTimeShiftStore*> StoreMap;
+
+  static StoreMap Stores;
+
+  static cMutex StoresLock;
+
+  static int Serial;
+};
+
+#endif // XVDR_TIMESHIFTSTORE_H
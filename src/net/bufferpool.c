@@ -0,0 +1,263 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "bufferpool.h"
+
+// free buffers are chained through their first bytes
+
+struct PoolBuffer {
+	PoolBuffer* next;
+};
+
+struct PoolThreadCache {
+	PoolBuffer* head[MsgBufferPool::ClassCount];
+	uint32_t count[MsgBufferPool::ClassCount];
+
+	uint64_t hits[MsgBufferPool::ClassCount];
+	uint64_t misses[MsgBufferPool::ClassCount];
+	uint64_t oversize;
+	uint64_t releases;
+
+	PoolThreadCache* prev;
+	PoolThreadCache* next;
+};
+
+// cache limits (thread caches: bytes per size class, global: bytes of all free lists)
+static const uint32_t ThreadCacheSize = 1024 * 1024;
+static const uint64_t GlobalCacheSize = 16 * 1024 * 1024;
+
+static pthread_mutex_t poolmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t poolonce = PTHREAD_ONCE_INIT;
+static pthread_key_t poolkey;
+
+static PoolBuffer* globalhead[MsgBufferPool::ClassCount];
+static uint32_t globalcount[MsgBufferPool::ClassCount];
+static uint64_t globalbytes = 0;
+
+// registered thread caches and the counters of exited threads
+static PoolThreadCache* threadcaches = NULL;
+static PoolThreadCache retired;
+
+static uint32_t threadLimit(int index) {
+	uint32_t limit = ThreadCacheSize / MsgBufferPool::classSize(index);
+
+	if(limit < 4) {
+		return 4;
+	}
+
+	return (limit > 64) ? 64 : limit;
+}
+
+// move "count" buffers from the thread cache to the global list (poolmutex must be locked)
+static void flushCache(PoolThreadCache* cache, int index, uint32_t count) {
+	while(count-- > 0 && cache->head[index] != NULL) {
+		PoolBuffer* b = cache->head[index];
+		cache->head[index] = b->next;
+		cache->count[index]--;
+
+		if(globalbytes + MsgBufferPool::classSize(index) > GlobalCacheSize) {
+			free(b);
+			continue;
+		}
+
+		b->next = globalhead[index];
+		globalhead[index] = b;
+		globalcount[index]++;
+		globalbytes += MsgBufferPool::classSize(index);
+	}
+}
+
+static void destroyCache(void* data) {
+	PoolThreadCache* cache = (PoolThreadCache*)data;
+
+	pthread_mutex_lock(&poolmutex);
+
+	for(int i = 0; i < MsgBufferPool::ClassCount; i++) {
+		flushCache(cache, i, cache->count[i]);
+
+		retired.hits[i] += cache->hits[i];
+		retired.misses[i] += cache->misses[i];
+	}
+
+	retired.oversize += cache->oversize;
+	retired.releases += cache->releases;
+
+	if(cache->prev != NULL) {
+		cache->prev->next = cache->next;
+	}
+	else {
+		threadcaches = cache->next;
+	}
+
+	if(cache->next != NULL) {
+		cache->next->prev = cache->prev;
+	}
+
+	pthread_mutex_unlock(&poolmutex);
+
+	free(cache);
+}
+
+static void createKey() {
+	pthread_key_create(&poolkey, destroyCache);
+}
+
+static PoolThreadCache* threadCache() {
+	pthread_once(&poolonce, createKey);
+
+	PoolThreadCache* cache = (PoolThreadCache*)pthread_getspecific(poolkey);
+
+	if(cache != NULL) {
+		return cache;
+	}
+
+	cache = (PoolThreadCache*)calloc(1, sizeof(PoolThreadCache));
+
+	if(cache == NULL) {
+		return NULL;
+	}
+
+	pthread_mutex_lock(&poolmutex);
+
+	cache->next = threadcaches;
+
+	if(threadcaches != NULL) {
+		threadcaches->prev = cache;
+	}
+
+	threadcaches = cache;
+
+	pthread_mutex_unlock(&poolmutex);
+
+	pthread_setspecific(poolkey, cache);
+	return cache;
+}
+
+int MsgBufferPool::classIndex(uint32_t size) {
+	if(size <= MinClassSize) {
+		return 0;
+	}
+
+	// log2 of the next power of two, relative to MinClassSize (2^8)
+	return (32 - __builtin_clz(size - 1)) - 8;
+}
+
+uint8_t* MsgBufferPool::alloc(uint32_t size, uint32_t& capacity) {
+	PoolThreadCache* cache = threadCache();
+
+	if(size > MaxClassSize) {
+		if(cache != NULL) {
+			cache->oversize++;
+		}
+
+		capacity = size;
+		return (uint8_t*)malloc(size);
+	}
+
+	int index = classIndex(size);
+	capacity = classSize(index);
+
+	if(cache == NULL) {
+		return (uint8_t*)malloc(capacity);
+	}
+
+	// refill from the global list
+	if(cache->head[index] == NULL && globalhead[index] != NULL) {
+		uint32_t count = threadLimit(index) / 2;
+
+		pthread_mutex_lock(&poolmutex);
+
+		while(count-- > 0 && globalhead[index] != NULL) {
+			PoolBuffer* b = globalhead[index];
+			globalhead[index] = b->next;
+			globalcount[index]--;
+			globalbytes -= classSize(index);
+
+			b->next = cache->head[index];
+			cache->head[index] = b;
+			cache->count[index]++;
+		}
+
+		pthread_mutex_unlock(&poolmutex);
+	}
+
+	PoolBuffer* b = cache->head[index];
+
+	if(b == NULL) {
+		cache->misses[index]++;
+		return (uint8_t*)malloc(capacity);
+	}
+
+	cache->head[index] = b->next;
+	cache->count[index]--;
+	cache->hits[index]++;
+
+	return (uint8_t*)b;
+}
+
+void MsgBufferPool::release(uint8_t* buffer, uint32_t capacity) {
+	if(buffer == NULL) {
+		return;
+	}
+
+	PoolThreadCache* cache = NULL;
+
+	// alloc() rounds small sizes up to the smallest class
+	if(capacity <= MaxClassSize) {
+		cache = threadCache();
+	}
+
+	if(cache == NULL) {
+		free(buffer);
+		return;
+	}
+
+	int index = classIndex(capacity);
+
+	PoolBuffer* b = (PoolBuffer*)buffer;
+	b->next = cache->head[index];
+	cache->head[index] = b;
+	cache->count[index]++;
+	cache->releases++;
+
+	// hand over half of the cache to other threads
+	if(cache->count[index] > threadLimit(index)) {
+		pthread_mutex_lock(&poolmutex);
+		flushCache(cache, index, cache->count[index] / 2);
+		pthread_mutex_unlock(&poolmutex);
+	}
+}
+
+void MsgBufferPool::getStats(Stats& stats) {
+	memset(&stats, 0, sizeof(stats));
+
+	pthread_mutex_lock(&poolmutex);
+
+	stats.oversize = retired.oversize;
+	stats.releases = retired.releases;
+
+	for(int i = 0; i < ClassCount; i++) {
+		stats.classhits[i] = retired.hits[i];
+		stats.classmisses[i] = retired.misses[i];
+	}
+
+	stats.cached = globalbytes;
+
+	for(PoolThreadCache* cache = threadcaches; cache != NULL; cache = cache->next) {
+		stats.oversize += cache->oversize;
+		stats.releases += cache->releases;
+
+		for(int i = 0; i < ClassCount; i++) {
+			stats.classhits[i] += cache->hits[i];
+			stats.classmisses[i] += cache->misses[i];
+		}
+	}
+
+	pthread_mutex_unlock(&poolmutex);
+
+	for(int i = 0; i < ClassCount; i++) {
+		stats.hits += stats.classhits[i];
+		stats.misses += stats.classmisses[i];
+	}
+}
@@ -0,0 +1,87 @@
+/** \file bufferpool.h
+	Header file for the MsgBufferPool class.
+	This include file defines the size-classed buffer pool used for packet storage.
+*/
+
+#ifndef MSGBUFFERPOOL_H
+#define MSGBUFFERPOOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+	@short Packet buffer pool
+
+	Recycles packet buffers in power-of-two size classes (256 bytes - 256 kbytes).
+	Every thread keeps a small cache per size class, so allocating and releasing
+	buffers doesn't need a lock in the common case. Caches are exchanged in batches
+	with a global free list (packets are usually created by one thread and released
+	by another one). Larger buffers are passed to malloc / free directly.
+*/
+
+class MsgBufferPool {
+public:
+
+	enum {
+		MinClassSize = 256,						/*!< smallest pooled buffer */
+		MaxClassSize = 256 * 1024,				/*!< biggest pooled buffer */
+		ClassCount = 11							/*!< number of size classes */
+	};
+
+	/**
+	Pool statistics.
+	*/
+	struct Stats {
+		uint64_t hits;			/*!< allocations served from a free list */
+		uint64_t misses;		/*!< allocations passed to malloc */
+		uint64_t oversize;		/*!< allocations larger than the biggest size class */
+		uint64_t releases;		/*!< buffers returned to the pool */
+		uint64_t cached;		/*!< bytes held in the global free lists */
+		uint64_t classhits[ClassCount];		/*!< hits per size class */
+		uint64_t classmisses[ClassCount];	/*!< misses per size class */
+	};
+
+	/**
+	Allocate a buffer.
+	The size is rounded up to the next size class.
+
+	@param	size		minimum size of the buffer in bytes
+	@param	capacity	returns the usable size of the buffer
+	@return pointer to the buffer or NULL if memory allocation failed
+	*/
+	static uint8_t* alloc(uint32_t size, uint32_t& capacity);
+
+	/**
+	Release a buffer.
+	Return a buffer to the pool.
+
+	@param	buffer		buffer returned by alloc (may be NULL)
+	@param	capacity	capacity returned by alloc (or the size passed to alloc)
+	*/
+	static void release(uint8_t* buffer, uint32_t capacity);
+
+	/**
+	Get pool statistics.
+	Counters of active threads are read without locking, so values may be slightly off.
+
+	@param	stats		receives the current statistics
+	*/
+	static void getStats(Stats& stats);
+
+	/**
+	Get the size of a size class.
+
+	@param	index		size class index (0 - ClassCount-1)
+	@return size of the buffers in this class
+	*/
+	static uint32_t classSize(int index) {
+		return MinClassSize << index;
+	}
+
+private:
+
+	static int classIndex(uint32_t size);
+
+};
+
+#endif // MSGBUFFERPOOL_H
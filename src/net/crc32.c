@@ -0,0 +1,286 @@
+#include <string.h>
+#include <pthread.h>
+
+#include "crc32.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CRC32_HAVE_CLMUL 1
+#include <cpuid.h>
+#include <wmmintrin.h>
+#include <smmintrin.h>
+#endif
+
+// all engines work on the inverted crc register, crc32_update does the pre- and post-conditioning
+
+typedef uint32_t (*crc32_func)(uint32_t c, const uint8_t* buf, size_t size);
+
+static uint32_t crc32_tab[8][256];
+
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+
+static Crc32Engine crc32_selected = Crc32Slice8;
+
+static bool crc32_clmul_supported = false;
+
+static uint32_t crc32_resolve(uint32_t c, const uint8_t* buf, size_t size);
+
+static crc32_func crc32_impl = crc32_resolve;
+
+static uint32_t crc32_bytewise(uint32_t c, const uint8_t* p, size_t size) {
+	while(size--) {
+		c = crc32_tab[0][(c ^ *p++) & 0xFF] ^ (c >> 8);
+	}
+
+	return c;
+}
+
+static inline uint32_t crc32_load_le32(const uint8_t* p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t crc32_slice8(uint32_t c, const uint8_t* p, size_t size) {
+	while(size >= 8) {
+		uint32_t one = crc32_load_le32(p) ^ c;
+		uint32_t two = crc32_load_le32(p + 4);
+
+		c = crc32_tab[7][one & 0xFF] ^
+		    crc32_tab[6][(one >> 8) & 0xFF] ^
+		    crc32_tab[5][(one >> 16) & 0xFF] ^
+		    crc32_tab[4][one >> 24] ^
+		    crc32_tab[3][two & 0xFF] ^
+		    crc32_tab[2][(two >> 8) & 0xFF] ^
+		    crc32_tab[1][(two >> 16) & 0xFF] ^
+		    crc32_tab[0][two >> 24];
+
+		p += 8;
+		size -= 8;
+	}
+
+	return crc32_bytewise(c, p, size);
+}
+
+#ifdef CRC32_HAVE_CLMUL
+
+// folding constants for the reflected IEEE polynomial
+// (x^(4*128+32), x^(4*128-32), x^(128+32), x^(128-32), x^64 mod P and the Barrett constants)
+
+static const uint64_t __attribute__((aligned(16))) crc32_k1k2[] = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+static const uint64_t __attribute__((aligned(16))) crc32_k3k4[] = { 0x01751997d0ULL, 0x00ccaa009eULL };
+static const uint64_t __attribute__((aligned(16))) crc32_k5k0[] = { 0x0163cd6124ULL, 0x0000000000ULL };
+static const uint64_t __attribute__((aligned(16))) crc32_poly[] = { 0x01db710641ULL, 0x01f7011641ULL };
+
+// size must be a multiple of 16 and at least 64 bytes
+
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_clmul_fold(uint32_t c, const uint8_t* buf, size_t size) {
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+	__m128i y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(c));
+	x0 = _mm_load_si128((const __m128i*)crc32_k1k2);
+
+	buf += 64;
+	size -= 64;
+
+	// fold 4 x 128 bits in parallel
+	while(size >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		y5 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+		y6 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+		y7 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+		y8 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+		buf += 64;
+		size -= 64;
+	}
+
+	// fold into 128 bits
+	x0 = _mm_load_si128((const __m128i*)crc32_k3k4);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	// fold remaining 128 bit blocks
+	while(size >= 16) {
+		x2 = _mm_loadu_si128((const __m128i*)buf);
+
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+		buf += 16;
+		size -= 16;
+	}
+
+	// fold 128 bits to 64 bits
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_loadl_epi64((const __m128i*)crc32_k5k0);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// barrett reduction to 32 bits
+	x0 = _mm_load_si128((const __m128i*)crc32_poly);
+
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc32_clmul(uint32_t c, const uint8_t* p, size_t size) {
+	// folding doesn't pay off for small buffers (packet headers, status packets)
+	if(size < 256) {
+		return crc32_slice8(c, p, size);
+	}
+
+	size_t blocks = size & ~(size_t)15;
+	c = crc32_clmul_fold(c, p, blocks);
+
+	return crc32_slice8(c, p + blocks, size - blocks);
+}
+
+static bool crc32_cpu_has_clmul() {
+	unsigned int eax, ebx, ecx, edx;
+
+	if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		return false;
+	}
+
+	return (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1);
+}
+
+#endif
+
+static void crc32_init() {
+	for(uint32_t i = 0; i < 256; i++) {
+		uint32_t c = i;
+
+		for(int k = 0; k < 8; k++) {
+			c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+		}
+
+		crc32_tab[0][i] = c;
+	}
+
+	for(uint32_t i = 0; i < 256; i++) {
+		for(int k = 1; k < 8; k++) {
+			uint32_t c = crc32_tab[k - 1][i];
+			crc32_tab[k][i] = (c >> 8) ^ crc32_tab[0][c & 0xFF];
+		}
+	}
+
+	crc32_func impl = crc32_slice8;
+	crc32_selected = Crc32Slice8;
+
+#ifdef CRC32_HAVE_CLMUL
+	crc32_clmul_supported = crc32_cpu_has_clmul();
+
+	if(crc32_clmul_supported) {
+		impl = crc32_clmul;
+		crc32_selected = Crc32Clmul;
+	}
+#endif
+
+	// publish the tables before the function pointer
+	__sync_synchronize();
+	crc32_impl = impl;
+}
+
+static uint32_t crc32_resolve(uint32_t c, const uint8_t* buf, size_t size) {
+	pthread_once(&crc32_once, crc32_init);
+	return crc32_impl(c, buf, size);
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t* buf, size_t size) {
+	return ~crc32_impl(~crc, buf, size);
+}
+
+uint32_t crc32_update_engine(Crc32Engine engine, uint32_t crc, const uint8_t* buf, size_t size) {
+	pthread_once(&crc32_once, crc32_init);
+
+	switch(engine) {
+		case Crc32Bytewise:
+			return ~crc32_bytewise(~crc, buf, size);
+#ifdef CRC32_HAVE_CLMUL
+		case Crc32Clmul:
+			if(crc32_clmul_supported) {
+				return ~crc32_clmul(~crc, buf, size);
+			}
+			break;
+#endif
+		default:
+			break;
+	}
+
+	return ~crc32_slice8(~crc, buf, size);
+}
+
+bool crc32_engine_supported(Crc32Engine engine) {
+	pthread_once(&crc32_once, crc32_init);
+
+	switch(engine) {
+		case Crc32Bytewise:
+		case Crc32Slice8:
+			return true;
+		case Crc32Clmul:
+			return crc32_clmul_supported;
+		default:
+			return false;
+	}
+}
+
+Crc32Engine crc32_engine() {
+	pthread_once(&crc32_once, crc32_init);
+	return crc32_selected;
+}
+
+const char* crc32_engine_name(Crc32Engine engine) {
+	switch(engine) {
+		case Crc32Bytewise:
+			return "bytewise";
+		case Crc32Slice8:
+			return "slice-by-8";
+		case Crc32Clmul:
+			return "pclmulqdq";
+		default:
+			return "unknown";
+	}
+}
@@ -0,0 +1,72 @@
+/** \file crc32.h
+	Header file for the CRC32 engine.
+	This include file defines the CRC32 (IEEE 802.3) functions shared by
+	the message packets and the channel / recording hashes.
+*/
+
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+	CRC32 implementations.
+	The fastest supported engine is selected at runtime.
+*/
+enum Crc32Engine {
+	Crc32Bytewise = 0,			/*!< classic table lookup, one byte per iteration */
+	Crc32Slice8,				/*!< slicing-by-8, portable baseline */
+	Crc32Clmul,					/*!< carry-less multiplication folding (x86 PCLMULQDQ + SSE4.1) */
+	Crc32EngineCount
+};
+
+/**
+	Update a CRC32 checksum.
+	Continues the checksum "crc" with the data in "buf". Start with a crc value of 0,
+	the result of one call can be passed to the next one to checksum data incrementally.
+
+	@param	crc		checksum of the preceding data (0 for the first block)
+	@param	buf		pointer to data array
+	@param	size	size of array in bytes
+	@return updated 32bit crc
+*/
+uint32_t crc32_update(uint32_t crc, const uint8_t* buf, size_t size);
+
+/**
+	Update a CRC32 checksum with a specific engine.
+	Same as crc32_update but bypasses the runtime dispatch (used for benchmarking).
+	Unsupported engines fall back to slicing-by-8.
+
+	@param	engine	implementation to use
+	@param	crc		checksum of the preceding data (0 for the first block)
+	@param	buf		pointer to data array
+	@param	size	size of array in bytes
+	@return updated 32bit crc
+*/
+uint32_t crc32_update_engine(Crc32Engine engine, uint32_t crc, const uint8_t* buf, size_t size);
+
+/**
+	Check if an engine is supported by the CPU.
+
+	@param	engine	implementation to check
+	@return true if the engine can be used on this machine
+*/
+bool crc32_engine_supported(Crc32Engine engine);
+
+/**
+	Get the engine selected by the runtime dispatch.
+
+	@return active engine
+*/
+Crc32Engine crc32_engine();
+
+/**
+	Get the name of an engine.
+
+	@param	engine	implementation
+	@return human readable name
+*/
+const char* crc32_engine_name(Crc32Engine engine);
+
+#endif // CRC32_H
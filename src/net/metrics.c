@@ -0,0 +1,311 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "metrics.h"
+
+// values of a thread, chained into the list of running threads
+
+struct MetricThreadSlot {
+  volatile int64_t value[cMetrics::Count];
+  MetricThreadSlot* prev;
+  MetricThreadSlot* next;
+};
+
+static const char* names[cMetrics::Count] = {
+  "bytes_sent",
+  "packets_sent",
+  "packets_dropped",
+  "send_timeouts",
+  "ring_overflows",
+  "timeshift_writes",
+  "timeshift_bytes",
+  "timeshift_dropped",
+  "compress_in",
+  "compress_out",
+  "requests",
+  "stream_packets",
+  "clients",
+  "streams",
+  "send_backlog",
+  "send_rate",
+  "timeshift_queue"
+};
+
+static pthread_mutex_t metricmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t metriconce = PTHREAD_ONCE_INIT;
+static pthread_key_t metrickey;
+
+// slots of running threads and the values of exited threads
+static MetricThreadSlot* threadslots = NULL;
+static int64_t retired[cMetrics::Count];
+
+// registered client sets
+static cMetricSet* sets = NULL;
+
+static cRequestStats requests[cMetrics::MaxOpcodes];
+
+// lock wait time of the request running on this thread
+static __thread uint64_t lockwait = 0;
+
+static void destroySlot(void* data) {
+  MetricThreadSlot* slot = (MetricThreadSlot*)data;
+
+  pthread_mutex_lock(&metricmutex);
+
+  for(int i = 0; i < cMetrics::Count; i++)
+    retired[i] += slot->value[i];
+
+  if(slot->prev != NULL)
+    slot->prev->next = slot->next;
+  else
+    threadslots = slot->next;
+
+  if(slot->next != NULL)
+    slot->next->prev = slot->prev;
+
+  pthread_mutex_unlock(&metricmutex);
+
+  free(slot);
+}
+
+static void createKey() {
+  pthread_key_create(&metrickey, destroySlot);
+}
+
+static MetricThreadSlot* threadSlot() {
+  pthread_once(&metriconce, createKey);
+
+  MetricThreadSlot* slot = (MetricThreadSlot*)pthread_getspecific(metrickey);
+
+  if(slot != NULL)
+    return slot;
+
+  slot = (MetricThreadSlot*)calloc(1, sizeof(MetricThreadSlot));
+
+  if(slot == NULL)
+    return NULL;
+
+  pthread_mutex_lock(&metricmutex);
+
+  slot->next = threadslots;
+
+  if(threadslots != NULL)
+    threadslots->prev = slot;
+
+  threadslots = slot;
+
+  pthread_mutex_unlock(&metricmutex);
+
+  pthread_setspecific(metrickey, slot);
+  return slot;
+}
+
+void cMetrics::Add(int id, int64_t value, cMetricSet* set) {
+  MetricThreadSlot* slot = threadSlot();
+
+  if(slot != NULL)
+    slot->value[id] += value;
+
+  if(set != NULL)
+    set->Add(id, value);
+}
+
+void cMetrics::Get(Values& values) {
+  pthread_mutex_lock(&metricmutex);
+
+  for(int i = 0; i < Count; i++)
+    values.value[i] = retired[i];
+
+  for(MetricThreadSlot* slot = threadslots; slot != NULL; slot = slot->next) {
+    for(int i = 0; i < Count; i++)
+      values.value[i] += slot->value[i];
+  }
+
+  pthread_mutex_unlock(&metricmutex);
+}
+
+void cMetrics::GetSets(std::vector<std::pair<std::string, Values> >& result) {
+  pthread_mutex_lock(&metricmutex);
+
+  for(cMetricSet* set = sets; set != NULL; set = set->m_next) {
+    Values values;
+    set->Get(values);
+    result.push_back(std::make_pair(set->GetName(), values));
+  }
+
+  pthread_mutex_unlock(&metricmutex);
+}
+
+const char* cMetrics::Name(int id) {
+  return (id >= 0 && id < Count) ? names[id] : "";
+}
+
+bool cMetrics::IsGauge(int id) {
+  return (id >= Clients);
+}
+
+void cMetrics::Register(cMetricSet* set) {
+  pthread_mutex_lock(&metricmutex);
+
+  set->m_next = sets;
+  sets = set;
+
+  pthread_mutex_unlock(&metricmutex);
+}
+
+void cMetrics::Unregister(cMetricSet* set) {
+  pthread_mutex_lock(&metricmutex);
+
+  for(cMetricSet** p = &sets; *p != NULL; p = &(*p)->m_next) {
+    if(*p == set) {
+      *p = set->m_next;
+      break;
+    }
+  }
+
+  pthread_mutex_unlock(&metricmutex);
+}
+
+cMetricSet::cMetricSet() : m_next(NULL) {
+  memset((void*)m_values, 0, sizeof(m_values));
+  cMetrics::Register(this);
+}
+
+cMetricSet::~cMetricSet() {
+  cMetrics::Unregister(this);
+}
+
+void cMetricSet::SetName(const std::string& name) {
+  cMutexLock lock(&m_lock);
+  m_name = name;
+}
+
+std::string cMetricSet::GetName() {
+  cMutexLock lock(&m_lock);
+  return m_name;
+}
+
+void cMetricSet::Add(int id, int64_t value) {
+  __sync_fetch_and_add(&m_values[id], value);
+}
+
+void cMetricSet::Get(cMetrics::Values& values) {
+  for(int i = 0; i < cMetrics::Count; i++)
+    values.value[i] = m_values[i];
+}
+
+cLatencyHistogram::cLatencyHistogram() : m_count(0), m_max(0) {
+  memset((void*)m_buckets, 0, sizeof(m_buckets));
+}
+
+int cLatencyHistogram::Index(uint64_t us) {
+  if(us < SubBuckets)
+    return us;
+
+  if(us >= ((uint64_t)1 << MaxExponent))
+    us = ((uint64_t)1 << MaxExponent) - 1;
+
+  // position of the highest bit and the next 4 bits below
+  int e = 63 - __builtin_clzll(us);
+  int sub = (us >> (e - 4)) & (SubBuckets - 1);
+
+  return (e - 3) * SubBuckets + sub;
+}
+
+uint64_t cLatencyHistogram::UpperBound(int index) {
+  if(index < SubBuckets)
+    return index;
+
+  int e = index / SubBuckets + 3;
+  uint64_t sub = index % SubBuckets;
+
+  return ((SubBuckets + sub + 1) << (e - 4)) - 1;
+}
+
+void cLatencyHistogram::Add(uint64_t us) {
+  __sync_fetch_and_add(&m_buckets[Index(us)], 1);
+  __sync_fetch_and_add(&m_count, 1);
+
+  uint64_t max = m_max;
+
+  while(us > max && !__sync_bool_compare_and_swap(&m_max, max, us))
+    max = m_max;
+}
+
+uint64_t cLatencyHistogram::Count() {
+  return m_count;
+}
+
+uint64_t cLatencyHistogram::Max() {
+  return m_max;
+}
+
+uint64_t cLatencyHistogram::Percentile(double p) {
+  uint64_t count = 0;
+
+  for(int i = 0; i < Buckets; i++)
+    count += m_buckets[i];
+
+  if(count == 0)
+    return 0;
+
+  uint64_t rank = (uint64_t)(count * p / 100.0);
+
+  if(rank >= count)
+    rank = count - 1;
+
+  uint64_t seen = 0;
+
+  for(int i = 0; i < Buckets; i++) {
+    seen += m_buckets[i];
+
+    // don't report more than the biggest value seen
+    if(seen > rank) {
+      uint64_t bound = UpperBound(i);
+      return (bound < m_max) ? bound : m_max;
+    }
+  }
+
+  return m_max;
+}
+
+uint64_t cMetrics::Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void cMetrics::AddRequest(int opcode, uint64_t us, uint64_t wait, uint32_t bytes) {
+  cRequestStats* stats = GetRequestStats(opcode);
+
+  if(stats == NULL)
+    return;
+
+  stats->time.Add(us);
+  stats->lockwait.Add(wait);
+  __sync_fetch_and_add(&stats->bytes, bytes);
+
+  uint32_t max = stats->maxbytes;
+
+  while(bytes > max && !__sync_bool_compare_and_swap(&stats->maxbytes, max, bytes))
+    max = stats->maxbytes;
+}
+
+cRequestStats* cMetrics::GetRequestStats(int opcode) {
+  if(opcode < 0 || opcode >= MaxOpcodes)
+    return NULL;
+
+  return &requests[opcode];
+}
+
+void cMetrics::AddLockWait(uint64_t start) {
+  lockwait += Now() - start;
+}
+
+uint64_t cMetrics::TakeLockWait() {
+  uint64_t wait = lockwait;
+  lockwait = 0;
+  return wait;
+}
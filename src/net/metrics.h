@@ -0,0 +1,167 @@
+#ifndef XVDR_METRICS_H
+#define XVDR_METRICS_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <vdr/thread.h>
+
+class cMetricSet;
+
+// Latency histogram (microseconds).
+// Log-linear buckets (HDR style): values below 16 are exact, above that every power of two
+// is split into 16 buckets, so a percentile is off by 1/16 at most.
+
+class cLatencyHistogram {
+public:
+
+  enum {
+    SubBuckets = 16,
+    MaxExponent = 36,   // values are clamped to 2^36 us (19 hours)
+    Buckets = (MaxExponent - 3) * SubBuckets
+  };
+
+  cLatencyHistogram();
+
+  void Add(uint64_t us);
+
+  uint64_t Count();
+
+  uint64_t Max();
+
+  // upper bound of the given percentile (0 - 100)
+  uint64_t Percentile(double p);
+
+private:
+
+  static int Index(uint64_t us);
+
+  static uint64_t UpperBound(int index);
+
+  volatile uint32_t m_buckets[Buckets];
+
+  volatile uint64_t m_count;
+
+  volatile uint64_t m_max;
+
+};
+
+// Latency and response size of a request type.
+
+struct cRequestStats {
+  cLatencyHistogram time;         // total time of the request (including lock waits)
+  cLatencyHistogram lockwait;     // time spent waiting for locks
+  volatile uint64_t bytes;        // total size of the responses
+  volatile uint32_t maxbytes;     // biggest response
+};
+
+// Process wide counters and gauges.
+// Every thread updates its own copy of the values, so Add() doesn't need a lock or an
+// atomic operation. The copies are summed up on read (gauges are kept as the sum of
+// their increments and decrements). Values of running threads are read without
+// locking, so they may be slightly off.
+
+class cMetrics {
+public:
+
+  enum {
+    // counters
+    BytesSent,          // bytes written to client connections
+    PacketsSent,        // packets written to client connections
+    PacketsDropped,     // stream packets dropped (live queue full)
+    SendTimeouts,       // connections closed because the client didn't take any data
+    RingOverflows,      // bytes lost in the receiver ring buffer
+    TimeshiftWrites,    // packets written into the timeshift buffer
+    TimeshiftBytes,     // bytes written into the timeshift buffer
+    TimeshiftDropped,   // packets dropped because the timeshift writer didn't keep up
+    CompressIn,         // payload bytes passed to the compressors
+    CompressOut,        // payload bytes returned by the compressors
+    Requests,           // requests processed
+    StreamPackets,      // stream packets created
+    // gauges
+    Clients,            // connected clients
+    Streams,            // running live streams
+    SendBacklog,        // bytes queued for sending
+    SendRate,           // measured throughput of the connections (bytes/s)
+    TimeshiftQueue,     // bytes waiting for the timeshift writers
+    Count
+  };
+
+  struct Values {
+    int64_t value[Count];
+  };
+
+  // add to a metric (and to a client's set if given)
+  static void Add(int id, int64_t value, cMetricSet* set = NULL);
+
+  static void Get(Values& values);
+
+  // values of all registered sets (name, values)
+  static void GetSets(std::vector<std::pair<std::string, Values> >& sets);
+
+  static const char* Name(int id);
+
+  static bool IsGauge(int id);
+
+  enum {
+    MaxOpcodes = 256
+  };
+
+  // monotonic clock (microseconds)
+  static uint64_t Now();
+
+  // record a processed request
+  static void AddRequest(int opcode, uint64_t us, uint64_t lockwait, uint32_t bytes);
+
+  // statistics of an opcode (NULL if out of range)
+  static cRequestStats* GetRequestStats(int opcode);
+
+  // add the time since "start" to the lock wait time of the current thread
+  static void AddLockWait(uint64_t start);
+
+  // return and reset the lock wait time of the current thread
+  static uint64_t TakeLockWait();
+
+private:
+
+  friend class cMetricSet;
+
+  static void Register(cMetricSet* set);
+
+  static void Unregister(cMetricSet* set);
+
+};
+
+// Metrics of a single client.
+// Updated with atomic operations, only the threads serving the client write to it.
+
+class cMetricSet {
+public:
+
+  cMetricSet();
+
+  ~cMetricSet();
+
+  void SetName(const std::string& name);
+
+  std::string GetName();
+
+  void Add(int id, int64_t value);
+
+  void Get(cMetrics::Values& values);
+
+private:
+
+  friend class cMetrics;
+
+  cMutex m_lock;
+
+  std::string m_name;
+
+  volatile int64_t m_values[cMetrics::Count];
+
+  cMetricSet* m_next;
+
+};
+
+#endif // XVDR_METRICS_H
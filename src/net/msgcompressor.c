@@ -0,0 +1,351 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "msgcompressor.h"
+
+// LZ4 references at most 64KB of previous data
+#define LZ4_HISTORY_SIZE 65536
+
+uint8_t* MsgCompressor::globaldictionary = NULL;
+
+uint32_t MsgCompressor::globaldictionarysize = 0;
+
+uint32_t MsgCompressor::globaldictionaryid = 0;
+
+MsgCompressor::MsgCompressor(int codec, int level, bool streaming, bool dictionary) : m_codec(codec), m_streaming(streaming), m_stream(NULL), m_history(NULL), m_valid(false) {
+	if(level <= 0 || level > 9) {
+		return;
+	}
+
+	switch(m_codec) {
+#ifdef HAVE_ZLIB
+		case Zlib: {
+			z_stream* stream = (z_stream*)calloc(1, sizeof(z_stream));
+
+			if(stream == NULL) {
+				return;
+			}
+
+			if(deflateInit(stream, level) != Z_OK) {
+				free(stream);
+				return;
+			}
+
+			m_stream = stream;
+			break;
+		}
+#endif
+#ifdef HAVE_LZ4
+		case Lz4: {
+			LZ4_stream_t* stream = LZ4_createStream();
+
+			if(stream == NULL) {
+				return;
+			}
+
+			m_stream = stream;
+
+			if(m_streaming) {
+				m_history = (uint8_t*)malloc(LZ4_HISTORY_SIZE);
+
+				if(m_history == NULL) {
+					return;
+				}
+			}
+			break;
+		}
+#endif
+#ifdef HAVE_ZSTD
+		case Zstd: {
+			ZSTD_CCtx* stream = ZSTD_createCCtx();
+
+			if(stream == NULL) {
+				return;
+			}
+
+			m_stream = stream;
+
+			if(ZSTD_isError(ZSTD_CCtx_setParameter(stream, ZSTD_c_compressionLevel, level))) {
+				return;
+			}
+
+			// the dictionary is sticky, it's used for all following frames
+			if(dictionary && globaldictionary != NULL) {
+				if(ZSTD_isError(ZSTD_CCtx_loadDictionary(stream, globaldictionary, globaldictionarysize))) {
+					return;
+				}
+			}
+			break;
+		}
+#endif
+		default:
+			return;
+	}
+
+	m_valid = true;
+}
+
+MsgCompressor::~MsgCompressor() {
+	if(m_stream == NULL) {
+		return;
+	}
+
+	switch(m_codec) {
+#ifdef HAVE_ZLIB
+		case Zlib:
+			deflateEnd((z_stream*)m_stream);
+			free(m_stream);
+			break;
+#endif
+#ifdef HAVE_LZ4
+		case Lz4:
+			LZ4_freeStream((LZ4_stream_t*)m_stream);
+			free(m_history);
+			break;
+#endif
+#ifdef HAVE_ZSTD
+		case Zstd:
+			ZSTD_freeCCtx((ZSTD_CCtx*)m_stream);
+			break;
+#endif
+		default:
+			break;
+	}
+}
+
+bool MsgCompressor::valid() {
+	return m_valid;
+}
+
+uint32_t MsgCompressor::bound(uint32_t size) {
+	if(m_stream == NULL) {
+		return size;
+	}
+
+	switch(m_codec) {
+#ifdef HAVE_ZLIB
+		case Zlib:
+			// deflateBound is computed for Z_FINISH, a sync flush adds an empty stored block
+			return deflateBound((z_stream*)m_stream, size) + 16;
+#endif
+#ifdef HAVE_LZ4
+		case Lz4:
+			return LZ4_compressBound(size);
+#endif
+#ifdef HAVE_ZSTD
+		case Zstd:
+			// a flush within a running frame may add a block header
+			return ZSTD_compressBound(size) + 16;
+#endif
+		default:
+			return size;
+	}
+}
+
+bool MsgCompressor::compress(const uint8_t* in, uint32_t inlen, uint8_t* out, uint32_t& outlen) {
+	if(!m_valid) {
+		return false;
+	}
+
+	switch(m_codec) {
+#ifdef HAVE_ZLIB
+		case Zlib: {
+			z_stream* stream = (z_stream*)m_stream;
+
+			if(!m_streaming) {
+				deflateReset(stream);
+			}
+
+			stream->next_in = (Bytef*)in;
+			stream->avail_in = inlen;
+			stream->next_out = out;
+			stream->avail_out = outlen;
+
+			int rc = deflate(stream, m_streaming ? Z_SYNC_FLUSH : Z_FINISH);
+
+			if(!m_streaming) {
+				if(rc != Z_STREAM_END) {
+					return false;
+				}
+
+				outlen -= stream->avail_out;
+				return true;
+			}
+
+			// all input must be consumed and the flush must be complete
+			if(rc != Z_OK || stream->avail_in != 0 || stream->avail_out == 0) {
+				m_valid = false;
+				return false;
+			}
+
+			outlen -= stream->avail_out;
+			return true;
+		}
+#endif
+#ifdef HAVE_LZ4
+		case Lz4: {
+			LZ4_stream_t* stream = (LZ4_stream_t*)m_stream;
+
+			if(!m_streaming) {
+				int rc = LZ4_compress_fast_extState(stream, (const char*)in, (char*)out, inlen, outlen, 1);
+
+				if(rc <= 0) {
+					return false;
+				}
+
+				outlen = rc;
+				return true;
+			}
+
+			int rc = LZ4_compress_fast_continue(stream, (const char*)in, (char*)out, inlen, outlen, 1);
+
+			if(rc <= 0) {
+				m_valid = false;
+				return false;
+			}
+
+			// the input buffer will be gone, keep the history for the next payload
+			LZ4_saveDict(stream, (char*)m_history, LZ4_HISTORY_SIZE);
+
+			outlen = rc;
+			return true;
+		}
+#endif
+#ifdef HAVE_ZSTD
+		case Zstd: {
+			ZSTD_CCtx* stream = (ZSTD_CCtx*)m_stream;
+
+			if(!m_streaming) {
+				size_t rc = ZSTD_compress2(stream, out, outlen, in, inlen);
+
+				if(ZSTD_isError(rc)) {
+					return false;
+				}
+
+				outlen = rc;
+				return true;
+			}
+
+			ZSTD_inBuffer input = { in, inlen, 0 };
+			ZSTD_outBuffer output = { out, outlen, 0 };
+			size_t remaining = 0;
+
+			// the frame is never ended, every payload just flushes the pending blocks
+			do {
+				remaining = ZSTD_compressStream2(stream, &output, &input, ZSTD_e_flush);
+
+				if(ZSTD_isError(remaining) || (remaining != 0 && output.pos == output.size)) {
+					m_valid = false;
+					return false;
+				}
+			}
+			while(remaining != 0);
+
+			outlen = output.pos;
+			return true;
+		}
+#endif
+		default:
+			return false;
+	}
+}
+
+bool MsgCompressor::supported(int codec) {
+	switch(codec) {
+#ifdef HAVE_ZLIB
+		case Zlib:
+			return true;
+#endif
+#ifdef HAVE_LZ4
+		case Lz4:
+			return true;
+#endif
+#ifdef HAVE_ZSTD
+		case Zstd:
+			return true;
+#endif
+		default:
+			return false;
+	}
+}
+
+const char* MsgCompressor::name(int codec) {
+	switch(codec) {
+		case Zlib:
+			return "zlib";
+		case Lz4:
+			return "lz4";
+		case Zstd:
+			return "zstd";
+		default:
+			return "unknown";
+	}
+}
+
+bool MsgCompressor::loadDictionary(const char* filename) {
+#ifndef HAVE_ZSTD
+	return false;
+#else
+	FILE* file = fopen(filename, "rb");
+
+	if(file == NULL) {
+		return false;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	if(size <= 0) {
+		fclose(file);
+		return false;
+	}
+
+	uint8_t* dictionary = (uint8_t*)malloc(size);
+
+	if(dictionary == NULL || fread(dictionary, 1, size, file) != (size_t)size) {
+		free(dictionary);
+		fclose(file);
+		return false;
+	}
+
+	fclose(file);
+
+	// raw content dictionaries don't carry an id, clients couldn't tell them apart
+	uint32_t id = ZSTD_getDictID_fromDict(dictionary, size);
+
+	if(id == 0) {
+		free(dictionary);
+		return false;
+	}
+
+	free(globaldictionary);
+
+	globaldictionary = dictionary;
+	globaldictionarysize = size;
+	globaldictionaryid = id;
+
+	return true;
+#endif
+}
+
+uint32_t MsgCompressor::dictionaryId() {
+	return globaldictionaryid;
+}
@@ -0,0 +1,130 @@
+/** \file msgcompressor.h
+	Header file for the MsgCompressor class.
+	This include file defines the payload compressor of a connection.
+*/
+
+#ifndef MSGCOMPRESSOR_H
+#define MSGCOMPRESSOR_H
+
+#include <stdint.h>
+
+/**
+	@short Payload compressor
+
+	Compresses payloads with one of the supported codecs (zlib, LZ4, zstd).
+
+	In streaming mode one compression stream is kept for the lifetime of a connection.
+	Each payload is flushed, so it can be decoded as soon as it's received, while
+	later payloads still compress against the history of the previous ones.
+	The receiver must decode the payloads in the same order with a single
+	decoder, so packets have to be sent in the order they were compressed.
+
+	In packet mode every payload is compressed independently (zlib / zstd frames, LZ4 blocks).
+
+	zstd may additionally use a dictionary trained on typical payloads (EPG, recordings).
+	The dictionary is loaded once and shared by all compressors.
+*/
+
+class MsgCompressor {
+public:
+
+	/**
+	Compression codecs.
+	*/
+	enum Codec {
+		Zlib = 0,		/*!< deflate (zlib) */
+		Lz4 = 1,		/*!< LZ4 block format */
+		Zstd = 2		/*!< Zstandard */
+	};
+
+	/**
+	MsgCompressor constructor.
+
+	@param	codec		compression codec
+	@param	level		compression level (1 - 9, ignored by LZ4)
+	@param	streaming	keep one stream for all payloads
+	@param	dictionary	use the shared dictionary (zstd only)
+	*/
+	MsgCompressor(int codec, int level, bool streaming = true, bool dictionary = false);
+
+	/**
+	Destructor.
+	*/
+	~MsgCompressor();
+
+	/**
+	Check if the compressor can be used.
+	The compressor becomes invalid if a payload couldn't be compressed in streaming mode (the stream is out of sync then).
+
+	@return true if the compressor is usable
+	*/
+	bool valid();
+
+	/**
+	Get the maximum compressed size.
+
+	@param	size		size of the uncompressed data
+	@return maximum size of the compressed data
+	*/
+	uint32_t bound(uint32_t size);
+
+	/**
+	Compress data.
+	Appends the data to the stream and flushes the output (streaming mode),
+	or compresses the data independently (packet mode).
+
+	@param	in			uncompressed data
+	@param	inlen		size of the uncompressed data
+	@param	out			output buffer (at least "bound(inlen)" bytes)
+	@param	outlen		size of the output buffer, returns the size of the compressed data
+	@return true on success
+	*/
+	bool compress(const uint8_t* in, uint32_t inlen, uint8_t* out, uint32_t& outlen);
+
+	/**
+	Check if a codec has been compiled in.
+
+	@param	codec		compression codec
+	@return true if the codec can be used
+	*/
+	static bool supported(int codec);
+
+	/**
+	Get the name of a codec.
+
+	@param	codec		compression codec
+	@return name of the codec
+	*/
+	static const char* name(int codec);
+
+	/**
+	Load the shared zstd dictionary.
+	Must be called before any compressor uses the dictionary.
+
+	@param	filename	dictionary file (as created by "zstd --train")
+	@return true on success
+	*/
+	static bool loadDictionary(const char* filename);
+
+	/**
+	Get the id of the shared dictionary.
+
+	@return dictionary id or 0 if no dictionary has been loaded
+	*/
+	static uint32_t dictionaryId();
+
+private:
+
+	int m_codec;
+	bool m_streaming;
+	void* m_stream;
+	uint8_t* m_history;
+	bool m_valid;
+
+	static uint8_t* globaldictionary;
+	static uint32_t globaldictionarysize;
+	static uint32_t globaldictionaryid;
+
+};
+
+#endif // MSGCOMPRESSOR_H
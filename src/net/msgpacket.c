@@ -9,11 +9,19 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#ifndef WIN32
+#include <sys/uio.h>
+#endif
 #include <iostream>
 #include <unistd.h>
+#include <new>
 
 #include "os-config.h"
 #include "msgpacket.h"
+#include "bufferpool.h"
+#include "msgsegment.h"
+#include "msgcompressor.h"
+#include "crc32.h"
 
 #define get_impl(T, f) \
 	if((m_readposition + sizeof(T)) > m_usage) { \
@@ -35,70 +43,50 @@ pthread_mutex_t MsgPacket::uidmutex = PTHREAD_MUTEX_INITIALIZER;
 
 uint32_t MsgPacket::globalUID = 1;
 
-uint32_t MsgPacket::crc32_tab[] = {
-	0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
-	0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
-	0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
-	0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
-	0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9,
-	0xfa0f3d63, 0x8d080df5, 0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
-	0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b, 0x35b5a8fa, 0x42b2986c,
-	0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
-	0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423,
-	0xcfba9599, 0xb8bda50f, 0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
-	0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d, 0x76dc4190, 0x01db7106,
-	0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
-	0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d,
-	0x91646c97, 0xe6635c01, 0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
-	0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457, 0x65b0d9c6, 0x12b7e950,
-	0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
-	0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7,
-	0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
-	0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9, 0x5005713c, 0x270241aa,
-	0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
-	0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81,
-	0xb7bd5c3b, 0xc0ba6cad, 0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
-	0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683, 0xe3630b12, 0x94643b84,
-	0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
-	0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb,
-	0x196c3671, 0x6e6b06e7, 0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
-	0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e,
-	0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
-	0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55,
-	0x316e8eef, 0x4669be79, 0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
-	0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f, 0xc5ba3bbe, 0xb2bd0b28,
-	0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
-	0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f,
-	0x72076785, 0x05005713, 0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
-	0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242,
-	0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
-	0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69,
-	0x616bffd3, 0x166ccf45, 0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
-	0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db, 0xaed16a4a, 0xd9d65adc,
-	0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
-	0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693,
-	0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
-	0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
-};
-
-
-MsgPacket::MsgPacket() : m_packet(NULL), m_size(InitialPacketSize), m_usage(HeaderLength), m_readposition(HeaderLength), m_freezed(false), m_payloadchecksum(true) {
+
+MsgPacket::MsgPacket() : m_packet(NULL), m_size(InitialPacketSize), m_usage(HeaderLength), m_readposition(HeaderLength), m_freezed(false), m_payloadchecksum(true), m_crc(0), m_crcposition(HeaderLength), m_crcincremental(true), m_compactlength(0), m_segmentcount(0), m_segmentbytes(0) {
 	Init(0, 0, 0);
 }
 
-MsgPacket::MsgPacket(uint16_t msgid, uint16_t type, uint32_t uid) : m_packet(NULL), m_size(InitialPacketSize), m_usage(HeaderLength), m_readposition(HeaderLength), m_freezed(false), m_payloadchecksum(true) {
-	Init(msgid, type, uid);
+MsgPacket::MsgPacket(uint16_t msgid, uint16_t type, uint32_t uid, uint32_t payloadsize) : m_packet(NULL), m_size(InitialPacketSize), m_usage(HeaderLength), m_readposition(HeaderLength), m_freezed(false), m_payloadchecksum(true), m_crc(0), m_crcposition(HeaderLength), m_crcincremental(true), m_compactlength(0), m_segmentcount(0), m_segmentbytes(0) {
+	Init(msgid, type, uid, payloadsize);
 }
 
 MsgPacket::~MsgPacket() {
-	free(m_packet);
+	releaseSegments();
+
+	if(m_packet != m_inline) {
+		MsgBufferPool::release(m_packet, m_size);
+	}
 }
 
-void MsgPacket::Init(uint16_t msgid, uint16_t type, uint32_t uid) {
-	m_packet = (uint8_t*)malloc(m_size);
+void* MsgPacket::operator new(size_t size) {
+	uint32_t capacity = 0;
+	void* p = MsgBufferPool::alloc(size, capacity);
 
-	if(m_packet == NULL) {
-		return;
+	if(p == NULL) {
+		throw std::bad_alloc();
+	}
+
+	return p;
+}
+
+void MsgPacket::operator delete(void* p, size_t size) {
+	MsgBufferPool::release((uint8_t*)p, size);
+}
+
+void MsgPacket::Init(uint16_t msgid, uint16_t type, uint32_t uid, uint32_t payloadsize) {
+	m_packet = m_inline;
+	m_size = InitialPacketSize;
+
+	if(payloadsize > InitialPacketSize - HeaderLength) {
+		uint32_t capacity = 0;
+		uint8_t* buffer = MsgBufferPool::alloc(HeaderLength + payloadsize, capacity);
+
+		if(buffer != NULL) {
+			m_packet = buffer;
+			m_size = capacity;
+		}
 	}
 
 	pthread_mutex_lock(&uidmutex);
@@ -150,6 +138,7 @@ bool MsgPacket::put_String(const char* string) {
 	memcpy(m_packet + m_usage, string, len);
 	m_usage += len;
 
+	updatePayloadCheckSum();
 	return true;
 }
 
@@ -181,27 +170,115 @@ bool MsgPacket::put_S64(int64_t ll) {
 	put_impl(int64_t, htobe64, ll);
 }
 
+bool MsgPacket::put_VarU64(uint64_t ull) {
+	uint8_t buffer[10];
+	uint32_t length = 0;
+
+	do {
+		uint8_t b = ull & 0x7F;
+		ull >>= 7;
+		buffer[length++] = b | (ull > 0 ? 0x80 : 0);
+	}
+	while(ull > 0);
+
+	return put_Blob(buffer, length);
+}
+
+bool MsgPacket::put_VarS64(int64_t ll) {
+	return put_VarU64(((uint64_t)ll << 1) ^ (uint64_t)(ll >> 63));
+}
+
 bool MsgPacket::put_Blob(uint8_t source[], uint32_t length) {
-	uint8_t* p = reserve(length);
+	uint8_t* p = append(length);
 
 	if(p == NULL) {
 		return false;
 	}
 
 	memcpy(p, source, length);
+
+	// checksum the blob while it's still in the cache
+	updatePayloadCheckSum();
+	return true;
+}
+
+bool MsgPacket::put_Segment(MsgSegment* segment, uint32_t offset, uint32_t length) {
+	if(length == 0) {
+		return true;
+	}
+
+	if(m_segmentcount == MaxSegments) {
+		return put_Blob(segment->data() + offset, length);
+	}
+
+	SegmentRef& s = m_segments[m_segmentcount++];
+
+	s.position = m_usage;
+	s.segment = segment->ref();
+	s.offset = offset;
+	s.length = length;
+
+	m_segmentbytes += length;
+
+	// the payload isn't contiguous anymore
+	m_crcincremental = false;
 	return true;
 }
 
+bool MsgPacket::flatten() {
+	if(m_segmentcount == 0) {
+		return true;
+	}
+
+	if(!checkPacketSize(m_segmentbytes)) {
+		return false;
+	}
+
+	// move the inline data behind each segment to its final position (back to front)
+	uint32_t end = m_usage;
+	uint32_t shift = m_segmentbytes;
+
+	for(int i = m_segmentcount - 1; i >= 0; i--) {
+		SegmentRef& s = m_segments[i];
+
+		memmove(m_packet + s.position + shift, m_packet + s.position, end - s.position);
+		shift -= s.length;
+		memcpy(m_packet + s.position + shift, s.segment->data() + s.offset, s.length);
+
+		end = s.position;
+	}
+
+	m_usage += m_segmentbytes;
+	releaseSegments();
+
+	return true;
+}
+
+void MsgPacket::releaseSegments() {
+	for(uint32_t i = 0; i < m_segmentcount; i++) {
+		m_segments[i].segment->unref();
+	}
+
+	m_segmentcount = 0;
+	m_segmentbytes = 0;
+}
+
 void MsgPacket::clear() {
+	releaseSegments();
+
 	m_usage = HeaderLength;
 	m_readposition = HeaderLength;
+
+	m_crc = 0;
+	m_crcposition = HeaderLength;
+	m_crcincremental = true;
 }
 
 void MsgPacket::rewind() {
 	m_readposition = HeaderLength;
 }
 
-uint8_t* MsgPacket::reserve(uint32_t length, bool fill, unsigned char c) {
+uint8_t* MsgPacket::append(uint32_t length) {
 	if(!checkPacketSize(length)) {
 		return NULL;
 	}
@@ -209,6 +286,19 @@ uint8_t* MsgPacket::reserve(uint32_t length, bool fill, unsigned char c) {
 	uint8_t* p = m_packet + m_usage;
 	m_usage += length;
 
+	return p;
+}
+
+uint8_t* MsgPacket::reserve(uint32_t length, bool fill, unsigned char c) {
+	uint8_t* p = append(length);
+
+	if(p == NULL) {
+		return NULL;
+	}
+
+	// the caller fills the region later on, we have to checksum the whole payload in freeze()
+	m_crcincremental = false;
+
 	if(fill) {
 		memset(p, c, length);
 	}
@@ -222,6 +312,11 @@ void MsgPacket::unreserve(uint32_t length) {
 	}
 
 	m_usage -= length;
+
+	if(m_usage < m_crcposition) {
+		m_crc = 0;
+		m_crcposition = HeaderLength;
+	}
 }
 
 uint8_t* MsgPacket::consume(uint32_t length) {
@@ -277,6 +372,26 @@ int64_t MsgPacket::get_S64() {
 	get_impl(int64_t, be64toh);
 }
 
+uint64_t MsgPacket::get_VarU64() {
+	uint64_t ull = 0;
+
+	for(int shift = 0; shift < 64 && m_readposition < m_usage; shift += 7) {
+		uint8_t b = m_packet[m_readposition++];
+		ull |= (uint64_t)(b & 0x7F) << shift;
+
+		if((b & 0x80) == 0) {
+			break;
+		}
+	}
+
+	return ull;
+}
+
+int64_t MsgPacket::get_VarS64() {
+	uint64_t ull = get_VarU64();
+	return (int64_t)(ull >> 1) ^ -(int64_t)(ull & 1);
+}
+
 bool MsgPacket::get_Blob(uint8_t dest[], uint32_t length) {
 	if((m_readposition + length) > m_usage) {
 		return false;
@@ -289,19 +404,25 @@ bool MsgPacket::get_Blob(uint8_t dest[], uint32_t length) {
 }
 
 uint8_t* MsgPacket::getPacket() {
+	flatten();
 	return m_packet;
 }
 
 uint32_t MsgPacket::getPacketLength() {
-	return m_usage;
+	if(m_compactlength > 0) {
+		return m_compactlength + m_usage + m_segmentbytes - HeaderLength;
+	}
+
+	return m_usage + m_segmentbytes;
 }
 
 uint8_t* MsgPacket::getPayload() {
+	flatten();
 	return m_packet + HeaderLength;
 }
 
 uint32_t MsgPacket::getPayloadLength() {
-	return m_usage - HeaderLength;
+	return m_usage + m_segmentbytes - HeaderLength;
 }
 
 uint32_t MsgPacket::getUID() {
@@ -345,14 +466,29 @@ void MsgPacket::freeze() {
 		return;
 	}
 
+	// compact packets go out without checksums
+	if(m_compactlength > 0) {
+		m_freezed = true;
+		return;
+	}
+
 	uint32_t payloadCheckSum = 0;
 
 	if(getPayloadLength() > 0 && m_payloadchecksum) {
-		payloadCheckSum = crc32(m_packet + HeaderLength, m_usage - HeaderLength);
+		if(m_crcincremental) {
+			updatePayloadCheckSum();
+			payloadCheckSum = m_crc;
+		}
+		else if(m_segmentcount > 0) {
+			payloadCheckSum = segmentCheckSum();
+		}
+		else {
+			payloadCheckSum = crc32(m_packet + HeaderLength, m_usage - HeaderLength);
+		}
 	}
 
 	writePacket<uint32_t>(PayloadCheckSumPos, htobe32(payloadCheckSum));
-	writePacket<uint32_t>(PayloadLengthPos, htobe32(m_usage - HeaderLength));
+	writePacket<uint32_t>(PayloadLengthPos, htobe32(getPayloadLength()));
 	writePacket<uint32_t>(CheckSumPos, htobe32(crc32(m_packet, CheckSumPos)));
 
 	m_freezed = true;
@@ -371,38 +507,72 @@ bool MsgPacket::checkPacketSize(uint32_t bytes) {
 		bytes = IncrementPacketSize;
 	}
 
-	uint8_t* buffer = (uint8_t*)realloc((void*)m_packet, m_usage + bytes);
+	// grow geometrically, the pool rounds up to the next size class
+	uint32_t size = m_size * 2;
+
+	if(size < m_usage + bytes) {
+		size = m_usage + bytes;
+	}
+
+	uint32_t capacity = 0;
+	uint8_t* buffer = MsgBufferPool::alloc(size, capacity);
 
 	if(buffer == NULL) {
-		buffer = (uint8_t*)malloc(m_usage + bytes);
+		return false;
+	}
 
-		if(buffer == NULL) {
-			return false;
-		}
+	memcpy(buffer, m_packet, m_usage);
 
-		memcpy(buffer, m_packet, m_usage);
-		free(m_packet);
+	if(m_packet != m_inline) {
+		MsgBufferPool::release(m_packet, m_size);
 	}
 
 	m_packet = buffer;
-	m_size = m_usage + bytes;
+	m_size = capacity;
 	return true;
 }
 
-uint32_t MsgPacket::crc32(const uint8_t* buf, int size) {
-	uint32_t crc = 0xFFFFFFFF;
-	const uint8_t* p = buf;
+void MsgPacket::updatePayloadCheckSum() {
+	if(!m_payloadchecksum || !m_crcincremental || m_usage <= m_crcposition) {
+		return;
+	}
+
+	m_crc = crc32_update(m_crc, m_packet + m_crcposition, m_usage - m_crcposition);
+	m_crcposition = m_usage;
+}
+
+uint32_t MsgPacket::segmentCheckSum() {
+	uint32_t crc = 0;
+	uint32_t position = HeaderLength;
+
+	for(uint32_t i = 0; i < m_segmentcount; i++) {
+		SegmentRef& s = m_segments[i];
 
-	while(size--) {
-		crc = crc32_tab[(crc ^ *p++) & 0xFF] ^(crc >> 8);
+		crc = crc32_update(crc, m_packet + position, s.position - position);
+		crc = crc32_update(crc, s.segment->data() + s.offset, s.length);
+
+		position = s.position;
 	}
 
-	return (crc ^ ~0U);
+	return crc32_update(crc, m_packet + position, m_usage - position);
+}
+
+uint32_t MsgPacket::crc32(const uint8_t* buf, int size) {
+	return crc32_update(0, buf, size);
 }
 
 bool MsgPacket::write(int fd, int timeout_ms) {
 	freeze();
 
+	if(m_segmentcount > 0 || m_compactlength > 0) {
+#ifdef WIN32
+		flatten();
+#else
+		struct iovec iov[2 * MaxSegments + 2];
+		return writeIOVec(fd, iov, getIOVec(iov), timeout_ms, 0);
+#endif
+	}
+
 	uint32_t written = 0;
 
 	while(written < m_usage) {
@@ -430,6 +600,228 @@ bool MsgPacket::write(int fd, int timeout_ms) {
 	return true;
 }
 
+#ifndef WIN32
+int MsgPacket::getIOVec(struct iovec* iov) {
+	int count = 0;
+	uint32_t position = 0;
+
+	// the compact header replaces the regular one
+	if(m_compactlength > 0) {
+		iov[count].iov_base = m_compactheader;
+		iov[count++].iov_len = m_compactlength;
+		position = HeaderLength;
+	}
+
+	// header + inline data and segments in payload order
+	for(uint32_t i = 0; i < m_segmentcount; i++) {
+		SegmentRef& s = m_segments[i];
+
+		if(s.position > position) {
+			iov[count].iov_base = m_packet + position;
+			iov[count++].iov_len = s.position - position;
+		}
+
+		iov[count].iov_base = s.segment->data() + s.offset;
+		iov[count++].iov_len = s.length;
+
+		position = s.position;
+	}
+
+	if(m_usage > position) {
+		iov[count].iov_base = m_packet + position;
+		iov[count++].iov_len = m_usage - position;
+	}
+
+	return count;
+}
+
+bool MsgPacket::writeIOVec(int fd, struct iovec* iov, int count, int timeout_ms, int flags) {
+	size_t length = 0;
+
+	for(int i = 0; i < count; i++) {
+		length += iov[i].iov_len;
+	}
+
+	size_t written = 0;
+	int index = 0;
+
+	while(written < length) {
+		if(pollfd(fd, timeout_ms, false) == 0) {
+			return false;
+		}
+
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov + index;
+		msg.msg_iovlen = count - index;
+
+		ssize_t rc = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL | flags);
+
+		if(rc == -1 && sockerror() == ENOTSOCK) {
+			rc = ::writev(fd, iov + index, count - index);
+		}
+
+		if(rc == -1 || rc == 0) {
+			if(sockerror() == SEWOULDBLOCK) {
+				continue;
+			}
+
+			return false;
+		}
+
+		written += rc;
+
+		// skip the sent vectors
+		while(rc > 0) {
+			if((size_t)rc >= iov[index].iov_len) {
+				rc -= iov[index++].iov_len;
+				continue;
+			}
+
+			iov[index].iov_base = (uint8_t*)iov[index].iov_base + rc;
+			iov[index].iov_len -= rc;
+			rc = 0;
+		}
+	}
+
+	return true;
+}
+#endif
+
+bool MsgPacket::write(int fd, MsgPacket* packets[], int count, int timeout_ms, bool more) {
+#ifdef WIN32
+	for(int i = 0; i < count; i++) {
+		if(!packets[i]->write(fd, timeout_ms)) {
+			return false;
+		}
+	}
+
+	return true;
+#else
+	struct iovec iov[MaxIOVec];
+	int iovcount = 0;
+
+	for(int i = 0; i < count; i++) {
+		MsgPacket* p = packets[i];
+		p->freeze();
+
+		// vector list full, send what we have
+		if(iovcount + 2 * (int)p->m_segmentcount + 2 > MaxIOVec) {
+			if(!writeIOVec(fd, iov, iovcount, timeout_ms, MSG_MORE)) {
+				return false;
+			}
+
+			iovcount = 0;
+		}
+
+		iovcount += p->getIOVec(iov + iovcount);
+	}
+
+	if(iovcount == 0) {
+		return true;
+	}
+
+	return writeIOVec(fd, iov, iovcount, timeout_ms, more ? MSG_MORE : 0);
+#endif
+}
+
+#ifndef WIN32
+static int skipIOVec(struct iovec* iov, int index, size_t bytes) {
+	while(bytes > 0) {
+		if(bytes >= iov[index].iov_len) {
+			bytes -= iov[index++].iov_len;
+			continue;
+		}
+
+		iov[index].iov_base = (uint8_t*)iov[index].iov_base + bytes;
+		iov[index].iov_len -= bytes;
+		bytes = 0;
+	}
+
+	return index;
+}
+#endif
+
+int MsgPacket::trywrite(int fd, MsgPacket* packets[], int count, uint32_t& offset, bool more) {
+#ifdef WIN32
+	for(int i = 0; i < count; i++) {
+		if(!packets[i]->write(fd)) {
+			return -1;
+		}
+	}
+
+	offset = 0;
+	return count;
+#else
+	struct iovec iov[MaxIOVec];
+	uint32_t lengths[MaxIOVec];
+	int iovcount = 0;
+	int n = 0;
+
+	// take as many packets as fit into the vector list
+	while(n < count) {
+		MsgPacket* p = packets[n];
+		p->freeze();
+
+		if(iovcount + 2 * (int)p->m_segmentcount + 2 > MaxIOVec) {
+			break;
+		}
+
+		iovcount += p->getIOVec(iov + iovcount);
+		lengths[n++] = p->getPacketLength();
+	}
+
+	// skip the part of the first packet which has already been written
+	int index = skipIOVec(iov, 0, offset);
+	int flags = MSG_DONTWAIT | MSG_NOSIGNAL | ((more || n < count) ? MSG_MORE : 0);
+	size_t written = 0;
+	bool full = false;
+
+	while(index < iovcount) {
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov + index;
+		msg.msg_iovlen = iovcount - index;
+
+		ssize_t rc = sendmsg(fd, &msg, flags);
+
+		if(rc == -1 && sockerror() == ENOTSOCK) {
+			rc = ::writev(fd, iov + index, iovcount - index);
+		}
+
+		if(rc == -1 && sockerror() == EINTR) {
+			continue;
+		}
+
+		// socket full, continue later
+		if(rc == -1 && sockerror() == SEWOULDBLOCK) {
+			full = true;
+			break;
+		}
+
+		if(rc <= 0) {
+			return -1;
+		}
+
+		written += rc;
+		index = skipIOVec(iov, index, rc);
+	}
+
+	// count the completely written packets
+	int completed = 0;
+	size_t position = offset + written;
+
+	while(completed < n && position >= lengths[completed]) {
+		position -= lengths[completed++];
+	}
+
+	offset = position;
+	errno = full ? EAGAIN : 0;
+
+	return completed;
+#endif
+}
+
 MsgPacket* MsgPacket::read(int fd, int timeout_ms) {
 	bool bClosed;
 	return read(fd, bClosed, timeout_ms);
@@ -523,6 +915,83 @@ MsgPacket* MsgPacket::read(int fd, bool& closed, int timeout_ms) {
 	return p;
 }
 
+uint32_t MsgPacket::copy(uint8_t* dest) {
+	freeze();
+
+#ifdef WIN32
+	flatten();
+	memcpy(dest, m_packet, m_usage);
+	return m_usage;
+#else
+	struct iovec iov[2 * MaxSegments + 2];
+	int count = getIOVec(iov);
+	uint32_t length = 0;
+
+	for(int i = 0; i < count; i++) {
+		memcpy(dest + length, iov[i].iov_base, iov[i].iov_len);
+		length += iov[i].iov_len;
+	}
+
+	return length;
+#endif
+}
+
+MsgPacket* MsgPacket::restore(const uint8_t* data, uint32_t length) {
+	if(length < HeaderLength) {
+		return NULL;
+	}
+
+	uint32_t payloadlength = 0;
+	memcpy(&payloadlength, data + PayloadLengthPos, sizeof(payloadlength));
+	payloadlength = be32toh(payloadlength);
+
+	if(payloadlength != length - HeaderLength) {
+		return NULL;
+	}
+
+	MsgPacket* p = new MsgPacket(0, 0, 1);
+	memcpy(p->m_packet, data, HeaderLength);
+
+	if(payloadlength > 0) {
+		uint8_t* payload = p->reserve(payloadlength);
+
+		if(payload == NULL) {
+			delete p;
+			return NULL;
+		}
+
+		memcpy(payload, data + HeaderLength, payloadlength);
+	}
+
+	if(p->getPayloadCheckSum() == 0) {
+		p->disablePayloadCheckSum();
+	}
+
+	// the stored header (and checksums) go out unchanged
+	p->m_freezed = true;
+
+	return p;
+}
+
+MsgPacket* MsgPacket::clone() {
+	uint32_t length = getPacketLength();
+	MsgPacket* p = new MsgPacket(0, 0, 1);
+
+	if(length > HeaderLength && p->reserve(length - HeaderLength) == NULL) {
+		delete p;
+		return NULL;
+	}
+
+	// header and payload go straight into the buffer of the new packet
+	copy(p->m_packet);
+
+	if(p->getPayloadCheckSum() == 0) {
+		p->disablePayloadCheckSum();
+	}
+
+	return p;
+}
+
 bool MsgPacket::readstream(std::istream& in, MsgPacket& p) {
 	uint8_t* header = p.getPacket();
 
@@ -647,10 +1116,125 @@ bool MsgPacket::compress(int level) {
 #endif
 }
 
+bool MsgPacket::compress(MsgCompressor& compressor) {
+	if(m_freezed || !compressor.valid() || !flatten()) {
+		return false;
+	}
+
+	uint32_t uncompressedsize = getPayloadLength();
+
+	if(uncompressedsize == 0) {
+		return true;
+	}
+
+	// compress into a new buffer and swap buffers afterwards
+	uint32_t capacity = 0;
+	uint8_t* buffer = MsgBufferPool::alloc(HeaderLength + compressor.bound(uncompressedsize), capacity);
+
+	if(buffer == NULL) {
+		return false;
+	}
+
+	uint32_t compressedsize = capacity - HeaderLength;
+
+	if(!compressor.compress(getPayload(), uncompressedsize, buffer + HeaderLength, compressedsize)) {
+		MsgBufferPool::release(buffer, capacity);
+		return false;
+	}
+
+	memcpy(buffer, m_packet, HeaderLength);
+
+	if(m_packet != m_inline) {
+		MsgBufferPool::release(m_packet, m_size);
+	}
+
+	m_packet = buffer;
+	m_size = capacity;
+	m_usage = HeaderLength + compressedsize;
+	m_readposition = HeaderLength;
+
+	m_crc = 0;
+	m_crcposition = HeaderLength;
+	m_crcincremental = true;
+
+	writePacket<uint32_t>(UncompressedPayloadLengthPos, htobe32(uncompressedsize));
+	freeze();
+
+	return true;
+}
+
 bool MsgPacket::isCompressed() {
 	return (be32toh(readPacket<uint32_t>(UncompressedPayloadLengthPos)) != 0);
 }
 
+bool MsgPacket::setCompact() {
+#ifdef WIN32
+	return false;
+#else
+	if(m_compactlength > 0) {
+		return true;
+	}
+
+	uint16_t type = getType();
+	uint16_t msgid = getMsgID();
+
+	if(type >= 8 || msgid >= 32 || isCompressed()) {
+		return false;
+	}
+
+	uint32_t length = getPayloadLength();
+	uint32_t n = 0;
+
+	m_compactheader[n++] = CompactSync;
+	m_compactheader[n++] = (uint8_t)((type << 5) | msgid);
+
+	do {
+		uint8_t b = length & 0x7F;
+		length >>= 7;
+		m_compactheader[n++] = b | (length > 0 ? 0x80 : 0);
+	}
+	while(length > 0);
+
+	m_compactlength = n;
+	m_freezed = true;
+
+	return true;
+#endif
+}
+
+bool MsgPacket::isCompact() {
+	return (m_compactlength > 0);
+}
+
+int MsgPacket::readCompactHeader(const uint8_t* data, uint32_t length, uint16_t& msgid, uint16_t& type, uint32_t& payloadlength) {
+	if(length < 3) {
+		return 0;
+	}
+
+	if(data[0] != CompactSync) {
+		return -1;
+	}
+
+	type = data[1] >> 5;
+	msgid = data[1] & 0x1F;
+	payloadlength = 0;
+
+	for(uint32_t i = 2; i < CompactMaxHeaderLength; i++) {
+		if(i >= length) {
+			return 0;
+		}
+
+		payloadlength |= (uint32_t)(data[i] & 0x7F) << (7 * (i - 2));
+
+		if((data[i] & 0x80) == 0) {
+			return i + 1;
+		}
+	}
+
+	// varint too long
+	return -1;
+}
+
 bool MsgPacket::uncompress() {
 #ifndef HAVE_ZLIB
 	return false;
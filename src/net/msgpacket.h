@@ -13,6 +13,10 @@
 #include <ostream>
 #include <istream>
 
+class MsgSegment;
+class MsgCompressor;
+struct iovec;
+
 // PACKET HEADER DEFINITION
 
 // pos    type       description
@@ -27,6 +31,15 @@
 // 24     uint32_t   uncompressed payload length (indicates compression if > 0)
 // 28     uint32_t   header checksum
 
+// COMPACT PACKET HEADER (stream packets, negotiated at login)
+
+// pos    type       description
+// 0      uint8_t    compact sync (0xA5)
+// 1      uint8_t    type (bits 5-7) and message id (bits 0-4)
+// 2      varint     payload length (7 bits per byte, least significant first, bit 7 set if more bytes follow)
+//
+// Compact packets don't have a serial number, checksums or compression.
+
 /**
 	@short Message Packet class
 
@@ -44,8 +57,9 @@ public:
 	@param	msgid			user defined message id
 	@param	type			user defined message type (default: 0)
 	@param	uid				packet uid (default: unique incremental id)
+	@param	payloadsize		expected size of the payload (preallocates the packet buffer)
 	*/
-	MsgPacket(uint16_t msgid, uint16_t type = 0, uint32_t uid = 0);
+	MsgPacket(uint16_t msgid, uint16_t type = 0, uint32_t uid = 0, uint32_t payloadsize = 0);
 
 	/**
 	MsgPacket constructor.
@@ -58,6 +72,13 @@ public:
 	*/
 	~MsgPacket();
 
+	/**
+	Allocate packet objects from the buffer pool.
+	*/
+	static void* operator new(size_t size);
+
+	static void operator delete(void* p, size_t size);
+
 	/**
 	Insert NULL terminated string.
 	Add a NULL terminted string to the payload of the packet.
@@ -130,6 +151,26 @@ public:
 	*/
 	bool put_S64(int64_t ll);
 
+	/**
+	Insert unsigned variable length integer.
+	Adds an unsigned integer number with 7 bits per byte (least significant first, bit 7 set if more bytes follow).
+	Small numbers take less space (1 byte up to 127).
+
+	@param	ull		unsigned 64bit number
+	@return true on success / false on memory allocation error
+	*/
+	bool put_VarU64(uint64_t ull);
+
+	/**
+	Insert signed variable length integer.
+	Adds a signed integer number as zigzag encoded variable length integer (0, -1, 1, -2, ... as 0, 1, 2, 3, ...),
+	so numbers close to zero take less space.
+
+	@param	ll		signed 64bit number
+	@return true on success / false on memory allocation error
+	*/
+	bool put_VarS64(int64_t ll);
+
 	/**
 	Insert a binary large object.
 	Adds a binary object to the payload of the packet.
@@ -140,6 +181,28 @@ public:
 	*/
 	bool put_Blob(uint8_t source[], uint32_t length);
 
+	/**
+	Insert a buffer segment.
+	Adds a reference to (a part of) an external buffer to the payload of the packet.
+	The data isn't copied, it's sent directly from the segment. Packets with segments are
+	flattened into a contiguous buffer by getPacket(), getPayload() and compress().
+	If the packet can't hold any more segments the data is copied.
+
+	@param	segment		buffer segment (the packet adds its own reference)
+	@param	offset		start of the data within the segment
+	@param	length		number of bytes
+	@return true on success / false on memory allocation error
+	*/
+	bool put_Segment(MsgSegment* segment, uint32_t offset, uint32_t length);
+
+	/**
+	Flatten packet.
+	Copy all attached segments into the packet buffer.
+
+	@return true on success / false on memory allocation error
+	*/
+	bool flatten();
+
 	/**
 	Reserve space.
 	Creates a memory region in the payload of the packet.
@@ -246,6 +309,22 @@ public:
 	*/
 	int64_t get_S64();
 
+	/**
+	Extract unsigned variable length integer.
+	Return unsigned variable length integer (see put_VarU64) at the current payload position pointer.
+
+	@return unsigned 64bit integer at current payload position
+	*/
+	uint64_t get_VarU64();
+
+	/**
+	Extract signed variable length integer.
+	Return zigzag encoded variable length integer (see put_VarS64) at the current payload position pointer.
+
+	@return signed 64bit integer at current payload position
+	*/
+	int64_t get_VarS64();
+
 	/**
 	Extract binary large object.
 	Copy "length" bytes from the current payload position to "dest". The internal payload pointer will be incremented
@@ -407,8 +486,42 @@ public:
 	*/
 	bool compress(int level);
 
+	/**
+	Compress packet with the compressor of a connection.
+	Compress the payload of the packet with the negotiated codec of a connection.
+	Packets compressed by a streaming compressor must be sent in the order they were compressed.
+
+	@param compressor compressor of the connection
+	@return true on success
+	*/
+	bool compress(MsgCompressor& compressor);
+
 	bool isCompressed();
 
+	/**
+	Use the compact packet header.
+	Replaces the header with the compact version when the packet is written. Only
+	uncompressed packets with a type < 8 and a message id < 32 can be sent compact.
+	The payload must not be modified afterwards.
+
+	@return true if the packet will be sent with the compact header
+	*/
+	bool setCompact();
+
+	bool isCompact();
+
+	/**
+	Parse a compact packet header.
+
+	@param	data			received data (starting with the compact sync)
+	@param	length			size of the data
+	@param	msgid			message id of the packet
+	@param	type			type of the packet
+	@param	payloadlength	length of the payload
+	@return length of the header, 0 if more data is needed or -1 if the header is invalid
+	*/
+	static int readCompactHeader(const uint8_t* data, uint32_t length, uint16_t& msgid, uint16_t& type, uint32_t& payloadlength);
+
 	/**
 	Uncompress packet.
 	Uncompress the payload of the packet
@@ -428,6 +541,32 @@ public:
 	*/
 	bool write(int fd, int timeout_ms = 3000);
 
+	/**
+	Write packets to socket.
+	Writes a batch of packets with as few system calls as possible.
+
+	@param	fd			filedescriptor of the socket
+	@param	packets		array of packets
+	@param	count		number of packets in the array
+	@param	timeout_ms	write operation timeout in milliseconds
+	@param	more		more data follows (the last partial TCP segment may be held back)
+	*/
+	static bool write(int fd, MsgPacket* packets[], int count, int timeout_ms = 3000, bool more = false);
+
+	/**
+	Write packets without blocking.
+	Writes as much data as the socket takes. A partially written packet is continued
+	by the next call, passing the packet first in the array together with the returned offset.
+
+	@param	fd			filedescriptor of the socket
+	@param	packets		array of packets
+	@param	count		number of packets in the array
+	@param	offset		number of bytes of the first packet already written (updated)
+	@param	more		more data follows (the last partial TCP segment may be held back)
+	@return number of completely written packets or -1 on error. errno is set to EAGAIN if the socket is full
+	*/
+	static int trywrite(int fd, MsgPacket* packets[], int count, uint32_t& offset, bool more = false);
+
 	/**
 	Receive packet from socket.
 	Create a new packet from incoming socket data
@@ -451,6 +590,37 @@ public:
 
 	static bool readstream(std::istream& in, MsgPacket& p);
 
+	/**
+	Copy packet.
+	Freezes the packet and copies header and payload (including attached segments)
+	into a buffer.
+
+	@param	dest		buffer of at least getPacketLength() bytes
+	@return number of bytes copied
+	*/
+	uint32_t copy(uint8_t* dest);
+
+	/**
+	Restore packet.
+	Creates a packet from data written by copy(). The data is our own, so the
+	checksums are not validated again. The packet is frozen, the stored header
+	is sent unchanged.
+
+	@param	data		packet data
+	@param	length		length of the data in bytes
+	@return new packet or NULL if the data is invalid or memory allocation failed
+	*/
+	static MsgPacket* restore(const uint8_t* data, uint32_t length);
+
+	/**
+	Clone packet.
+	Creates a flat copy of the packet (including attached segments), which can be
+	sent and modified independently of the original one.
+
+	@return new packet or NULL if memory allocation failed
+	*/
+	MsgPacket* clone();
+
 	enum {
 		HeaderLength = 32,						/*!< Length (in bytes) of a packet header. */
 		CheckSumPos = 28,						/*!< Checksum position (uint32_t) within the header data. */
@@ -465,9 +635,14 @@ public:
 		SyncPos = 0								/*!< sync-mark position (uint32_t). */
 	};
 
+	enum {
+		CompactSync = 0xA5,						/*!< first byte of a compact packet. */
+		CompactMaxHeaderLength = 7				/*!< maximum length of a compact header (sync, type / msgid, 5 byte varint). */
+	};
+
 protected:
 
-	void Init(uint16_t msgid, uint16_t type = 0, uint32_t uid = 0);
+	void Init(uint16_t msgid, uint16_t type = 0, uint32_t uid = 0, uint32_t payloadsize = 0);
 
 	/**
 	Set unique message id.
@@ -504,8 +679,19 @@ private:
 
 	bool checkPacketSize(uint32_t bytes);
 
+	uint8_t* append(uint32_t length);
+
+	void updatePayloadCheckSum();
+
+	uint32_t segmentCheckSum();
+
+	void releaseSegments();
+
+	int getIOVec(struct iovec* iov);
+
+	static bool writeIOVec(int fd, struct iovec* iov, int count, int timeout_ms, int flags);
+
 	static uint32_t globalUID;
-	static uint32_t crc32_tab[];
 
 	uint8_t* m_packet;
 	uint32_t m_size;
@@ -515,11 +701,38 @@ private:
 	bool m_freezed;
 	bool m_payloadchecksum;
 
+	uint32_t m_crc;						// running payload checksum up to m_crcposition
+	uint32_t m_crcposition;
+	bool m_crcincremental;				// false if reserved regions may have been modified
+
+	uint8_t m_compactheader[CompactMaxHeaderLength];
+	uint32_t m_compactlength;			// length of the compact header, 0 for the regular header
+
 	enum {
 		InitialPacketSize = 128,
 		IncrementPacketSize = 512
 	};
 
+	// small packets (status, ping, stream status) don't need a separate buffer
+	uint8_t m_inline[InitialPacketSize];
+
+	// external payload data, inserted at "position" of the packet buffer
+	struct SegmentRef {
+		uint32_t position;
+		MsgSegment* segment;
+		uint32_t offset;
+		uint32_t length;
+	};
+
+	enum {
+		MaxSegments = 8,
+		MaxIOVec = 1024
+	};
+
+	SegmentRef m_segments[MaxSegments];
+	uint32_t m_segmentcount;
+	uint32_t m_segmentbytes;
+
 	static pthread_mutex_t uidmutex;
 };
 
@@ -555,6 +768,8 @@ class MsgPacket {
 +bool put_S32(int32_t l)
 +bool put_U64(uint64_t ull)
 +bool put_S64(int64_t ll)
++bool put_VarU64(uint64_t ull)
++bool put_VarS64(int64_t ll)
 +bool put_Blob(uint8_t source[], uint32_t length)
 .. data getters ..
 +const char* get_String()
@@ -565,6 +780,8 @@ class MsgPacket {
 +int32_t get_S32()
 +uint64_t get_U64()
 +int64_t get_S64()
++uint64_t get_VarU64()
++int64_t get_VarS64()
 +bool get_Blob(uint8_t dest[], uint32_t length)
 .. memory allocation ..
 +uint8_t* reserve(uint32_t length, bool fill, unsigned char c)
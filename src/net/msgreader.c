@@ -0,0 +1,281 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+
+#include "os-config.h"
+#include "msgreader.h"
+#include "msgpacket.h"
+#include "crc32.h"
+
+// first bytes of the sync mark (0x00AAAAAA)
+#define SYNC_BYTE 0xAA
+
+static inline uint32_t read32(const uint8_t* p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return be32toh(v);
+}
+
+MsgReader::MsgReader(uint32_t buffersize) : m_buffer(NULL), m_size(buffersize), m_start(0), m_end(0), m_packet(NULL), m_payload(NULL), m_payloadlength(0), m_received(0), m_crc(0), m_checksum(false), m_synced(false) {
+	if(m_size < MsgPacket::HeaderLength * 2) {
+		m_size = MsgPacket::HeaderLength * 2;
+	}
+
+	m_buffer = (uint8_t*)malloc(m_size);
+
+	if(m_buffer == NULL) {
+		m_size = 0;
+	}
+}
+
+MsgReader::~MsgReader() {
+	delete m_packet;
+	free(m_buffer);
+}
+
+void MsgReader::reset() {
+	delete m_packet;
+	m_packet = NULL;
+	m_start = 0;
+	m_end = 0;
+	m_synced = false;
+}
+
+uint32_t MsgReader::feed(const uint8_t* data, uint32_t length) {
+	compact();
+
+	if(length > m_size - m_end) {
+		length = m_size - m_end;
+	}
+
+	memcpy(m_buffer + m_end, data, length);
+	m_end += length;
+
+	return length;
+}
+
+void MsgReader::compact() {
+	if(m_start == 0) {
+		return;
+	}
+
+	// only an incomplete header remains after next()
+	memmove(m_buffer, m_buffer + m_start, m_end - m_start);
+	m_end -= m_start;
+	m_start = 0;
+}
+
+void MsgReader::append(const uint8_t* data, uint32_t length) {
+	memcpy(m_payload + m_received, data, length);
+
+	if(m_checksum) {
+		m_crc = crc32_update(m_crc, data, length);
+	}
+
+	m_received += length;
+}
+
+bool MsgReader::sync() {
+	for(;;) {
+		uint32_t available = m_end - m_start;
+		uint8_t* p = m_buffer + m_start;
+
+		if(available < sizeof(uint32_t)) {
+			return false;
+		}
+
+		if(read32(p) == 0xAAAAAA) {
+			if(available < MsgPacket::HeaderLength) {
+				return false;
+			}
+
+			if(crc32_update(0, p, MsgPacket::CheckSumPos) == read32(p + MsgPacket::CheckSumPos)) {
+				m_synced = true;
+				return true;
+			}
+
+			std::cerr << "checksum failed !" << std::endl;
+		}
+
+		// compact packets can't be found by scanning, wait for a regular header
+		m_synced = false;
+
+		// skip to the next possible sync mark
+		uint8_t* hit = (uint8_t*)memchr(p + 2, SYNC_BYTE, available - 2);
+
+		if(hit == NULL) {
+			// the last byte may be the start of a sync mark
+			m_start = m_end - 1;
+			return false;
+		}
+
+		m_start = (hit - 1) - m_buffer;
+	}
+}
+
+MsgPacket* MsgReader::next() {
+	for(;;) {
+		// continue a partially received packet
+		if(m_packet != NULL) {
+			uint32_t length = m_end - m_start;
+
+			if(length > m_payloadlength - m_received) {
+				length = m_payloadlength - m_received;
+			}
+
+			append(m_buffer + m_start, length);
+			m_start += length;
+
+			if(m_received < m_payloadlength) {
+				return NULL;
+			}
+
+			MsgPacket* p = m_packet;
+			m_packet = NULL;
+
+			if(m_checksum && p->getPayloadCheckSum() != m_crc) {
+				std::cerr << "wrong payload checksum !" << std::endl;
+				delete p;
+				continue;
+			}
+
+			return p;
+		}
+
+		MsgPacket* p = NULL;
+		uint32_t length = 0;
+
+		// compact packets are only accepted in a synchronized stream
+		if(m_synced && m_start < m_end && m_buffer[m_start] == MsgPacket::CompactSync) {
+			uint16_t msgid = 0;
+			uint16_t type = 0;
+
+			int rc = MsgPacket::readCompactHeader(m_buffer + m_start, m_end - m_start, msgid, type, length);
+
+			if(rc == 0) {
+				compact();
+				return NULL;
+			}
+
+			if(rc > 0) {
+				p = new MsgPacket(msgid, type, 1);
+				m_start += rc;
+			}
+		}
+
+		if(p == NULL) {
+			if(!sync()) {
+				compact();
+				return NULL;
+			}
+
+			uint8_t* header = m_buffer + m_start;
+			length = read32(header + MsgPacket::PayloadLengthPos);
+
+			p = new MsgPacket(0, 0, 1);
+			memcpy(p->getPacket(), header, MsgPacket::HeaderLength);
+			m_start += MsgPacket::HeaderLength;
+		}
+
+		// no payload ?
+		if(length == 0) {
+			return p;
+		}
+
+		m_payload = p->reserve(length);
+
+		// drop the packet, the payload will be skipped by the resync
+		if(m_payload == NULL) {
+			delete p;
+			continue;
+		}
+
+		m_packet = p;
+		m_payloadlength = length;
+		m_received = 0;
+		m_crc = 0;
+		m_checksum = (p->getPayloadCheckSum() != 0);
+
+		if(!m_checksum) {
+			p->disablePayloadCheckSum();
+		}
+	}
+}
+
+int MsgReader::fill(int fd) {
+	uint8_t* data = NULL;
+	uint32_t length = 0;
+
+	// receive the rest of a large payload directly into the packet
+	bool direct = (m_packet != NULL && m_start == m_end);
+
+	if(direct) {
+		data = m_payload + m_received;
+		length = m_payloadlength - m_received;
+	}
+	else {
+		compact();
+		data = m_buffer + m_end;
+		length = m_size - m_end;
+	}
+
+	if(length == 0) {
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	int rc = recv(fd, (char*)data, length, MSG_DONTWAIT);
+
+	if(rc == -1 && sockerror() == ENOTSOCK) {
+		rc = ::read(fd, data, length);
+	}
+
+	if(rc <= 0) {
+		return rc;
+	}
+
+	if(direct) {
+		if(m_checksum) {
+			m_crc = crc32_update(m_crc, data, rc);
+		}
+
+		m_received += rc;
+	}
+	else {
+		m_end += rc;
+	}
+
+	return rc;
+}
+
+MsgPacket* MsgReader::read(int fd, bool& closed, int timeout_ms) {
+	for(;;) {
+		MsgPacket* p = next();
+
+		if(p != NULL) {
+			return p;
+		}
+
+		if(!pollfd(fd, timeout_ms, true)) {
+			return NULL;
+		}
+
+		int rc = fill(fd);
+
+		if(rc == 0) {
+			closed = true;
+			return NULL;
+		}
+
+		if(rc == -1 && sockerror() != SEWOULDBLOCK && sockerror() != EINTR) {
+			closed = true;
+			return NULL;
+		}
+	}
+}
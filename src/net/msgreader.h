@@ -0,0 +1,127 @@
+/** \file msgreader.h
+	Header file for the MsgReader class.
+	This include file defines the buffered packet reader of a connection.
+*/
+
+#ifndef MSGREADER_H
+#define MSGREADER_H
+
+#include <stdint.h>
+
+class MsgPacket;
+
+/**
+	@short Buffered incremental packet reader
+
+	Collects incoming data of a connection in a read buffer and parses packets
+	from it. Partially received packets are kept until the next call, so the reader
+	can be driven by a non-blocking (edge-triggered) event loop:
+
+	\code
+	for(;;) {
+		while((p = reader.next()) != NULL) {
+			process(p);
+		}
+
+		if(reader.fill(fd) <= 0) {
+			break; // closed, error or no more data (EAGAIN)
+		}
+	}
+	\endcode
+
+	Blocking callers just use read().
+
+	Large payloads are received directly into the packet, without passing the read buffer.
+	After a corrupted header, the stream is resynchronized by scanning the buffer for the next sync mark.
+	Packets with the compact header (see msgpacket.h) are accepted once a regular header has been received.
+*/
+
+class MsgReader {
+public:
+
+	/**
+	MsgReader constructor.
+
+	@param	buffersize	size of the read buffer
+	*/
+	MsgReader(uint32_t buffersize = DefaultBufferSize);
+
+	/**
+	Destructor.
+	*/
+	~MsgReader();
+
+	/**
+	Feed data into the reader.
+	Copies as much data as fits into the read buffer. Call next() to make room for more.
+
+	@param	data		incoming data
+	@param	length		size of the data
+	@return number of bytes taken
+	*/
+	uint32_t feed(const uint8_t* data, uint32_t length);
+
+	/**
+	Get the next complete packet.
+	The caller takes ownership of the packet.
+
+	@return pointer to new packet or NULL if more data is needed
+	*/
+	MsgPacket* next();
+
+	/**
+	Receive data from a socket (non-blocking).
+	next() must have returned NULL before, so the buffered data has been consumed.
+
+	@param	fd			filedescriptor of the socket
+	@return number of bytes received, 0 if the connection has been closed or -1 on error (EAGAIN if no data is available)
+	*/
+	int fill(int fd);
+
+	/**
+	Receive packet from socket.
+	Waits until a complete packet has been received.
+
+	@param	fd			filedescriptor of the socket
+	@param	closed		set to true if connection has been closed
+	@param	timeout_ms	timeout in milliseconds (waiting for data)
+	@return pointer to new packet or NULL on timeout
+	*/
+	MsgPacket* read(int fd, bool& closed, int timeout_ms = 3000);
+
+	/**
+	Drop all buffered data and a partially received packet.
+	*/
+	void reset();
+
+	enum {
+		DefaultBufferSize = 16384	/*!< default size of the read buffer */
+	};
+
+private:
+
+	bool sync();
+
+	void compact();
+
+	void append(const uint8_t* data, uint32_t length);
+
+	uint8_t* m_buffer;
+	uint32_t m_size;
+	uint32_t m_start;
+	uint32_t m_end;
+
+	MsgPacket* m_packet;
+	uint8_t* m_payload;
+	uint32_t m_payloadlength;
+	uint32_t m_received;
+	uint32_t m_crc;
+	bool m_checksum;
+	bool m_synced;
+
+	MsgReader(const MsgReader&);
+	MsgReader& operator=(const MsgReader&);
+
+};
+
+#endif // MSGREADER_H
@@ -0,0 +1,80 @@
+#include <string.h>
+#include <new>
+
+#include "bufferpool.h"
+#include "msgsegment.h"
+
+MsgSegment::MsgSegment() : m_data(NULL), m_size(0), m_refcount(1) {
+}
+
+MsgSegment::~MsgSegment() {
+	MsgBufferPool::release(m_data, m_size);
+}
+
+void* MsgSegment::operator new(size_t size) {
+	uint32_t capacity = 0;
+	void* p = MsgBufferPool::alloc(size, capacity);
+
+	if(p == NULL) {
+		throw std::bad_alloc();
+	}
+
+	return p;
+}
+
+void MsgSegment::operator delete(void* p, size_t size) {
+	MsgBufferPool::release((uint8_t*)p, size);
+}
+
+MsgSegment* MsgSegment::create(uint32_t size) {
+	MsgSegment* s = new MsgSegment;
+
+	s->m_data = MsgBufferPool::alloc(size, s->m_size);
+
+	if(s->m_data == NULL) {
+		delete s;
+		return NULL;
+	}
+
+	return s;
+}
+
+MsgSegment* MsgSegment::ref() {
+	__sync_add_and_fetch(&m_refcount, 1);
+	return this;
+}
+
+void MsgSegment::unref() {
+	if(__sync_sub_and_fetch(&m_refcount, 1) == 0) {
+		delete this;
+	}
+}
+
+bool MsgSegment::shared() {
+	return (__sync_add_and_fetch(&m_refcount, 0) > 1);
+}
+
+bool MsgSegment::resize(uint32_t size, uint32_t preserve) {
+	if(size <= m_size) {
+		return true;
+	}
+
+	uint32_t capacity = 0;
+	uint8_t* buffer = MsgBufferPool::alloc(size, capacity);
+
+	if(buffer == NULL) {
+		return false;
+	}
+
+	if(preserve > m_size) {
+		preserve = m_size;
+	}
+
+	memcpy(buffer, m_data, preserve);
+	MsgBufferPool::release(m_data, m_size);
+
+	m_data = buffer;
+	m_size = capacity;
+
+	return true;
+}
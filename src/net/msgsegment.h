@@ -0,0 +1,98 @@
+/** \file msgsegment.h
+	Header file for the MsgSegment class.
+	This include file defines the reference counted buffers that can be
+	attached to a MsgPacket without copying.
+*/
+
+#ifndef MSGSEGMENT_H
+#define MSGSEGMENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+	@short Reference counted buffer segment
+
+	A segment owns a buffer from the packet buffer pool. Producers (e.g. the
+	video parsers) fill a segment and attach it to one or more packets with
+	MsgPacket::put_Segment(). The buffer is released when the last reference
+	is dropped. A segment must not be modified while it's shared.
+*/
+
+class MsgSegment {
+public:
+
+	/**
+	Create a segment.
+	The segment is returned with a reference count of 1.
+
+	@param	size		minimum size of the buffer in bytes
+	@return new segment or NULL if memory allocation failed
+	*/
+	static MsgSegment* create(uint32_t size);
+
+	/**
+	Add a reference.
+
+	@return pointer to the segment
+	*/
+	MsgSegment* ref();
+
+	/**
+	Drop a reference.
+	Deletes the segment if this was the last reference.
+	*/
+	void unref();
+
+	/**
+	Check if the segment is referenced more than once.
+
+	@return true if other owners hold a reference
+	*/
+	bool shared();
+
+	/**
+	Get pointer to the buffer.
+
+	@return pointer to the segment data
+	*/
+	uint8_t* data() {
+		return m_data;
+	}
+
+	/**
+	Get buffer size.
+
+	@return usable size of the buffer in bytes
+	*/
+	uint32_t size() {
+		return m_size;
+	}
+
+	/**
+	Resize the buffer.
+	Only allowed for segments which are not shared.
+
+	@param	size		new minimum size of the buffer in bytes
+	@param	preserve	number of bytes to keep from the old buffer
+	@return true on success / false on memory allocation error
+	*/
+	bool resize(uint32_t size, uint32_t preserve);
+
+	static void* operator new(size_t size);
+
+	static void operator delete(void* p, size_t size);
+
+private:
+
+	MsgSegment();
+
+	~MsgSegment();
+
+	uint8_t* m_data;
+	uint32_t m_size;
+	volatile int m_refcount;
+
+};
+
+#endif // MSGSEGMENT_H
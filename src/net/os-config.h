@@ -16,6 +16,7 @@
 
 #define MSG_DONTWAIT 0
 #define MSG_NOSIGNAL 0
+#define MSG_MORE 0
 
 #include <iostream>
 #include <winsock2.h>
@@ -50,6 +51,10 @@ uint16_t be16toh(uint16_t u);
 #include <syslog.h>
 #include <signal.h>
 #include <pthread.h>
+
+#ifndef MSG_MORE
+#define MSG_MORE 0
+#endif
 #endif
 
 // ANDROID
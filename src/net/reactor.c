@@ -0,0 +1,398 @@
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config/config.h"
+#include "reactor.h"
+
+// reserved ids of the internal descriptors
+#define EVENT_ID 1
+#define TIMER_ID 2
+
+int cReactor::Threads = 4;
+
+static uint64_t monotonic_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint32_t epoll_events(int events) {
+  uint32_t e = EPOLLONESHOT;
+
+  if(events & cReactor::Readable)
+    e |= EPOLLIN | EPOLLRDHUP;
+  if(events & cReactor::Writable)
+    e |= EPOLLOUT;
+
+  return e;
+}
+
+static int reactor_events(uint32_t e) {
+  int events = 0;
+
+  if(e & EPOLLIN)
+    events |= cReactor::Readable;
+  if(e & EPOLLOUT)
+    events |= cReactor::Writable;
+  if(e & (EPOLLHUP | EPOLLERR | EPOLLRDHUP))
+    events |= cReactor::Hangup;
+
+  return events;
+}
+
+class cReactorWorker : public cThread {
+public:
+
+  cReactorWorker(cReactor* reactor) : cThread("VDR XVDR Reactor"), m_reactor(reactor) {
+  }
+
+  void Stop() {
+    cThread::Cancel(3);
+  }
+
+  void Shutdown() {
+    cThread::Cancel(-1);
+  }
+
+protected:
+
+  void Action() {
+    while(Running())
+      m_reactor->Poll(1000);
+  }
+
+private:
+
+  cReactor* m_reactor;
+
+};
+
+cReactorHandler::cReactorHandler() : m_handlerid(0), m_fd(-1), m_pending(0), m_running(false), m_queued(false), m_thread(0), m_deadline(0), m_removed(NULL) {
+}
+
+cReactorHandler::~cReactorHandler() {
+  cReactor::GetInstance().Remove(this);
+}
+
+cReactor::cReactor() : m_epollfd(-1), m_eventfd(-1), m_timerfd(-1), m_nextid(TIMER_ID + 1) {
+}
+
+cReactor::~cReactor() {
+  Stop();
+}
+
+cReactor& cReactor::GetInstance() {
+  static cReactor instance;
+  return instance;
+}
+
+void cReactor::SetThreads(int count) {
+  Threads = count;
+  DEBUGLOG("REACTORTHREADS: %i", Threads);
+}
+
+bool cReactor::Start() {
+  if(m_epollfd != -1)
+    return true;
+
+  m_epollfd = epoll_create1(EPOLL_CLOEXEC);
+  m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+  if(m_epollfd == -1 || m_eventfd == -1 || m_timerfd == -1) {
+    ERRORLOG("Unable to create reactor (%i)", errno);
+    Stop();
+    return false;
+  }
+
+  // internal descriptors are level-triggered, any idle worker may pick them up
+  struct epoll_event e;
+
+  e.events = EPOLLIN;
+  e.data.u64 = EVENT_ID;
+  epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_eventfd, &e);
+
+  e.events = EPOLLIN;
+  e.data.u64 = TIMER_ID;
+  epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_timerfd, &e);
+
+  int count = (Threads < 1) ? 1 : Threads;
+
+  for(int i = 0; i < count; i++) {
+    cReactorWorker* worker = new cReactorWorker(this);
+    m_workers.push_back(worker);
+    worker->Start();
+  }
+
+  INFOLOG("Reactor started with %i worker threads", count);
+  return true;
+}
+
+void cReactor::Stop() {
+  // signal all workers first, then wait for them
+  for(std::vector<cReactorWorker*>::iterator i = m_workers.begin(); i != m_workers.end(); i++)
+    (*i)->Shutdown();
+
+  for(std::vector<cReactorWorker*>::iterator i = m_workers.begin(); i != m_workers.end(); i++) {
+    (*i)->Stop();
+    delete *i;
+  }
+
+  m_workers.clear();
+
+  if(m_epollfd != -1)
+    close(m_epollfd);
+  if(m_eventfd != -1)
+    close(m_eventfd);
+  if(m_timerfd != -1)
+    close(m_timerfd);
+
+  m_epollfd = -1;
+  m_eventfd = -1;
+  m_timerfd = -1;
+}
+
+bool cReactor::Add(cReactorHandler* handler, int fd, int events) {
+  cMutexLock lock(&m_lock);
+
+  if(handler->m_handlerid != 0)
+    return false;
+
+  uint64_t id = m_nextid++;
+
+  if(fd != -1) {
+    struct epoll_event e;
+    e.events = epoll_events(events);
+    e.data.u64 = id;
+
+    if(epoll_ctl(m_epollfd, EPOLL_CTL_ADD, fd, &e) == -1) {
+      ERRORLOG("Unable to add descriptor %i to the reactor (%i)", fd, errno);
+      return false;
+    }
+  }
+
+  handler->m_handlerid = id;
+  handler->m_fd = fd;
+  handler->m_pending = 0;
+  handler->m_queued = false;
+  handler->m_deadline = 0;
+
+  m_handlers[id] = handler;
+  return true;
+}
+
+bool cReactor::Arm(cReactorHandler* handler, int events) {
+  cMutexLock lock(&m_lock);
+
+  if(handler->m_handlerid == 0 || handler->m_fd == -1)
+    return false;
+
+  struct epoll_event e;
+  e.events = epoll_events(events);
+  e.data.u64 = handler->m_handlerid;
+
+  return (epoll_ctl(m_epollfd, EPOLL_CTL_MOD, handler->m_fd, &e) == 0);
+}
+
+void cReactor::Remove(cReactorHandler* handler) {
+  cMutexLock lock(&m_lock);
+
+  if(handler->m_handlerid != 0) {
+    m_handlers.erase(handler->m_handlerid);
+
+    if(handler->m_fd != -1)
+      epoll_ctl(m_epollfd, EPOLL_CTL_DEL, handler->m_fd, NULL);
+
+    handler->m_handlerid = 0;
+    handler->m_fd = -1;
+    handler->m_pending = 0;
+    handler->m_deadline = 0;
+  }
+
+  // removed by the worker running it, the handler may be gone when OnEvent() returns
+  if(handler->m_running && handler->m_thread == cThread::ThreadId()) {
+    if(handler->m_removed != NULL)
+      *handler->m_removed = true;
+
+    handler->m_running = false;
+    handler->m_thread = 0;
+    handler->m_removed = NULL;
+    m_idle.Broadcast();
+    return;
+  }
+
+  // wait until a worker has left the handler
+  while(handler->m_running)
+    m_idle.Wait(m_lock);
+}
+
+void cReactor::Notify(cReactorHandler* handler) {
+  cMutexLock lock(&m_lock);
+
+  if(handler->m_handlerid == 0)
+    return;
+
+  handler->m_pending |= Wakeup;
+
+  // a running handler picks up the pending event itself
+  if(handler->m_running || handler->m_queued)
+    return;
+
+  handler->m_queued = true;
+  m_ready.push_back(handler->m_handlerid);
+
+  uint64_t one = 1;
+  if(write(m_eventfd, &one, sizeof(one)) == -1)
+    ERRORLOG("Unable to signal reactor (%i)", errno);
+}
+
+void cReactor::SetTimer(cReactorHandler* handler, int ms) {
+  cMutexLock lock(&m_lock);
+
+  if(handler->m_handlerid == 0)
+    return;
+
+  handler->m_deadline = (ms < 0) ? 0 : monotonic_ms() + ms;
+  UpdateTimer();
+}
+
+void cReactor::UpdateTimer() {
+  uint64_t deadline = 0;
+
+  for(HandlerMap::iterator i = m_handlers.begin(); i != m_handlers.end(); i++) {
+    uint64_t d = i->second->m_deadline;
+    if(d != 0 && (deadline == 0 || d < deadline))
+      deadline = d;
+  }
+
+  struct itimerspec t;
+  memset(&t, 0, sizeof(t));
+
+  // an absolute zero would disarm the timer
+  if(deadline != 0) {
+    t.it_value.tv_sec = deadline / 1000;
+    t.it_value.tv_nsec = (deadline % 1000) * 1000000 + 1;
+  }
+
+  timerfd_settime(m_timerfd, TFD_TIMER_ABSTIME, &t, NULL);
+}
+
+void cReactor::Poll(int timeout_ms) {
+  struct epoll_event e;
+
+  // take one event at a time, so a slow handler doesn't delay events picked up with it
+  int rc = epoll_wait(m_epollfd, &e, 1, timeout_ms);
+
+  if(rc <= 0)
+    return;
+
+  if(e.data.u64 == EVENT_ID)
+    ProcessWakeups();
+  else if(e.data.u64 == TIMER_ID)
+    ProcessTimers();
+  else
+    Dispatch(e.data.u64, reactor_events(e.events));
+}
+
+void cReactor::ProcessWakeups() {
+  uint64_t count = 0;
+  if(read(m_eventfd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+    ERRORLOG("Unable to read reactor event (%i)", errno);
+
+  for(;;) {
+    m_lock.Lock();
+
+    if(m_ready.empty()) {
+      m_lock.Unlock();
+      return;
+    }
+
+    uint64_t id = m_ready.front();
+    m_ready.pop_front();
+
+    // let another worker help with the remaining handlers
+    if(!m_ready.empty()) {
+      uint64_t one = 1;
+      if(write(m_eventfd, &one, sizeof(one)) == -1)
+        ERRORLOG("Unable to signal reactor (%i)", errno);
+    }
+
+    HandlerMap::iterator i = m_handlers.find(id);
+    if(i != m_handlers.end())
+      i->second->m_queued = false;
+
+    m_lock.Unlock();
+
+    Dispatch(id, 0);
+  }
+}
+
+void cReactor::ProcessTimers() {
+  uint64_t count = 0;
+  if(read(m_timerfd, &count, sizeof(count)) == -1)
+    return;
+
+  std::vector<uint64_t> expired;
+  uint64_t now = monotonic_ms();
+
+  m_lock.Lock();
+
+  for(HandlerMap::iterator i = m_handlers.begin(); i != m_handlers.end(); i++) {
+    cReactorHandler* handler = i->second;
+    if(handler->m_deadline != 0 && handler->m_deadline <= now) {
+      handler->m_deadline = 0;
+      expired.push_back(i->first);
+    }
+  }
+
+  UpdateTimer();
+  m_lock.Unlock();
+
+  for(std::vector<uint64_t>::iterator i = expired.begin(); i != expired.end(); i++)
+    Dispatch(*i, Timeout);
+}
+
+void cReactor::Dispatch(uint64_t id, int events) {
+  cMutexLock lock(&m_lock);
+
+  HandlerMap::iterator i = m_handlers.find(id);
+
+  if(i == m_handlers.end())
+    return;
+
+  cReactorHandler* handler = i->second;
+  handler->m_pending |= events;
+
+  // the worker running the handler will pick up the events
+  if(handler->m_running)
+    return;
+
+  bool removed = false;
+
+  handler->m_running = true;
+  handler->m_thread = cThread::ThreadId();
+  handler->m_removed = &removed;
+
+  while(handler->m_pending != 0 && handler->m_handlerid == id) {
+    int pending = handler->m_pending;
+    handler->m_pending = 0;
+
+    m_lock.Unlock();
+    handler->OnEvent(pending);
+    m_lock.Lock();
+
+    // the handler has removed itself (and may be deleted)
+    if(removed)
+      return;
+  }
+
+  handler->m_running = false;
+  handler->m_thread = 0;
+  handler->m_removed = NULL;
+  m_idle.Broadcast();
+}
@@ -0,0 +1,122 @@
+#ifndef XVDR_REACTOR_H
+#define XVDR_REACTOR_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <map>
+#include <list>
+#include <vector>
+#include <vdr/thread.h>
+
+class cReactor;
+class cReactorWorker;
+
+// Event handler of the reactor.
+// OnEvent() is called by the worker threads, but never concurrently for the same handler.
+// Derived classes must call cReactor::Remove() at the beginning of their destructor.
+// A handler may remove (and delete) itself in OnEvent(), the reactor doesn't touch
+// it afterwards.
+
+class cReactorHandler {
+public:
+
+  cReactorHandler();
+
+  virtual ~cReactorHandler();
+
+  virtual void OnEvent(int events) = 0;
+
+private:
+
+  friend class cReactor;
+
+  uint64_t m_handlerid;
+  int m_fd;
+  int m_pending;
+  bool m_running;
+  bool m_queued;
+  pid_t m_thread;
+  uint64_t m_deadline;
+  bool* m_removed;      // set if removed while running (by the worker running it)
+
+};
+
+// Multiplexes the connections on a small pool of worker threads (epoll).
+// File descriptors are registered one-shot: after an event has been handled,
+// the handler has to re-arm its descriptor with Arm().
+// Wakeup() (eventfd) and SetTimer() (timerfd) deliver events without a descriptor.
+
+class cReactor {
+public:
+
+  enum {
+    Readable = 0x01,
+    Writable = 0x02,
+    Hangup   = 0x04,
+    Wakeup   = 0x08,
+    Timeout  = 0x10
+  };
+
+  static cReactor& GetInstance();
+
+  bool Start();
+
+  void Stop();
+
+  bool Add(cReactorHandler* handler, int fd, int events);
+
+  bool Arm(cReactorHandler* handler, int events);
+
+  void Remove(cReactorHandler* handler);
+
+  void Notify(cReactorHandler* handler);
+
+  void SetTimer(cReactorHandler* handler, int ms);
+
+  static void SetThreads(int count);
+
+protected:
+
+  cReactor();
+
+  virtual ~cReactor();
+
+  void Poll(int timeout_ms);
+
+  void Dispatch(uint64_t id, int events);
+
+  void ProcessWakeups();
+
+  void ProcessTimers();
+
+  void UpdateTimer();
+
+private:
+
+  friend class cReactorWorker;
+
+  typedef std::map<uint64_t, cReactorHandler*> HandlerMap;
+
+  int m_epollfd;
+
+  int m_eventfd;
+
+  int m_timerfd;
+
+  cMutex m_lock;
+
+  cCondVar m_idle;
+
+  HandlerMap m_handlers;
+
+  std::list<uint64_t> m_ready;
+
+  uint64_t m_nextid;
+
+  std::vector<cReactorWorker*> m_workers;
+
+  static int Threads;
+
+};
+
+#endif // XVDR_REACTOR_H
@@ -0,0 +1,342 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "config/config.h"
+#include "msgpacket.h"
+#include "msgcompressor.h"
+#include "metrics.h"
+#include "sendqueue.h"
+
+// maximum number of packets passed to a single write
+#define WRITE_BATCH 64
+
+// busy time covered by a throughput sample (us)
+#define THROUGHPUT_WINDOW 1000000
+
+int cSendQueue::BufferSize = 0;
+int cSendQueue::LowWatermark = 128 * 1024;
+
+cSendQueue::cSendQueue(int sock, int timeout_ms) : m_socket(sock), m_pollfd(-1), m_timeout(timeout_ms), m_head(NULL), m_signaled(0), m_flush(0), m_backlog(0), m_offset(0), m_blocked(false), m_failed(false), m_compressor(NULL), m_compacttype(0), m_metrics(NULL), m_waiter(NULL), m_lowmark(0), m_tracer(NULL), m_busystart(0), m_windowbusy(0), m_windowbytes(0), m_throughput(0) {
+}
+
+cSendQueue::~cSendQueue() {
+  cReactor::GetInstance().Remove(this);
+
+  cMetrics::Add(cMetrics::SendRate, -(int64_t)m_throughput, m_metrics);
+
+  if(m_pollfd != -1)
+    close(m_pollfd);
+
+  Drop();
+}
+
+bool cSendQueue::Start() {
+  // the connection is registered with the reactor for reading,
+  // we need our own descriptor to wait until the socket is writable
+  m_pollfd = dup(m_socket);
+
+  if(BufferSize > 0 && setsockopt(m_socket, SOL_SOCKET, SO_SNDBUF, &BufferSize, sizeof(BufferSize)) == -1)
+    ERRORLOG("Unable to set send buffer size (%i)", errno);
+
+  // older kernels don't know about it
+#ifdef TCP_NOTSENT_LOWAT
+  if(LowWatermark > 0 && setsockopt(m_socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &LowWatermark, sizeof(LowWatermark)) == -1)
+    DEBUGLOG("Unable to set unsent data low watermark (%i)", errno);
+#endif
+
+  if(m_pollfd == -1 || !cReactor::GetInstance().Add(this, m_pollfd, 0)) {
+    ERRORLOG("Unable to register send queue");
+    return false;
+  }
+
+  return true;
+}
+
+void cSendQueue::Send(MsgPacket* p, int flags) {
+  Node* n = new Node;
+  n->packet = p;
+  n->flags = flags;
+  n->length = p->getPacketLength();
+
+  __sync_fetch_and_add(&m_backlog, n->length);
+  cMetrics::Add(cMetrics::SendBacklog, n->length, m_metrics);
+
+  Node* head = NULL;
+
+  do {
+    head = m_head;
+    n->next = head;
+  }
+  while(!__sync_bool_compare_and_swap(&m_head, head, n));
+
+  Signal();
+}
+
+void cSendQueue::Flush() {
+  __sync_lock_test_and_set(&m_flush, 1);
+  Signal();
+}
+
+void cSendQueue::Signal() {
+  // wake up the writer only once until it has collected the packets
+  if(__sync_bool_compare_and_swap(&m_signaled, 0, 1))
+    cReactor::GetInstance().Notify(this);
+}
+
+void cSendQueue::SetCompressor(MsgCompressor* compressor) {
+  m_compressor = compressor;
+  __sync_synchronize();
+}
+
+void cSendQueue::SetCompactType(uint16_t type) {
+  m_compacttype = type;
+  __sync_synchronize();
+}
+
+void cSendQueue::SetMetrics(cMetricSet* metrics) {
+  m_metrics = metrics;
+}
+
+cMetricSet* cSendQueue::Metrics() {
+  return m_metrics;
+}
+
+void cSendQueue::SetTracer(cSendTracer* tracer) {
+  cMutexLock lock(&m_tracerLock);
+  m_tracer = tracer;
+}
+
+uint32_t cSendQueue::Backlog() {
+  return m_backlog;
+}
+
+uint32_t cSendQueue::Throughput() {
+  return m_throughput;
+}
+
+void cSendQueue::SetBufferSize(int bytes) {
+  BufferSize = bytes;
+  DEBUGLOG("SENDBUFFERSIZE: %i bytes", BufferSize);
+}
+
+void cSendQueue::SetLowWatermark(int bytes) {
+  LowWatermark = bytes;
+  DEBUGLOG("SENDLOWWATERMARK: %i bytes", LowWatermark);
+}
+
+void cSendQueue::UpdateThroughput(uint32_t bytes, bool idle) {
+  uint64_t now = cMetrics::Now();
+
+  // only the time with data pending counts, an idle connection says nothing about the link
+  if(m_busystart == 0)
+    m_busystart = now;
+
+  m_windowbytes += bytes;
+  uint64_t busy = m_windowbusy + (now - m_busystart);
+
+  if(idle) {
+    m_windowbusy = busy;
+    m_busystart = 0;
+  }
+
+  if(busy < THROUGHPUT_WINDOW)
+    return;
+
+  uint32_t rate = (uint32_t)(m_windowbytes * 1000000 / busy);
+  uint32_t last = m_throughput;
+
+  m_throughput = (last == 0) ? rate : (3 * (uint64_t)last + rate) / 4;
+  cMetrics::Add(cMetrics::SendRate, (int64_t)m_throughput - last, m_metrics);
+
+  m_windowbytes = 0;
+  m_windowbusy = 0;
+
+  if(!idle)
+    m_busystart = now;
+}
+
+void cSendQueue::SetWaiter(cReactorHandler* handler, uint32_t lowmark) {
+  cMutexLock lock(&m_waiterLock);
+
+  m_waiter = NULL;
+  m_lowmark = lowmark;
+
+  if(handler == NULL)
+    return;
+
+  // already drained ?
+  if(m_backlog <= lowmark) {
+    cReactor::GetInstance().Notify(handler);
+    return;
+  }
+
+  m_waiter = handler;
+}
+
+void cSendQueue::NotifyWaiter() {
+  cMutexLock lock(&m_waiterLock);
+
+  if(m_waiter == NULL || m_backlog > m_lowmark)
+    return;
+
+  cReactor::GetInstance().Notify(m_waiter);
+  m_waiter = NULL;
+}
+
+void cSendQueue::Collect() {
+  Node* n = __sync_lock_test_and_set(&m_head, (Node*)NULL);
+
+  // restore the order the packets have been queued
+  Node* list = NULL;
+
+  while(n != NULL) {
+    Node* next = n->next;
+    n->next = list;
+    list = n;
+    n = next;
+  }
+
+  uint16_t compacttype = m_compacttype;
+
+  while(list != NULL) {
+    Node* next = list->next;
+
+    // compress in the order the packets go out (streaming compressors depend on that)
+    if((list->flags & Compress) && m_compressor != NULL) {
+      uint32_t length = list->packet->getPayloadLength();
+
+      if(list->packet->compress(*m_compressor)) {
+        cMetrics::Add(cMetrics::CompressIn, length, m_metrics);
+        cMetrics::Add(cMetrics::CompressOut, list->packet->getPayloadLength(), m_metrics);
+      }
+    }
+
+    // the header is chosen at send time, the timeshift buffer keeps regular packets
+    if(compacttype != 0 && list->packet->getType() == compacttype)
+      list->packet->setCompact();
+
+    m_pending.push_back(list);
+    list = next;
+  }
+}
+
+void cSendQueue::Drop() {
+  Collect();
+
+  while(!m_pending.empty()) {
+    Node* n = m_pending.front();
+    m_pending.pop_front();
+
+    __sync_fetch_and_sub(&m_backlog, n->length);
+    cMetrics::Add(cMetrics::SendBacklog, -(int64_t)n->length, m_metrics);
+    delete n->packet;
+    delete n;
+  }
+
+  m_offset = 0;
+}
+
+void cSendQueue::OnEvent(int events) {
+  // the client didn't take any data within the timeout
+  if((events & cReactor::Timeout) && m_blocked && !m_failed) {
+    ERRORLOG("Client didn't take any data for %i ms, closing connection", m_timeout);
+    shutdown(m_socket, SHUT_RDWR);
+    m_failed = true;
+    cMetrics::Add(cMetrics::SendTimeouts, 1, m_metrics);
+  }
+
+  // packets queued from now on need another wakeup
+  __sync_bool_compare_and_swap(&m_signaled, 1, 0);
+
+  Collect();
+
+  if(m_failed) {
+    Drop();
+    NotifyWaiter();
+    return;
+  }
+
+  Write();
+  NotifyWaiter();
+}
+
+void cSendQueue::Write() {
+  MsgPacket* packets[WRITE_BATCH];
+
+  while(!m_pending.empty()) {
+    int count = 0;
+
+    for(std::deque<Node*>::iterator i = m_pending.begin(); i != m_pending.end() && count < WRITE_BATCH; i++)
+      packets[count++] = (*i)->packet;
+
+    bool more = (count < (int)m_pending.size()) || (m_pending[count - 1]->flags & More);
+    uint32_t offset = m_offset;
+
+    int rc = MsgPacket::trywrite(m_socket, packets, count, m_offset, more);
+    bool full = (errno == EAGAIN);
+
+    if(rc == -1) {
+      ERRORLOG("Unable to send data to client (%i)", errno);
+      shutdown(m_socket, SHUT_RDWR);
+      m_failed = true;
+      Drop();
+      return;
+    }
+
+    uint32_t bytes = 0;
+    uint32_t queued = 0;
+
+    for(int i = 0; i < rc; i++) {
+      Node* n = m_pending.front();
+      m_pending.pop_front();
+
+      bytes += n->packet->getPacketLength();
+      queued += n->length;
+
+      __sync_fetch_and_sub(&m_backlog, n->length);
+
+      if(n->flags & Trace) {
+        cMutexLock lock(&m_tracerLock);
+        if(m_tracer != NULL)
+          m_tracer->Written(n->packet);
+      }
+
+      delete n->packet;
+      delete n;
+    }
+
+    if(rc > 0) {
+      cMetrics::Add(cMetrics::BytesSent, bytes, m_metrics);
+      cMetrics::Add(cMetrics::PacketsSent, rc, m_metrics);
+      cMetrics::Add(cMetrics::SendBacklog, -(int64_t)queued, m_metrics);
+    }
+
+    UpdateThroughput(bytes + m_offset - offset, m_pending.empty() && !full);
+
+    if(!full)
+      continue;
+
+    // (re)start the timeout whenever the client has taken some data
+    if(!m_blocked || rc > 0 || m_offset != offset) {
+      m_blocked = true;
+      cReactor::GetInstance().SetTimer(this, m_timeout);
+    }
+
+    cReactor::GetInstance().Arm(this, cReactor::Writable);
+    return;
+  }
+
+  if(m_blocked) {
+    m_blocked = false;
+    cReactor::GetInstance().SetTimer(this, -1);
+  }
+
+  // push out data held back by MSG_MORE
+  if(__sync_bool_compare_and_swap(&m_flush, 1, 0)) {
+    int val = 1;
+    setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+  }
+}
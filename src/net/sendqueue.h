@@ -0,0 +1,165 @@
+#ifndef XVDR_SENDQUEUE_H
+#define XVDR_SENDQUEUE_H
+
+#include <stdint.h>
+#include <deque>
+#include <vdr/thread.h>
+
+#include "reactor.h"
+
+class MsgPacket;
+class MsgCompressor;
+class cMetricSet;
+
+// Notified about packets queued with the Trace flag once they have been written.
+
+class cSendTracer {
+public:
+
+  virtual ~cSendTracer() {}
+
+  virtual void Written(MsgPacket* p) = 0;
+
+};
+
+// Outbound packet queue of a connection.
+// Any thread may add packets with Send(). It never blocks and doesn't take a lock:
+// the packets are pushed onto a lock-free list, which is drained by a single writer
+// running on the reactor. The writer doesn't block on the socket either: a partially
+// written packet is continued as soon as the socket becomes writable again.
+// If the client doesn't take any data within the timeout, the connection is shut down.
+// The kernel buffers are kept small (TCP_NOTSENT_LOWAT, SO_SNDBUF), so data waits in
+// userspace where it can still be dropped, and the writer measures the throughput
+// of the connection.
+
+class cSendQueue : public cReactorHandler {
+public:
+
+  enum {
+    More     = 0x01,  // more data follows, the last partial TCP segment may be held back
+    Compress = 0x02,  // compress the packet with the connection compressor
+    Trace    = 0x04   // report the packet to the tracer when it has been written
+  };
+
+  cSendQueue(int sock, int timeout_ms = 3000);
+
+  virtual ~cSendQueue();
+
+  bool Start();
+
+  // queue a packet, the queue takes ownership
+  void Send(MsgPacket* p, int flags = 0);
+
+  // push out data held back by the More flag
+  void Flush();
+
+  // compressor used for packets with the Compress flag (owned by the caller)
+  void SetCompressor(MsgCompressor* compressor);
+
+  // send packets of this type with the compact header (0 = off)
+  void SetCompactType(uint16_t type);
+
+  // metrics of the connection (owned by the caller)
+  void SetMetrics(cMetricSet* metrics);
+
+  cMetricSet* Metrics();
+
+  // tracer of packets with the Trace flag (owned by the caller, NULL to remove)
+  void SetTracer(cSendTracer* tracer);
+
+  // number of bytes queued but not yet written
+  uint32_t Backlog();
+
+  // bytes/s written while data was pending (0 = not measured yet)
+  uint32_t Throughput();
+
+  // kernel send buffer of the connections (0 = system default)
+  static void SetBufferSize(int bytes);
+
+  // unsent data kept by the kernel (TCP_NOTSENT_LOWAT, 0 = unlimited)
+  static void SetLowWatermark(int bytes);
+
+  // notify a handler once, when the backlog has dropped to the low watermark
+  void SetWaiter(cReactorHandler* handler, uint32_t lowmark);
+
+protected:
+
+  void OnEvent(int events);
+
+  void Write();
+
+  void Drop();
+
+private:
+
+  struct Node {
+    MsgPacket* packet;
+    int flags;
+    uint32_t length;
+    Node* next;
+  };
+
+  void Collect();
+
+  void Signal();
+
+  void NotifyWaiter();
+
+  void UpdateThroughput(uint32_t bytes, bool idle);
+
+  int m_socket;
+
+  int m_pollfd;
+
+  int m_timeout;
+
+  // pushed by the producers (newest first)
+  Node* volatile m_head;
+
+  volatile int m_signaled;
+
+  volatile int m_flush;
+
+  volatile uint32_t m_backlog;
+
+  // owned by the writer
+  std::deque<Node*> m_pending;
+
+  uint32_t m_offset;
+
+  bool m_blocked;
+
+  bool m_failed;
+
+  MsgCompressor* m_compressor;
+
+  volatile uint16_t m_compacttype;
+
+  cMetricSet* m_metrics;
+
+  cMutex m_waiterLock;
+
+  cReactorHandler* m_waiter;
+
+  uint32_t m_lowmark;
+
+  cMutex m_tracerLock;
+
+  cSendTracer* m_tracer;
+
+  // throughput measurement (writer)
+  uint64_t m_busystart;
+
+  uint64_t m_windowbusy;
+
+  uint64_t m_windowbytes;
+
+  volatile uint32_t m_throughput;
+
+  static int BufferSize;
+
+  static int LowWatermark;
+
+};
+
+#endif // XVDR_SENDQUEUE_H
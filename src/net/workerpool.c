@@ -0,0 +1,120 @@
+#include "config/config.h"
+#include "workerpool.h"
+
+int cWorkerPool::Threads = 4;
+
+class cWorkerThread : public cThread {
+public:
+
+  cWorkerThread(cWorkerPool* pool) : cThread("VDR XVDR Worker"), m_pool(pool) {
+  }
+
+  void Stop() {
+    cThread::Cancel(3);
+  }
+
+protected:
+
+  void Action() {
+    cWorkerJob* job = NULL;
+
+    while((job = m_pool->Next()) != NULL) {
+      job->Run();
+      delete job;
+    }
+  }
+
+private:
+
+  cWorkerPool* m_pool;
+
+};
+
+cWorkerPool::cWorkerPool() : m_stopping(false) {
+}
+
+cWorkerPool::~cWorkerPool() {
+  Stop();
+}
+
+cWorkerPool& cWorkerPool::GetInstance() {
+  static cWorkerPool instance;
+  return instance;
+}
+
+void cWorkerPool::SetThreads(int count) {
+  Threads = count;
+  DEBUGLOG("REQUESTTHREADS: %i", Threads);
+}
+
+bool cWorkerPool::Start() {
+  cMutexLock lock(&m_lock);
+
+  if(!m_workers.empty())
+    return true;
+
+  m_stopping = false;
+  int count = (Threads < 1) ? 1 : Threads;
+
+  for(int i = 0; i < count; i++) {
+    cWorkerThread* worker = new cWorkerThread(this);
+    m_workers.push_back(worker);
+    worker->Start();
+  }
+
+  INFOLOG("Worker pool started with %i threads", count);
+  return true;
+}
+
+void cWorkerPool::Stop() {
+  m_lock.Lock();
+  m_stopping = true;
+  m_queued.Broadcast();
+  m_lock.Unlock();
+
+  // workers finish their current job and leave
+  for(std::vector<cWorkerThread*>::iterator i = m_workers.begin(); i != m_workers.end(); i++) {
+    (*i)->Stop();
+    delete *i;
+  }
+
+  m_workers.clear();
+
+  cMutexLock lock(&m_lock);
+
+  for(std::list<cWorkerJob*>::iterator i = m_jobs.begin(); i != m_jobs.end(); i++)
+    delete *i;
+
+  m_jobs.clear();
+}
+
+void cWorkerPool::Queue(cWorkerJob* job) {
+  m_lock.Lock();
+
+  // no workers, run the job in the calling thread
+  if(m_workers.empty() || m_stopping) {
+    m_lock.Unlock();
+    job->Run();
+    delete job;
+    return;
+  }
+
+  m_jobs.push_back(job);
+  m_queued.Broadcast();
+  m_lock.Unlock();
+}
+
+cWorkerJob* cWorkerPool::Next() {
+  cMutexLock lock(&m_lock);
+
+  while(m_jobs.empty() && !m_stopping)
+    m_queued.Wait(m_lock);
+
+  if(m_stopping)
+    return NULL;
+
+  cWorkerJob* job = m_jobs.front();
+  m_jobs.pop_front();
+
+  return job;
+}
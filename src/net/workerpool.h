@@ -0,0 +1,64 @@
+#ifndef XVDR_WORKERPOOL_H
+#define XVDR_WORKERPOOL_H
+
+#include <list>
+#include <vector>
+#include <vdr/thread.h>
+
+class cWorkerThread;
+
+// Job of the worker pool.
+// The pool deletes the job after Run() has returned.
+
+class cWorkerJob {
+public:
+
+  virtual ~cWorkerJob() {}
+
+  virtual void Run() = 0;
+
+};
+
+// Bounded pool of threads running jobs in the order they have been queued.
+// Takes work off the reactor threads which must not block on slow requests.
+
+class cWorkerPool {
+public:
+
+  static cWorkerPool& GetInstance();
+
+  bool Start();
+
+  void Stop();
+
+  void Queue(cWorkerJob* job);
+
+  static void SetThreads(int count);
+
+protected:
+
+  cWorkerPool();
+
+  virtual ~cWorkerPool();
+
+  cWorkerJob* Next();
+
+private:
+
+  friend class cWorkerThread;
+
+  cMutex m_lock;
+
+  cCondVar m_queued;
+
+  std::list<cWorkerJob*> m_jobs;
+
+  std::vector<cWorkerThread*> m_workers;
+
+  bool m_stopping;
+
+  static int Threads;
+
+};
+
+#endif // XVDR_WORKERPOOL_H
@@ -24,9 +24,25 @@
  */
 
 #include <getopt.h>
+#include <string>
+#include <vector>
 #include <vdr/plugin.h>
+#include "net/metrics.h"
+#include "live/livetrace.h"
+#include "live/timeshiftbuffer.h"
 #include "xvdr.h"
 
+static std::string FormatMetrics(const char *Name, const cMetrics::Values &Values)
+{
+  std::string line = Name;
+  line += ":";
+
+  for (int i = 0; i < cMetrics::Count; i++)
+    line += *cString::sprintf(" %s=%lld", cMetrics::Name(i), (long long)Values.value[i]);
+
+  return line;
+}
+
 cPluginXVDRServer::cPluginXVDRServer(void)
 {
   Server = NULL;
@@ -127,12 +143,131 @@ bool cPluginXVDRServer::Service(const char *Id, void *Data)
 const char **cPluginXVDRServer::SVDRPHelpPages(void)
 {
   // Return help text for SVDRP commands this plugin implements
-  return NULL;
+  static const char *HelpPages[] = {
+    "STAT\n"
+    "    Print the metrics of all clients and of each connected client\n"
+    "    (id, address and name of the client followed by the values)\n"
+    "    and the time (us) of the timeshift block writes.",
+    "REQS\n"
+    "    Print the processing time (us) and response sizes of the requests\n"
+    "    per opcode (lock_* is the time spent waiting for locks).",
+    "TRCE [ <file> ]\n"
+    "    Print the latency (us) of the live pipeline stages of the traced\n"
+    "    stream packets (see TraceSampleRate). If a file is given, the traces\n"
+    "    are written to it in Chrome trace format (chrome://tracing).",
+    NULL
+  };
+
+  return HelpPages;
 }
 
 cString cPluginXVDRServer::SVDRPCommand(const char *Command, const char *Option, int &ReplyCode)
 {
   // Process SVDRP commands this plugin implements
+  if (strcasecmp(Command, "STAT") == 0)
+  {
+    cMetrics::Values total;
+    cMetrics::Get(total);
+
+    std::string result = FormatMetrics("total", total);
+
+    std::vector<std::pair<std::string, cMetrics::Values> > clients;
+    cMetrics::GetSets(clients);
+
+    for (std::vector<std::pair<std::string, cMetrics::Values> >::iterator i = clients.begin(); i != clients.end(); i++)
+    {
+      result += "\n";
+      result += FormatMetrics(*cString::sprintf("client %s", i->first.c_str()), i->second);
+    }
+
+    cLatencyHistogram &writes = cTimeShiftBuffer::WriteLatency();
+
+    result += *cString::sprintf("\ntimeshift writes: count=%llu p50=%llu p90=%llu p99=%llu max=%llu",
+                                (unsigned long long)writes.Count(),
+                                (unsigned long long)writes.Percentile(50),
+                                (unsigned long long)writes.Percentile(90),
+                                (unsigned long long)writes.Percentile(99),
+                                (unsigned long long)writes.Max());
+
+    return result.c_str();
+  }
+
+  if (strcasecmp(Command, "REQS") == 0)
+  {
+    std::string result;
+
+    for (int i = 0; i < cMetrics::MaxOpcodes; i++)
+    {
+      cRequestStats *stats = cMetrics::GetRequestStats(i);
+      uint64_t count = stats->time.Count();
+
+      if (count == 0)
+        continue;
+
+      if (!result.empty())
+        result += "\n";
+
+      result += *cString::sprintf("opcode %i: count=%llu p50=%llu p90=%llu p99=%llu max=%llu lock_p50=%llu lock_p99=%llu lock_max=%llu avg_bytes=%llu max_bytes=%u",
+                                  i, (unsigned long long)count,
+                                  (unsigned long long)stats->time.Percentile(50),
+                                  (unsigned long long)stats->time.Percentile(90),
+                                  (unsigned long long)stats->time.Percentile(99),
+                                  (unsigned long long)stats->time.Max(),
+                                  (unsigned long long)stats->lockwait.Percentile(50),
+                                  (unsigned long long)stats->lockwait.Percentile(99),
+                                  (unsigned long long)stats->lockwait.Max(),
+                                  (unsigned long long)(stats->bytes / count),
+                                  stats->maxbytes);
+    }
+
+    if (result.empty())
+      result = "no requests processed";
+
+    return result.c_str();
+  }
+
+  if (strcasecmp(Command, "TRCE") == 0)
+  {
+    if (cLiveTrace::GetSampleRate() == 0)
+    {
+      ReplyCode = 550;
+      return "tracing is off (TraceSampleRate)";
+    }
+
+    std::string result;
+
+    for (int i = 0; i < cLiveTrace::StageCount; i++)
+    {
+      cLatencyHistogram *latency = cLiveTrace::GetHistogram(i);
+
+      if (!result.empty())
+        result += "\n";
+
+      result += *cString::sprintf("%s: count=%llu p50=%llu p90=%llu p99=%llu max=%llu",
+                                  cLiveTrace::StageName(i),
+                                  (unsigned long long)latency->Count(),
+                                  (unsigned long long)latency->Percentile(50),
+                                  (unsigned long long)latency->Percentile(90),
+                                  (unsigned long long)latency->Percentile(99),
+                                  (unsigned long long)latency->Max());
+    }
+
+    if (Option != NULL && *Option)
+    {
+      int count = cLiveTrace::Dump(Option);
+
+      if (count < 0)
+      {
+        ReplyCode = 554;
+        return cString::sprintf("unable to write trace file '%s'", Option);
+      }
+
+      result += *cString::sprintf("\n%i events written to '%s'", count, Option);
+    }
+
+    return result.c_str();
+  }
+
   return NULL;
 }
 
@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/socket.h>
+#include <errno.h>
 #include <set>
 #include <map>
 #include <string>
@@ -43,7 +44,10 @@
 #include "config/config.h"
 #include "live/livestreamer.h"
 #include "net/msgpacket.h"
-#include "net/socketlock.h"
+#include "net/msgcompressor.h"
+#include "net/msgreader.h"
+#include "net/sendqueue.h"
+#include "net/workerpool.h"
 #include "recordings/recordingscache.h"
 #include "recordings/recplayer.h"
 #include "scanner/wirbelscanservice.h" /// copied from modified wirbelscan plugin
@@ -68,6 +72,103 @@ static bool IsRadio(const cChannel* channel)
   return isRadio;
 }
 
+// locks shared with VDR and the other clients.
+// the time spent waiting is accounted to the running request.
+class cTimedMutexLock
+{
+public:
+
+  cTimedMutexLock(cMutex* mutex) : m_mutex(mutex)
+  {
+    uint64_t start = cMetrics::Now();
+    m_mutex->Lock();
+    cMetrics::AddLockWait(start);
+  }
+
+  ~cTimedMutexLock()
+  {
+    m_mutex->Unlock();
+  }
+
+private:
+
+  cMutex* m_mutex;
+
+};
+
+static void LockChannels()
+{
+  uint64_t start = cMetrics::Now();
+  Channels.Lock(false);
+  cMetrics::AddLockWait(start);
+}
+
+// maximum number of requests in flight per connection
+#define MAX_INFLIGHT 8
+
+// order-dependent requests are processed one after another in the order they have been received.
+// all others just read the global VDR state and may complete out of order.
+static bool IsSerialRequest(uint32_t opcode)
+{
+  switch(opcode)
+  {
+    case XVDR_GETTIME:
+    case XVDR_PING:
+    case XVDR_GETSTATS:
+    case XVDR_TIMER_GETCOUNT:
+    case XVDR_TIMER_GET:
+    case XVDR_TIMER_GETLIST:
+    case XVDR_RECORDINGS_DISKSIZE:
+    case XVDR_RECORDINGS_GETCOUNT:
+    case XVDR_RECORDINGS_GETLIST:
+    case XVDR_RECORDINGS_GETPOSITION:
+    case XVDR_EPG_GETFORCHANNEL:
+    case XVDR_SCAN_SUPPORTED:
+      return false;
+  }
+
+  return true;
+}
+
+// responses compressed on request of the client (large lists)
+static bool IsCompressedResponse(uint32_t opcode)
+{
+  switch(opcode)
+  {
+    case XVDR_CHANNELS_GETCHANNELS:
+    case XVDR_RECORDINGS_GETLIST:
+    case XVDR_EPG_GETFORCHANNEL:
+      return true;
+  }
+
+  return false;
+}
+
+// runs a request of a client on the worker pool
+class cXVDRRequestJob : public cWorkerJob
+{
+public:
+
+  cXVDRRequestJob(cXVDRClient* client, MsgPacket* req, bool serial) : m_client(client), m_req(req), m_serial(serial)
+  {
+  }
+
+  void Run()
+  {
+    if(m_serial)
+      m_client->ProcessSerial(m_req);
+    else
+      m_client->ProcessConcurrent(m_req);
+  }
+
+private:
+
+  cXVDRClient* m_client;
+  MsgPacket* m_req;
+  bool m_serial;
+
+};
+
 static uint32_t recid2uid(const char* recid)
 {
   uint32_t uid = 0;
@@ -76,6 +177,30 @@ static uint32_t recid2uid(const char* recid)
   return uid;
 }
 
+void cXVDRClient::SendResponse(MsgPacket* resp, bool compress)
+{
+  // a client using a compression stream or another codec can't decode zlib packets.
+  // the connection compressor is applied by the send queue, in the order the packets go out.
+  if(compress && m_compressor != NULL)
+  {
+    m_sendqueue->Send(resp, cSendQueue::Compress);
+    return;
+  }
+
+  if(compress)
+  {
+    uint32_t length = resp->getPayloadLength();
+
+    if(resp->compress(m_compressionLevel))
+    {
+      cMetrics::Add(cMetrics::CompressIn, length, &m_metrics);
+      cMetrics::Add(cMetrics::CompressOut, resp->getPayloadLength(), &m_metrics);
+    }
+  }
+
+  m_sendqueue->Send(resp);
+}
+
 cString cXVDRClient::CreateLogoURL(cChannel* channel)
 {
   if((const char*)XVDRServerConfig.PiconsURL == NULL || strlen((const char*)XVDRServerConfig.PiconsURL) == 0)
@@ -118,7 +243,7 @@ cString cXVDRClient::CreateLogoURL(cChannel* channel)
 
 void cXVDRClient::PutTimer(cTimer* timer, MsgPacket* p)
 {
-  Channels.Lock(false);
+  LockChannels();
 
   // check for conflicts
   DEBUGLOG("Checking conflicts for: %s", (const char*)timer->ToText(true));
@@ -214,13 +339,15 @@ void cXVDRClient::PutTimer(cTimer* timer, MsgPacket* p)
   p->put_U32(timer->StopTime());
   p->put_U32(timer->Day());
   p->put_U32(timer->WeekDays());
-  p->put_String(m_toUTF8.Convert(timer->File()));
+  cCharSetConv toUTF8;
+  p->put_String(toUTF8.Convert(timer->File()));
 }
 
 cMutex cXVDRClient::m_timerLock;
 cMutex cXVDRClient::m_switchLock;
+int cXVDRClient::SlowRequestTime = 0;
 
-cXVDRClient::cXVDRClient(int fd, unsigned int id)
+cXVDRClient::cXVDRClient(int fd, unsigned int id, const char* address)
 {
   m_Id                      = id;
   m_loggedIn                = false;
@@ -229,73 +356,122 @@ cXVDRClient::cXVDRClient(int fd, unsigned int id)
   m_StatusInterfaceEnabled  = false;
   m_RecPlayer               = NULL;
   m_req                     = NULL;
-  m_resp                    = NULL;
+  m_inflight                = 0;
+  m_throttled               = false;
+  m_serialRunning           = false;
+  m_reader                  = new MsgReader;
   m_processSCAN_Response    = NULL;
-  m_processSCAN_Socket      = -1;
   m_compressionLevel        = 0;
+  m_compressor              = NULL;
+  m_features                = 0;
   m_LanguageIndex           = -1;
   m_LangStreamType          = stMPEG2AUDIO;
   m_channelCount            = 0;
   m_timeout                 = 3000;
 
   m_socket = fd;
+  m_active = true;
   m_wantfta = true;
   m_filterlanguage = false;
+  m_address = address;
 
-  Start();
+  m_metrics.SetName(*cString::sprintf("%u %s", m_Id, *m_address));
+  cMetrics::Add(cMetrics::Clients, 1, &m_metrics);
+
+  m_sendqueue = new cSendQueue(m_socket, m_timeout);
+  m_sendqueue->SetMetrics(&m_metrics);
+  m_sendqueue->Start();
+
+  cReactor::GetInstance().Add(this, m_socket, cReactor::Readable);
 }
 
 cXVDRClient::~cXVDRClient()
 {
   DEBUGLOG("%s", __FUNCTION__);
-  StopChannelStreaming();
 
   // shutdown connection
   shutdown(m_socket, SHUT_RDWR); 
-  Cancel(10);
 
-  // remove socket lock
-  cSocketLock::erase(m_socket);
+  // wait for a running event handler
+  cReactor::GetInstance().Remove(this);
+
+  // wait for the requests on the worker pool
+  m_jobLock.Lock();
+  while(m_inflight > 0)
+    m_jobDone.Wait(m_jobLock);
+  m_jobLock.Unlock();
+
+  StopChannelStreaming();
+
+  // drop unsent packets (a running scan mustn't send to the queue anymore)
+  {
+    cMutexLock lock(&m_processSCAN_Lock);
+
+    if(m_processSCAN_Queue == m_sendqueue)
+      m_processSCAN_Queue = NULL;
+
+    delete m_sendqueue;
+  }
 
   // close connection
   close(m_socket);
+
+  delete m_compressor;
+  delete m_reader;
+  delete m_req;
+
+  cMetrics::Add(cMetrics::Clients, -1, &m_metrics);
   DEBUGLOG("done");
 }
 
-void cXVDRClient::Action(void)
+void cXVDRClient::OnEvent(int events)
 {
-  bool bClosed(false);
-
-  while (Running())
+  for(;;)
   {
-    m_req = MsgPacket::read(m_socket, bClosed, 2000);
-
-    if(bClosed)
+    // dispatch all requests we have received so far
+    for(;;)
     {
-      delete m_req;
+      if(m_req == NULL)
+        m_req = m_reader->next();
+
+      if(m_req == NULL)
+        break;
+
+      // stop reading, a completed request will resume the connection
+      if(!DispatchRequest(m_req))
+        return;
+
       m_req = NULL;
-      break;
     }
 
-    if(m_req != NULL)
-    {
-      processRequest();
-      delete m_req;
-    }
+    int rc = m_reader->fill(m_socket);
+
+    if(rc > 0 || (rc == -1 && errno == EINTR))
+      continue;
+
+    if(rc == -1 && errno == EAGAIN)
+      break;
+
+    /* connection closed, the server removes the client later on.
+       requests may still be running on the worker pool, so the stream
+       is stopped by the destructor after they have completed */
+    m_active = false;
+    return;
   }
 
-  /* If thread is ended due to closed connection delete a
-     possible running stream here */
-  StopChannelStreaming();
+  cReactor::GetInstance().Arm(this, cReactor::Readable);
 }
 
-bool cXVDRClient::StartChannelStreaming(const cChannel *channel, uint32_t timeout, int32_t priority)
+bool cXVDRClient::StartChannelStreaming(const cChannel *channel, uint32_t timeout, int32_t priority, MsgPacket* resp)
 {
   cMutexLock lock(&m_switchLock);
-  m_Streamer = new cLiveStreamer(timeout);
+  m_Streamer = new cLiveStreamer(channel, timeout);
   m_Streamer->SetLanguage(m_LanguageIndex, m_LangStreamType);
+  m_Streamer->SetMuxBatching(m_features & XVDR_FEATURE_MUXBATCH);
+  m_Streamer->SetDeltaTimestamps(m_features & XVDR_FEATURE_DELTATIMESTAMPS);
+  m_Streamer->SetQueueStatus(m_features & XVDR_FEATURE_QUEUESTATUS);
 
-  return m_Streamer->StreamChannel(channel, priority, m_socket, m_resp);
+  return m_Streamer->StreamChannel(channel, priority, m_socket, m_sendqueue, resp);
 }
 
 void cXVDRClient::StopChannelStreaming()
@@ -317,10 +493,8 @@ void cXVDRClient::TimerChange()
 
   if (m_StatusInterfaceEnabled)
   {
-    cSocketLock locks(m_socket);
     MsgPacket* resp = new MsgPacket(XVDR_STATUS_TIMERCHANGE, XVDR_CHANNEL_STATUS);
-    resp->write(m_socket, m_timeout);
-    delete resp;
+    m_sendqueue->Send(resp);
   }
 }
 
@@ -343,10 +517,8 @@ void cXVDRClient::ChannelChange()
   else
     INFOLOG("Client %i : %i channels, %i available - sending request", m_Id, m_channelCount, count);
 
-  cSocketLock locks(m_socket);
   MsgPacket* resp = new MsgPacket(XVDR_STATUS_CHANNELCHANGE, XVDR_CHANNEL_STATUS);
-  resp->write(m_socket, m_timeout);
-  delete resp;
+  m_sendqueue->Send(resp);
 }
 
 void cXVDRClient::RecordingsChange()
@@ -356,10 +528,8 @@ void cXVDRClient::RecordingsChange()
   if (!m_StatusInterfaceEnabled)
     return;
 
-  cSocketLock locks(m_socket);
   MsgPacket* resp = new MsgPacket(XVDR_STATUS_RECORDINGSCHANGE, XVDR_CHANNEL_STATUS);
-  resp->write(m_socket, m_timeout);
-  delete resp;
+  m_sendqueue->Send(resp);
 }
 
 void cXVDRClient::Recording(const cDevice *Device, const char *Name, const char *FileName, bool On)
@@ -368,7 +538,6 @@ void cXVDRClient::Recording(const cDevice *Device, const char *Name, const char
 
   if (m_StatusInterfaceEnabled)
   {
-    cSocketLock locks(m_socket);
     MsgPacket* resp = new MsgPacket(XVDR_STATUS_RECORDING, XVDR_CHANNEL_STATUS);
 
     resp->put_U32(Device->CardIndex());
@@ -383,8 +552,7 @@ void cXVDRClient::Recording(const cDevice *Device, const char *Name, const char
     else
       resp->put_String("");
 
-    resp->write(m_socket, m_timeout);
-    delete resp;
+    m_sendqueue->Send(resp);
   }
 }
 
@@ -416,14 +584,12 @@ void cXVDRClient::OsdStatusMessage(const char *Message)
     else if (strcasecmp(Message, trVDR("Cutter already running - Add to cutting queue?")) == 0) return;
     else if (strcasecmp(Message, trVDR("No index-file found. Creating may take minutes. Create one?")) == 0) return;
 
-    cSocketLock locks(m_socket);
     MsgPacket* resp = new MsgPacket(XVDR_STATUS_MESSAGE, XVDR_CHANNEL_STATUS);
 
     resp->put_U32(0);
     resp->put_String(Message);
 
-    resp->write(m_socket, m_timeout);
-    delete resp;
+    m_sendqueue->Send(resp);
   }
 }
 
@@ -506,226 +672,372 @@ bool cXVDRClient::IsChannelWanted(cChannel* channel, bool radio)
   return false;
 }
 
-bool cXVDRClient::processRequest()
+bool cXVDRClient::DispatchRequest(MsgPacket* req)
 {
-  cMutexLock lock(&m_msgLock);
+  cMutexLock lock(&m_jobLock);
+
+  // the login changes the settings of the connection,
+  // so it has to wait until all running requests have been completed
+  bool login = (req->getMsgID() == XVDR_LOGIN);
+
+  if(m_inflight >= MAX_INFLIGHT || (login && m_inflight > 0))
+  {
+    m_throttled = true;
+    return false;
+  }
+
+  if(login)
+  {
+    processRequest(req);
+    delete req;
+    return true;
+  }
+
+  m_inflight++;
+
+  // queue up behind a running order-dependent request
+  bool serial = IsSerialRequest(req->getMsgID());
+
+  if(serial)
+  {
+    if(m_serialRunning)
+    {
+      m_serial.push(req);
+      return true;
+    }
+
+    m_serialRunning = true;
+  }
+
+  cWorkerPool::GetInstance().Queue(new cXVDRRequestJob(this, req, serial));
+  return true;
+}
+
+void cXVDRClient::ProcessConcurrent(MsgPacket* req)
+{
+  processRequest(req);
+  delete req;
+
+  cMutexLock lock(&m_jobLock);
+  RequestDone();
+}
+
+void cXVDRClient::ProcessSerial(MsgPacket* req)
+{
+  while(req != NULL)
+  {
+    processRequest(req);
+    delete req;
+    req = NULL;
+
+    cMutexLock lock(&m_jobLock);
+
+    if(m_serial.empty())
+      m_serialRunning = false;
+    else
+    {
+      req = m_serial.front();
+      m_serial.pop();
+    }
+
+    RequestDone();
+  }
+}
+
+void cXVDRClient::RequestDone()
+{
+  // called with m_jobLock held.
+  // the client may be deleted as soon as the lock has been released.
+  m_inflight--;
+
+  if(m_throttled)
+  {
+    m_throttled = false;
+    cReactor::GetInstance().Notify(this);
+  }
 
-  m_resp = new MsgPacket(m_req->getMsgID(), XVDR_CHANNEL_REQUEST_RESPONSE, m_req->getUID());
-  m_resp->setProtocolVersion(XVDR_PROTOCOLVERSION);
+  m_jobDone.Broadcast();
+}
+
+bool cXVDRClient::processRequest(MsgPacket* req)
+{
+  MsgPacket* resp = new MsgPacket(req->getMsgID(), XVDR_CHANNEL_REQUEST_RESPONSE, req->getUID());
+  resp->setProtocolVersion(XVDR_PROTOCOLVERSION);
+
+  cMetrics::Add(cMetrics::Requests, 1, &m_metrics);
+
+  // lock waits of this request are collected by the thread
+  cMetrics::TakeLockWait();
+  uint64_t start = cMetrics::Now();
 
   bool result = false;
-  switch(m_req->getMsgID())
+  switch(req->getMsgID())
   {
     /** OPCODE 1 - 19: XVDR network functions for general purpose */
     case XVDR_LOGIN:
-      result = process_Login();
+      result = process_Login(req, resp);
       break;
 
     case XVDR_GETTIME:
-      result = process_GetTime();
+      result = process_GetTime(req, resp);
       break;
 
     case XVDR_ENABLESTATUSINTERFACE:
-      result = process_EnableStatusInterface();
+      result = process_EnableStatusInterface(req, resp);
       break;
 
     case XVDR_PING:
-      result = process_Ping();
+      result = process_Ping(req, resp);
       break;
 
     case XVDR_UPDATECHANNELS:
-      result = process_UpdateChannels();
+      result = process_UpdateChannels(req, resp);
       break;
 
    case XVDR_CHANNELFILTER:
-      result = process_ChannelFilter();
+      result = process_ChannelFilter(req, resp);
+      break;
+
+    case XVDR_GETSTATS:
+      result = process_GetStats(req, resp);
       break;
 
     /** OPCODE 20 - 39: XVDR network functions for live streaming */
     case XVDR_CHANNELSTREAM_OPEN:
-      result = processChannelStream_Open();
+      result = processChannelStream_Open(req, resp);
       break;
 
     case XVDR_CHANNELSTREAM_CLOSE:
-      result = processChannelStream_Close();
+      result = processChannelStream_Close(req, resp);
       break;
 
     case XVDR_CHANNELSTREAM_REQUEST:
-      result = processChannelStream_Request();
+      result = processChannelStream_Request(req, resp);
       break;
 
     case XVDR_CHANNELSTREAM_PAUSE:
-      result = processChannelStream_Pause();
+      result = processChannelStream_Pause(req, resp);
+      break;
+
+    case XVDR_CHANNELSTREAM_SEEK:
+      result = processChannelStream_Seek(req, resp);
+      break;
+
+    case XVDR_CHANNELSTREAM_SKIP:
+      result = processChannelStream_Skip(req, resp);
+      break;
+
+    case XVDR_CHANNELSTREAM_LIVE:
+      result = processChannelStream_Live(req, resp);
+      break;
+
+    case XVDR_CHANNELSTREAM_WINDOW:
+      result = processChannelStream_Window(req, resp);
       break;
 
 
     /** OPCODE 40 - 59: XVDR network functions for recording streaming */
     case XVDR_RECSTREAM_OPEN:
-      result = processRecStream_Open();
+      result = processRecStream_Open(req, resp);
       break;
 
     case XVDR_RECSTREAM_CLOSE:
-      result = processRecStream_Close();
+      result = processRecStream_Close(req, resp);
       break;
 
     case XVDR_RECSTREAM_GETBLOCK:
-      result = processRecStream_GetBlock();
+      result = processRecStream_GetBlock(req, resp);
       break;
 
     case XVDR_RECSTREAM_UPDATE:
-      result = processRecStream_Update();
+      result = processRecStream_Update(req, resp);
       break;
 
     case XVDR_RECSTREAM_POSTOFRAME:
-      result = processRecStream_PositionFromFrameNumber();
+      result = processRecStream_PositionFromFrameNumber(req, resp);
       break;
 
     case XVDR_RECSTREAM_FRAMETOPOS:
-      result = processRecStream_FrameNumberFromPosition();
+      result = processRecStream_FrameNumberFromPosition(req, resp);
       break;
 
     case XVDR_RECSTREAM_GETIFRAME:
-      result = processRecStream_GetIFrame();
+      result = processRecStream_GetIFrame(req, resp);
       break;
 
 
     /** OPCODE 60 - 79: XVDR network functions for channel access */
     case XVDR_CHANNELS_GETCOUNT:
-      result = processCHANNELS_ChannelsCount();
+      result = processCHANNELS_ChannelsCount(req, resp);
       break;
 
     case XVDR_CHANNELS_GETCHANNELS:
-      result = processCHANNELS_GetChannels();
+      result = processCHANNELS_GetChannels(req, resp);
       break;
 
     case XVDR_CHANNELGROUP_GETCOUNT:
-      result = processCHANNELS_GroupsCount();
+      result = processCHANNELS_GroupsCount(req, resp);
       break;
 
     case XVDR_CHANNELGROUP_LIST:
-      result = processCHANNELS_GroupList();
+      result = processCHANNELS_GroupList(req, resp);
       break;
 
     case XVDR_CHANNELGROUP_MEMBERS:
-      result = processCHANNELS_GetGroupMembers();
+      result = processCHANNELS_GetGroupMembers(req, resp);
       break;
 
     /** OPCODE 80 - 99: XVDR network functions for timer access */
     case XVDR_TIMER_GETCOUNT:
-      result = processTIMER_GetCount();
+      result = processTIMER_GetCount(req, resp);
       break;
 
     case XVDR_TIMER_GET:
-      result = processTIMER_Get();
+      result = processTIMER_Get(req, resp);
       break;
 
     case XVDR_TIMER_GETLIST:
-      result = processTIMER_GetList();
+      result = processTIMER_GetList(req, resp);
       break;
 
     case XVDR_TIMER_ADD:
-      result = processTIMER_Add();
+      result = processTIMER_Add(req, resp);
       break;
 
     case XVDR_TIMER_DELETE:
-      result = processTIMER_Delete();
+      result = processTIMER_Delete(req, resp);
       break;
 
     case XVDR_TIMER_UPDATE:
-      result = processTIMER_Update();
+      result = processTIMER_Update(req, resp);
       break;
 
 
     /** OPCODE 100 - 119: XVDR network functions for recording access */
     case XVDR_RECORDINGS_DISKSIZE:
-      result = processRECORDINGS_GetDiskSpace();
+      result = processRECORDINGS_GetDiskSpace(req, resp);
       break;
 
     case XVDR_RECORDINGS_GETCOUNT:
-      result = processRECORDINGS_GetCount();
+      result = processRECORDINGS_GetCount(req, resp);
       break;
 
     case XVDR_RECORDINGS_GETLIST:
-      result = processRECORDINGS_GetList();
+      result = processRECORDINGS_GetList(req, resp);
       break;
 
     case XVDR_RECORDINGS_RENAME:
-      result = processRECORDINGS_Rename();
+      result = processRECORDINGS_Rename(req, resp);
       break;
 
     case XVDR_RECORDINGS_DELETE:
-      result = processRECORDINGS_Delete();
+      result = processRECORDINGS_Delete(req, resp);
       break;
 
     case XVDR_RECORDINGS_SETPLAYCOUNT:
-      result = processRECORDINGS_SetPlayCount();
+      result = processRECORDINGS_SetPlayCount(req, resp);
       break;
 
     case XVDR_RECORDINGS_SETPOSITION:
-      result = processRECORDINGS_SetPosition();
+      result = processRECORDINGS_SetPosition(req, resp);
       break;
 
     case XVDR_RECORDINGS_GETPOSITION:
-      result = processRECORDINGS_GetPosition();
+      result = processRECORDINGS_GetPosition(req, resp);
       break;
 
 
     /** OPCODE 120 - 139: XVDR network functions for epg access and manipulating */
     case XVDR_EPG_GETFORCHANNEL:
-      result = processEPG_GetForChannel();
+      result = processEPG_GetForChannel(req, resp);
       break;
 
 
     /** OPCODE 140 - 159: XVDR network functions for channel scanning */
     case XVDR_SCAN_SUPPORTED:
-      result = processSCAN_ScanSupported();
+      result = processSCAN_ScanSupported(req, resp);
       break;
 
     case XVDR_SCAN_GETCOUNTRIES:
-      result = processSCAN_GetCountries();
+      result = processSCAN_GetCountries(req, resp);
       break;
 
     case XVDR_SCAN_GETSATELLITES:
-      result = processSCAN_GetSatellites();
+      result = processSCAN_GetSatellites(req, resp);
       break;
 
     case XVDR_SCAN_START:
-      result = processSCAN_Start();
+      result = processSCAN_Start(req, resp);
       break;
 
     case XVDR_SCAN_STOP:
-      result = processSCAN_Stop();
+      result = processSCAN_Stop(req, resp);
       break;
   }
 
+  uint32_t bytes = result ? resp->getPayloadLength() : 0;
+
   if(result)
-  {
-    cSocketLock locks(m_socket);
-    m_resp->write(m_socket, m_timeout);
-  }
+    SendResponse(resp, IsCompressedResponse(req->getMsgID()));
+  else
+    delete resp;
+
+  uint64_t elapsed = cMetrics::Now() - start;
+  uint64_t lockwait = cMetrics::TakeLockWait();
 
-  delete m_resp;
-  m_resp = NULL;
+  cMetrics::AddRequest(req->getMsgID(), elapsed, lockwait, bytes);
+
+  if(SlowRequestTime > 0 && elapsed >= (uint64_t)SlowRequestTime * 1000)
+    INFOLOG("Slow request %u from client %u: %llu ms (%llu ms waiting for locks), %u bytes",
+            req->getMsgID(), m_Id, (unsigned long long)(elapsed / 1000), (unsigned long long)(lockwait / 1000), bytes);
 
   return result;
 }
 
+void cXVDRClient::SetSlowRequestTime(int ms)
+{
+  SlowRequestTime = ms;
+  DEBUGLOG("SLOWREQUESTTIME: %i ms", SlowRequestTime);
+}
+
 
 /** OPCODE 1 - 19: XVDR network functions for general purpose */
 
-bool cXVDRClient::process_Login() /* OPCODE 1 */
+bool cXVDRClient::process_Login(MsgPacket* req, MsgPacket* resp) /* OPCODE 1 */
 {
-  m_protocolVersion      = m_req->getProtocolVersion();
-  m_compressionLevel     = m_req->get_U8();
-  const char *clientName = m_req->get_String();
+  m_protocolVersion      = req->getProtocolVersion();
+  m_compressionLevel     = req->get_U8();
+  const char *clientName = req->get_String();
   const char *language   = NULL;
 
   // get preferred language
-  if(!m_req->eop())
+  if(!req->eop())
   {
-    language = m_req->get_String();
+    language = req->get_String();
     m_LanguageIndex = I18nLanguageIndex(language);
-    m_LangStreamType = (eStreamType)m_req->get_U8();
+    m_LangStreamType = (eStreamType)req->get_U8();
+  }
+
+  // get requested protocol features
+  bool featureRequest = false;
+  uint32_t features = 0;
+
+  if(!req->eop())
+  {
+    featureRequest = true;
+    features = req->get_U32();
+  }
+
+  // get requested compression codec and the id of the client's zstd dictionary
+  bool codecRequest = false;
+  int codec = XVDR_CODEC_ZLIB;
+  uint32_t dictionaryId = 0;
+
+  if(!req->eop())
+  {
+    codecRequest = true;
+    codec = req->get_U8();
+    dictionaryId = req->get_U32();
   }
 
   if (m_protocolVersion > XVDR_PROTOCOLVERSION || m_protocolVersion < 4)
@@ -735,100 +1047,212 @@ bool cXVDRClient::process_Login() /* OPCODE 1 */
   }
 
   INFOLOG("Welcome client '%s' with protocol version '%u'", clientName, m_protocolVersion);
+  m_metrics.SetName(*cString::sprintf("%u %s %s", m_Id, *m_address, clientName));
 
   if(!m_LanguageIndex != -1) {
     INFOLOG("Preferred language: %s / type: %i", I18nLanguageCode(m_LanguageIndex), (int)m_LangStreamType);
   }
 
+  // unknown or missing codecs fall back to zlib
+  if(m_compressionLevel <= 0 || !MsgCompressor::supported(codec))
+    codec = XVDR_CODEC_ZLIB;
+
+  // the dictionary is only used if the client has the same one
+  bool useDictionary = (codec == XVDR_CODEC_ZSTD && dictionaryId != 0 && dictionaryId == MsgCompressor::dictionaryId());
+  bool streaming = (features & XVDR_FEATURE_STREAMCOMPRESSION);
+
+  // plain zlib packets are still compressed with MsgPacket::compress(level)
+  if(m_compressionLevel > 0 && (streaming || codec != XVDR_CODEC_ZLIB) && m_compressor == NULL)
+  {
+    m_compressor = new MsgCompressor(codec, m_compressionLevel, streaming, useDictionary);
+
+    if(m_compressor->valid())
+    {
+      m_sendqueue->SetCompressor(m_compressor);
+
+      if(streaming)
+        m_features |= XVDR_FEATURE_STREAMCOMPRESSION;
+
+      INFOLOG("Using %s compression (level %i%s%s)", MsgCompressor::name(codec), m_compressionLevel, streaming ? ", streaming" : "", useDictionary ? ", dictionary" : "");
+    }
+    else
+    {
+      delete m_compressor;
+      m_compressor = NULL;
+      codec = XVDR_CODEC_ZLIB;
+      useDictionary = false;
+    }
+  }
+
+  // stream packets with the compact header
+  if(features & XVDR_FEATURE_COMPACTSTREAM)
+  {
+    m_features |= XVDR_FEATURE_COMPACTSTREAM;
+    m_sendqueue->SetCompactType(XVDR_CHANNEL_STREAM);
+  }
+
+  // batched audio, subtitle and teletext frames
+  if(features & XVDR_FEATURE_MUXBATCH)
+    m_features |= XVDR_FEATURE_MUXBATCH;
+
+  // delta coded timestamps in mux packets
+  if(features & XVDR_FEATURE_DELTATIMESTAMPS)
+    m_features |= XVDR_FEATURE_DELTATIMESTAMPS;
+
+  // periodic live queue status
+  if(features & XVDR_FEATURE_QUEUESTATUS)
+    m_features |= XVDR_FEATURE_QUEUESTATUS;
+
   // Send the login reply
   time_t timeNow        = time(NULL);
   struct tm* timeStruct = localtime(&timeNow);
   int timeOffset        = timeStruct->tm_gmtoff;
 
-  m_resp->put_U32(timeNow);
-  m_resp->put_S32(timeOffset);
-  m_resp->put_String("VDR-XVDR Server");
-  m_resp->put_String(XVDR_VERSION);
+  resp->put_U32(timeNow);
+  resp->put_S32(timeOffset);
+  resp->put_String("VDR-XVDR Server");
+  resp->put_String(XVDR_VERSION);
+
+  // granted protocol features
+  if(featureRequest)
+    resp->put_U32(m_features);
+
+  // granted compression codec and dictionary
+  if(codecRequest)
+  {
+    resp->put_U8(codec);
+    resp->put_U32(useDictionary ? dictionaryId : 0);
+  }
 
   SetLoggedIn(true);
   return true;
 }
 
-bool cXVDRClient::process_GetTime() /* OPCODE 2 */
+bool cXVDRClient::process_GetTime(MsgPacket* req, MsgPacket* resp) /* OPCODE 2 */
 {
   time_t timeNow        = time(NULL);
   struct tm* timeStruct = localtime(&timeNow);
   int timeOffset        = timeStruct->tm_gmtoff;
 
-  m_resp->put_U32(timeNow);
-  m_resp->put_S32(timeOffset);
+  resp->put_U32(timeNow);
+  resp->put_S32(timeOffset);
 
   return true;
 }
 
-bool cXVDRClient::process_EnableStatusInterface()
+bool cXVDRClient::process_EnableStatusInterface(MsgPacket* req, MsgPacket* resp)
 {
-  bool enabled = m_req->get_U8();
+  bool enabled = req->get_U8();
 
   SetStatusInterface(enabled);
 
-  m_resp->put_U32(XVDR_RET_OK);
+  resp->put_U32(XVDR_RET_OK);
 
   return true;
 }
 
-bool cXVDRClient::process_Ping() /* OPCODE 7 */
+bool cXVDRClient::process_Ping(MsgPacket* req, MsgPacket* resp) /* OPCODE 7 */
 {
-  m_resp->put_U32(1);
+  resp->put_U32(1);
 
   return true;
 }
 
-bool cXVDRClient::process_UpdateChannels()
+bool cXVDRClient::process_UpdateChannels(MsgPacket* req, MsgPacket* resp)
 {
-  uint8_t updatechannels = m_req->get_U8();
+  uint8_t updatechannels = req->get_U8();
 
   if(updatechannels <= 5)
   {
     Setup.UpdateChannels = updatechannels;
     INFOLOG("Setting channel update method: %i", updatechannels);
-    m_resp->put_U32(XVDR_RET_OK);
+    resp->put_U32(XVDR_RET_OK);
   }
   else
-    m_resp->put_U32(XVDR_RET_DATAINVALID);
+    resp->put_U32(XVDR_RET_DATAINVALID);
 
   return true;
 }
 
-bool cXVDRClient::process_ChannelFilter()
+bool cXVDRClient::process_ChannelFilter(MsgPacket* req, MsgPacket* resp)
 {
   INFOLOG("Channellist filter:");
 
   // do we want fta channels ?
-  m_wantfta = m_req->get_U32();
+  m_wantfta = req->get_U32();
   INFOLOG("Free To Air channels: %s", m_wantfta ? "Yes" : "No");
 
   // display only channels with native language audio ?
-  m_filterlanguage = m_req->get_U32();
+  m_filterlanguage = req->get_U32();
   INFOLOG("Only native language: %s", m_filterlanguage ? "Yes" : "No");
 
   // read caids
   m_caids.clear();
-  uint32_t count = m_req->get_U32();
+  uint32_t count = req->get_U32();
 
   INFOLOG("Enabled CaIDs: ");
 
   // sanity check (maximum of 20 caids)
   if(count < 20) {
     for(uint32_t i = 0; i < count; i++) {
-      int caid = m_req->get_U32();
+      int caid = req->get_U32();
       m_caids.push_back(caid);
       INFOLOG("%04X", caid);
     }
   }
 
 
-  m_resp->put_U32(XVDR_RET_OK);
+  resp->put_U32(XVDR_RET_OK);
+
+  return true;
+}
+
+bool cXVDRClient::process_GetStats(MsgPacket* req, MsgPacket* resp) /* OPCODE 10 */
+{
+  cMetrics::Values global;
+  cMetrics::Values client;
+
+  cMetrics::Get(global);
+  m_metrics.Get(client);
+
+  // name, gauge flag, value of all clients, value of this client
+  resp->put_U32(cMetrics::Count);
+
+  for(int i = 0; i < cMetrics::Count; i++)
+  {
+    resp->put_String(cMetrics::Name(i));
+    resp->put_U8(cMetrics::IsGauge(i));
+    resp->put_S64(global.value[i]);
+    resp->put_S64(client.value[i]);
+  }
+
+  // latency (us) and response sizes of the requests processed so far
+  std::vector<int> opcodes;
+
+  for(int i = 0; i < cMetrics::MaxOpcodes; i++)
+  {
+    if(cMetrics::GetRequestStats(i)->time.Count() > 0)
+      opcodes.push_back(i);
+  }
+
+  resp->put_U32(opcodes.size());
+
+  for(std::vector<int>::iterator i = opcodes.begin(); i != opcodes.end(); i++)
+  {
+    cRequestStats* stats = cMetrics::GetRequestStats(*i);
+
+    resp->put_U16(*i);
+    resp->put_U64(stats->time.Count());
+    resp->put_U64(stats->time.Percentile(50));
+    resp->put_U64(stats->time.Percentile(90));
+    resp->put_U64(stats->time.Percentile(99));
+    resp->put_U64(stats->time.Max());
+    resp->put_U64(stats->lockwait.Percentile(50));
+    resp->put_U64(stats->lockwait.Percentile(99));
+    resp->put_U64(stats->lockwait.Max());
+    resp->put_U64(stats->bytes);
+    resp->put_U32(stats->maxbytes);
+  }
 
   return true;
 }
@@ -837,22 +1261,22 @@ bool cXVDRClient::process_ChannelFilter()
 
 /** OPCODE 20 - 39: XVDR network functions for live streaming */
 
-bool cXVDRClient::processChannelStream_Open() /* OPCODE 20 */
+bool cXVDRClient::processChannelStream_Open(MsgPacket* req, MsgPacket* resp) /* OPCODE 20 */
 {
-  cMutexLock lock(&m_timerLock);
+  cTimedMutexLock lock(&m_timerLock);
 
-  uint32_t uid = m_req->get_U32();
+  uint32_t uid = req->get_U32();
   int32_t priority = 50;
 
-  if(!m_req->eop()) {
-    priority = m_req->get_S32();
+  if(!req->eop()) {
+    priority = req->get_S32();
   }
 
   uint32_t timeout = XVDRServerConfig.stream_timeout;
 
   StopChannelStreaming();
 
-  Channels.Lock(false);
+  LockChannels();
   const cChannel *channel = NULL;
 
   // try to find channel by uid first
@@ -866,11 +1290,11 @@ bool cXVDRClient::processChannelStream_Open() /* OPCODE 20 */
 
   if (channel == NULL) {
     ERRORLOG("Can't find channel %08x", uid);
-    m_resp->put_U32(XVDR_RET_DATAINVALID);
+    resp->put_U32(XVDR_RET_DATAINVALID);
   }
   else
   {
-    if (StartChannelStreaming(channel, timeout, priority))
+    if (StartChannelStreaming(channel, timeout, priority, resp))
     {
       INFOLOG("Started streaming of channel %s (timeout %i seconds, priority %i)", channel->Name(), timeout, priority);
       // return here without sending the response
@@ -884,13 +1308,13 @@ bool cXVDRClient::processChannelStream_Open() /* OPCODE 20 */
   return true;
 }
 
-bool cXVDRClient::processChannelStream_Close() /* OPCODE 21 */
+bool cXVDRClient::processChannelStream_Close(MsgPacket* req, MsgPacket* resp) /* OPCODE 21 */
 {
   StopChannelStreaming();
   return true;
 }
 
-bool cXVDRClient::processChannelStream_Request() /* OPCODE 22 */
+bool cXVDRClient::processChannelStream_Request(MsgPacket* req, MsgPacket* resp) /* OPCODE 22 */
 {
   if(m_Streamer != NULL)
     m_Streamer->RequestPacket();
@@ -899,23 +1323,79 @@ bool cXVDRClient::processChannelStream_Request() /* OPCODE 22 */
   return false;
 }
 
-bool cXVDRClient::processChannelStream_Pause() /* OPCODE 23 */
+bool cXVDRClient::processChannelStream_Pause(MsgPacket* req, MsgPacket* resp) /* OPCODE 23 */
 {
-  bool on = m_req->get_U32();
+  bool on = req->get_U32();
   INFOLOG("LIVESTREAM: %s", on ? "PAUSED" : "TIMESHIFT");
 
-  m_Streamer->Pause(on);
+  if(m_Streamer != NULL)
+    m_Streamer->Pause(on);
+
+  return true;
+}
+
+static void putSeekResult(MsgPacket* resp, int64_t pts)
+{
+  // no timeshift or no keyframe stored
+  if(pts == DVD_NOPTS_VALUE)
+  {
+    resp->put_U32(XVDR_RET_DATAUNKNOWN);
+    return;
+  }
+
+  resp->put_U32(XVDR_RET_OK);
+  resp->put_S64(pts);
+}
+
+bool cXVDRClient::processChannelStream_Seek(MsgPacket* req, MsgPacket* resp) /* OPCODE 24 */
+{
+  int64_t pts = req->get_S64();
+
+  putSeekResult(resp, (m_Streamer != NULL) ? m_Streamer->Seek(pts) : DVD_NOPTS_VALUE);
+  return true;
+}
+
+bool cXVDRClient::processChannelStream_Skip(MsgPacket* req, MsgPacket* resp) /* OPCODE 25 */
+{
+  int32_t ms = req->get_S32();
+
+  putSeekResult(resp, (m_Streamer != NULL) ? m_Streamer->SeekRelative(ms) : DVD_NOPTS_VALUE);
+  return true;
+}
+
+bool cXVDRClient::processChannelStream_Live(MsgPacket* req, MsgPacket* resp) /* OPCODE 26 */
+{
+  putSeekResult(resp, (m_Streamer != NULL) ? m_Streamer->SeekLive() : DVD_NOPTS_VALUE);
+  return true;
+}
+
+bool cXVDRClient::processChannelStream_Window(MsgPacket* req, MsgPacket* resp) /* OPCODE 27 */
+{
+  int64_t first = DVD_NOPTS_VALUE;
+  int64_t position = DVD_NOPTS_VALUE;
+  int64_t live = DVD_NOPTS_VALUE;
+
+  if(m_Streamer == NULL || !m_Streamer->GetTimeShiftWindow(first, position, live))
+  {
+    resp->put_U32(XVDR_RET_DATAUNKNOWN);
+    return true;
+  }
+
+  resp->put_U32(XVDR_RET_OK);
+  resp->put_S64(first);
+  resp->put_S64(position);
+  resp->put_S64(live);
 
   return true;
 }
 
 /** OPCODE 40 - 59: XVDR network functions for recording streaming */
 
-bool cXVDRClient::processRecStream_Open() /* OPCODE 40 */
+bool cXVDRClient::processRecStream_Open(MsgPacket* req, MsgPacket* resp) /* OPCODE 40 */
 {
   cRecording *recording = NULL;
 
-  const char* recid = m_req->get_String();
+  const char* recid = req->get_String();
   unsigned int uid = recid2uid(recid);
   DEBUGLOG("lookup recid: %s (uid: %u)", recid, uid);
   recording = cRecordingsCache::GetInstance().Lookup(uid);
@@ -924,26 +1404,26 @@ bool cXVDRClient::processRecStream_Open() /* OPCODE 40 */
   {
     m_RecPlayer = new cRecPlayer(recording);
 
-    m_resp->put_U32(XVDR_RET_OK);
-    m_resp->put_U32(m_RecPlayer->getLengthFrames());
-    m_resp->put_U64(m_RecPlayer->getLengthBytes());
+    resp->put_U32(XVDR_RET_OK);
+    resp->put_U32(m_RecPlayer->getLengthFrames());
+    resp->put_U64(m_RecPlayer->getLengthBytes());
 
 #if VDRVERSNUM < 10703
-    m_resp->put_U8(true);//added for TS
+    resp->put_U8(true);//added for TS
 #else
-    m_resp->put_U8(recording->IsPesRecording());//added for TS
+    resp->put_U8(recording->IsPesRecording());//added for TS
 #endif
   }
   else
   {
-    m_resp->put_U32(XVDR_RET_DATAUNKNOWN);
+    resp->put_U32(XVDR_RET_DATAUNKNOWN);
     ERRORLOG("%s - unable to start recording !", __FUNCTION__);
   }
 
   return true;
 }
 
-bool cXVDRClient::processRecStream_Close() /* OPCODE 41 */
+bool cXVDRClient::processRecStream_Close(MsgPacket* req, MsgPacket* resp) /* OPCODE 41 */
 {
   if (m_RecPlayer)
   {
@@ -951,24 +1431,24 @@ bool cXVDRClient::processRecStream_Close() /* OPCODE 41 */
     m_RecPlayer = NULL;
   }
 
-  m_resp->put_U32(XVDR_RET_OK);
+  resp->put_U32(XVDR_RET_OK);
 
   return true;
 }
 
-bool cXVDRClient::processRecStream_Update() /* OPCODE 46 */
+bool cXVDRClient::processRecStream_Update(MsgPacket* req, MsgPacket* resp) /* OPCODE 46 */
 {
   if(m_RecPlayer == NULL)
     return false;
 
   m_RecPlayer->update();
-  m_resp->put_U32(m_RecPlayer->getLengthFrames());
-  m_resp->put_U64(m_RecPlayer->getLengthBytes());
+  resp->put_U32(m_RecPlayer->getLengthFrames());
+  resp->put_U64(m_RecPlayer->getLengthBytes());
 
   return true;
 }
 
-bool cXVDRClient::processRecStream_GetBlock() /* OPCODE 42 */
+bool cXVDRClient::processRecStream_GetBlock(MsgPacket* req, MsgPacket* resp) /* OPCODE 42 */
 {
   if (m_isStreaming)
   {
@@ -982,50 +1462,50 @@ bool cXVDRClient::processRecStream_GetBlock() /* OPCODE 42 */
     return false;
   }
 
-  uint64_t position  = m_req->get_U64();
-  uint32_t amount    = m_req->get_U32();
+  uint64_t position  = req->get_U64();
+  uint32_t amount    = req->get_U32();
 
-  uint8_t* p = m_resp->reserve(amount);
+  uint8_t* p = resp->reserve(amount);
   uint32_t amountReceived = m_RecPlayer->getBlock(p, position, amount);
 
   // smaller chunk ?
   if(amountReceived < amount)
-    m_resp->unreserve(amount - amountReceived);
+    resp->unreserve(amount - amountReceived);
 
   return true;
 }
 
-bool cXVDRClient::processRecStream_PositionFromFrameNumber() /* OPCODE 43 */
+bool cXVDRClient::processRecStream_PositionFromFrameNumber(MsgPacket* req, MsgPacket* resp) /* OPCODE 43 */
 {
   uint64_t retval       = 0;
-  uint32_t frameNumber  = m_req->get_U32();
+  uint32_t frameNumber  = req->get_U32();
 
   if (m_RecPlayer)
     retval = m_RecPlayer->positionFromFrameNumber(frameNumber);
 
-  m_resp->put_U64(retval);
+  resp->put_U64(retval);
 
   return true;
 }
 
-bool cXVDRClient::processRecStream_FrameNumberFromPosition() /* OPCODE 44 */
+bool cXVDRClient::processRecStream_FrameNumberFromPosition(MsgPacket* req, MsgPacket* resp) /* OPCODE 44 */
 {
   uint32_t retval   = 0;
-  uint64_t position = m_req->get_U64();
+  uint64_t position = req->get_U64();
 
   if (m_RecPlayer)
     retval = m_RecPlayer->frameNumberFromPosition(position);
 
-  m_resp->put_U32(retval);
+  resp->put_U32(retval);
 
   return true;
 }
 
-bool cXVDRClient::processRecStream_GetIFrame() /* OPCODE 45 */
+bool cXVDRClient::processRecStream_GetIFrame(MsgPacket* req, MsgPacket* resp) /* OPCODE 45 */
 {
   bool success            = false;
-  uint32_t frameNumber    = m_req->get_U32();
-  uint32_t direction      = m_req->get_U32();
+  uint32_t frameNumber    = req->get_U32();
+  uint32_t direction      = req->get_U32();
   uint64_t rfilePosition  = 0;
   uint32_t rframeNumber   = 0;
   uint32_t rframeLength   = 0;
@@ -1036,13 +1516,13 @@ bool cXVDRClient::processRecStream_GetIFrame() /* OPCODE 45 */
   // returns file position, frame number, length
   if (success)
   {
-    m_resp->put_U64(rfilePosition);
-    m_resp->put_U32(rframeNumber);
-    m_resp->put_U32(rframeLength);
+    resp->put_U64(rfilePosition);
+    resp->put_U32(rframeNumber);
+    resp->put_U32(rframeLength);
   }
   else
   {
-    m_resp->put_U32(0);
+    resp->put_U32(0);
   }
 
   return true;
@@ -1050,7 +1530,7 @@ bool cXVDRClient::processRecStream_GetIFrame() /* OPCODE 45 */
 
 int cXVDRClient::ChannelsCount()
 {
-  Channels.Lock(false);
+  LockChannels();
   int count = 0;
 
   for (cChannel *channel = Channels.First(); channel; channel = Channels.Next(channel))
@@ -1065,47 +1545,46 @@ int cXVDRClient::ChannelsCount()
 
 /** OPCODE 60 - 79: XVDR network functions for channel access */
 
-bool cXVDRClient::processCHANNELS_ChannelsCount() /* OPCODE 61 */
+bool cXVDRClient::processCHANNELS_ChannelsCount(MsgPacket* req, MsgPacket* resp) /* OPCODE 61 */
 {
   m_channelCount = ChannelsCount();
-  m_resp->put_U32(m_channelCount);
+  resp->put_U32(m_channelCount);
 
   return true;
 }
 
-bool cXVDRClient::processCHANNELS_GetChannels() /* OPCODE 63 */
+bool cXVDRClient::processCHANNELS_GetChannels(MsgPacket* req, MsgPacket* resp) /* OPCODE 63 */
 {
-  bool radio = m_req->get_U32();
+  bool radio = req->get_U32();
+  cCharSetConv toUTF8;
 
   m_channelCount = ChannelsCount();
-  Channels.Lock(false);
+  LockChannels();
 
   for (cChannel *channel = Channels.First(); channel; channel = Channels.Next(channel))
   {
     if(!IsChannelWanted(channel, radio))
       continue;
 
-    m_resp->put_U32(channel->Number());
-    m_resp->put_String(m_toUTF8.Convert(channel->Name()));
-    m_resp->put_U32(CreateChannelUID(channel));
-    m_resp->put_U32(channel->Ca());
+    resp->put_U32(channel->Number());
+    resp->put_String(toUTF8.Convert(channel->Name()));
+    resp->put_U32(CreateChannelUID(channel));
+    resp->put_U32(channel->Ca());
 
     // logo url - for future use
-    m_resp->put_String((const char*)CreateLogoURL(channel));
+    resp->put_String((const char*)CreateLogoURL(channel));
   }
 
   Channels.Unlock();
 
-  m_resp->compress(m_compressionLevel);
-
   return true;
 }
 
-bool cXVDRClient::processCHANNELS_GroupsCount()
+bool cXVDRClient::processCHANNELS_GroupsCount(MsgPacket* req, MsgPacket* resp)
 {
-  uint32_t type = m_req->get_U32();
+  uint32_t type = req->get_U32();
 
-  Channels.Lock(false);
+  LockChannels();
 
   m_channelgroups[0].clear();
   m_channelgroups[1].clear();
@@ -1127,29 +1606,29 @@ bool cXVDRClient::processCHANNELS_GroupsCount()
 
   uint32_t count = m_channelgroups[0].size() + m_channelgroups[1].size();
 
-  m_resp->put_U32(count);
+  resp->put_U32(count);
 
   return true;
 }
 
-bool cXVDRClient::processCHANNELS_GroupList()
+bool cXVDRClient::processCHANNELS_GroupList(MsgPacket* req, MsgPacket* resp)
 {
-  uint32_t radio = m_req->get_U8();
+  uint32_t radio = req->get_U8();
   std::map<std::string, ChannelGroup>::iterator i;
 
   for(i = m_channelgroups[radio].begin(); i != m_channelgroups[radio].end(); i++)
   {
-    m_resp->put_String(i->second.name.c_str());
-    m_resp->put_U8(i->second.radio);
+    resp->put_String(i->second.name.c_str());
+    resp->put_U8(i->second.radio);
   }
 
   return true;
 }
 
-bool cXVDRClient::processCHANNELS_GetGroupMembers()
+bool cXVDRClient::processCHANNELS_GetGroupMembers(MsgPacket* req, MsgPacket* resp)
 {
-  const char* groupname = m_req->get_String();
-  uint32_t radio = m_req->get_U8();
+  const char* groupname = req->get_String();
+  uint32_t radio = req->get_U8();
   int index = 0;
 
   // unknown group
@@ -1163,7 +1642,7 @@ bool cXVDRClient::processCHANNELS_GetGroupMembers()
 
   m_channelCount = ChannelsCount();
 
-  Channels.Lock(false);
+  LockChannels();
 
   for (cChannel *channel = Channels.First(); channel; channel = Channels.Next(channel))
   {
@@ -1187,8 +1666,8 @@ bool cXVDRClient::processCHANNELS_GetGroupMembers()
 
     if(name == groupname)
     {
-      m_resp->put_U32(CreateChannelUID(channel));
-      m_resp->put_U32(++index);
+      resp->put_U32(CreateChannelUID(channel));
+      resp->put_U32(++index);
     }
   }
 
@@ -1229,50 +1708,50 @@ void cXVDRClient::CreateChannelGroups(bool automatic)
 
 /** OPCODE 80 - 99: XVDR network functions for timer access */
 
-bool cXVDRClient::processTIMER_GetCount() /* OPCODE 80 */
+bool cXVDRClient::processTIMER_GetCount(MsgPacket* req, MsgPacket* resp) /* OPCODE 80 */
 {
-  cMutexLock lock(&m_timerLock);
+  cTimedMutexLock lock(&m_timerLock);
 
   int count = Timers.Count();
 
-  m_resp->put_U32(count);
+  resp->put_U32(count);
 
   return true;
 }
 
-bool cXVDRClient::processTIMER_Get() /* OPCODE 81 */
+bool cXVDRClient::processTIMER_Get(MsgPacket* req, MsgPacket* resp) /* OPCODE 81 */
 {
-  cMutexLock lock(&m_timerLock);
+  cTimedMutexLock lock(&m_timerLock);
 
-  uint32_t number = m_req->get_U32();
+  uint32_t number = req->get_U32();
 
   if (Timers.Count() == 0)
   {
-    m_resp->put_U32(XVDR_RET_DATAUNKNOWN);
+    resp->put_U32(XVDR_RET_DATAUNKNOWN);
     return true;
   }
 
   cTimer *timer = Timers.Get(number-1);
   if (timer == NULL)
   {
-    m_resp->put_U32(XVDR_RET_DATAUNKNOWN);
+    resp->put_U32(XVDR_RET_DATAUNKNOWN);
     return true;
   }
 
-  m_resp->put_U32(XVDR_RET_OK);
-  PutTimer(timer, m_resp);
+  resp->put_U32(XVDR_RET_OK);
+  PutTimer(timer, resp);
 
   return true;
 }
 
-bool cXVDRClient::processTIMER_GetList() /* OPCODE 82 */
+bool cXVDRClient::processTIMER_GetList(MsgPacket* req, MsgPacket* resp) /* OPCODE 82 */
 {
-  cMutexLock lock(&m_timerLock);
+  cTimedMutexLock lock(&m_timerLock);
 
   cTimer *timer;
   int numTimers = Timers.Count();
 
-  m_resp->put_U32(numTimers);
+  resp->put_U32(numTimers);
 
   for (int i = 0; i < numTimers; i++)
   {
@@ -1280,27 +1759,27 @@ bool cXVDRClient::processTIMER_GetList() /* OPCODE 82 */
     if (!timer)
       continue;
 
-    PutTimer(timer, m_resp);
+    PutTimer(timer, resp);
   }
 
   return true;
 }
 
-bool cXVDRClient::processTIMER_Add() /* OPCODE 83 */
+bool cXVDRClient::processTIMER_Add(MsgPacket* req, MsgPacket* resp) /* OPCODE 83 */
 {
-  cMutexLock lock(&m_timerLock);
+  cTimedMutexLock lock(&m_timerLock);
 
-  m_req->get_U32(); // index unused
-  uint32_t flags      = m_req->get_U32() > 0 ? tfActive : tfNone;
-  uint32_t priority   = m_req->get_U32();
-  uint32_t lifetime   = m_req->get_U32();
-  uint32_t channelid  = m_req->get_U32();
-  time_t startTime    = m_req->get_U32();
-  time_t stopTime     = m_req->get_U32();
-  time_t day          = m_req->get_U32();
-  uint32_t weekdays   = m_req->get_U32();
-  const char *file    = m_req->get_String();
-  const char *aux     = m_req->get_String();
+  req->get_U32(); // index unused
+  uint32_t flags      = req->get_U32() > 0 ? tfActive : tfNone;
+  uint32_t priority   = req->get_U32();
+  uint32_t lifetime   = req->get_U32();
+  uint32_t channelid  = req->get_U32();
+  time_t startTime    = req->get_U32();
+  time_t stopTime     = req->get_U32();
+  time_t day          = req->get_U32();
+  uint32_t weekdays   = req->get_U32();
+  const char *file    = req->get_String();
+  const char *aux     = req->get_String();
 
   // handle instant timers
   if(startTime == -1 || startTime == 0)
@@ -1331,19 +1810,19 @@ bool cXVDRClient::processTIMER_Add() /* OPCODE 83 */
       Timers.Add(timer);
       Timers.SetModified();
       INFOLOG("Timer %s added", *timer->ToDescr());
-      m_resp->put_U32(XVDR_RET_OK);
+      resp->put_U32(XVDR_RET_OK);
       return true;
     }
     else
     {
       ERRORLOG("Timer already defined: %d %s", t->Index() + 1, *t->ToText());
-      m_resp->put_U32(XVDR_RET_DATALOCKED);
+      resp->put_U32(XVDR_RET_DATALOCKED);
     }
   }
   else
   {
     ERRORLOG("Error in timer settings");
-    m_resp->put_U32(XVDR_RET_DATAINVALID);
+    resp->put_U32(XVDR_RET_DATAINVALID);
   }
 
   delete timer;
@@ -1351,17 +1830,17 @@ bool cXVDRClient::processTIMER_Add() /* OPCODE 83 */
   return true;
 }
 
-bool cXVDRClient::processTIMER_Delete() /* OPCODE 84 */
+bool cXVDRClient::processTIMER_Delete(MsgPacket* req, MsgPacket* resp) /* OPCODE 84 */
 {
-  cMutexLock lock(&m_timerLock);
+  cTimedMutexLock lock(&m_timerLock);
 
-  uint32_t number = m_req->get_U32();
-  bool     force  = m_req->get_U32();
+  uint32_t number = req->get_U32();
+  bool     force  = req->get_U32();
 
   if (number <= 0 || number > (uint32_t)Timers.Count())
   {
     ERRORLOG("Unable to delete timer - invalid timer identifier");
-    m_resp->put_U32(XVDR_RET_DATAINVALID);
+    resp->put_U32(XVDR_RET_DATAINVALID);
     return true;
   }
 
@@ -1369,21 +1848,21 @@ bool cXVDRClient::processTIMER_Delete() /* OPCODE 84 */
   if (timer == NULL)
   {
     ERRORLOG("Unable to delete timer - invalid timer identifier");
-    m_resp->put_U32(XVDR_RET_DATAINVALID);
+    resp->put_U32(XVDR_RET_DATAINVALID);
     return true;
   }
 
   if (Timers.BeingEdited())
   {
     ERRORLOG("Unable to delete timer - timers being edited at VDR");
-    m_resp->put_U32(XVDR_RET_DATALOCKED);
+    resp->put_U32(XVDR_RET_DATALOCKED);
     return true;
   }
 
   if (timer->Recording() && !force)
   {
     ERRORLOG("Timer \"%i\" is recording and can be deleted (use force=1 to stop it)", number);
-    m_resp->put_U32(XVDR_RET_RECRUNNING);
+    resp->put_U32(XVDR_RET_RECRUNNING);
     return true;
   }
 
@@ -1393,38 +1872,38 @@ bool cXVDRClient::processTIMER_Delete() /* OPCODE 84 */
   INFOLOG("Deleting timer %s", *timer->ToDescr());
   Timers.Del(timer);
   Timers.SetModified();
-  m_resp->put_U32(XVDR_RET_OK);
+  resp->put_U32(XVDR_RET_OK);
 
   return true;
 }
 
-bool cXVDRClient::processTIMER_Update() /* OPCODE 85 */
+bool cXVDRClient::processTIMER_Update(MsgPacket* req, MsgPacket* resp) /* OPCODE 85 */
 {
-  cMutexLock lock(&m_timerLock);
+  cTimedMutexLock lock(&m_timerLock);
 
-  uint32_t index  = m_req->get_U32();
-  bool active     = m_req->get_U32();
+  uint32_t index  = req->get_U32();
+  bool active     = req->get_U32();
 
   cTimer *timer = Timers.Get(index - 1);
   if (!timer)
   {
     ERRORLOG("Timer \"%u\" not defined", index);
-    m_resp->put_U32(XVDR_RET_DATAUNKNOWN);
+    resp->put_U32(XVDR_RET_DATAUNKNOWN);
     return true;
   }
 
   cTimer t = *timer;
 
   uint32_t flags      = active ? tfActive : tfNone;
-  uint32_t priority   = m_req->get_U32();
-  uint32_t lifetime   = m_req->get_U32();
-  uint32_t channelid  = m_req->get_U32();
-  time_t startTime    = m_req->get_U32();
-  time_t stopTime     = m_req->get_U32();
-  time_t day          = m_req->get_U32();
-  uint32_t weekdays   = m_req->get_U32();
-  const char *file    = m_req->get_String();
-  const char *aux     = m_req->get_String();
+  uint32_t priority   = req->get_U32();
+  uint32_t lifetime   = req->get_U32();
+  uint32_t channelid  = req->get_U32();
+  time_t startTime    = req->get_U32();
+  time_t stopTime     = req->get_U32();
+  time_t day          = req->get_U32();
+  uint32_t weekdays   = req->get_U32();
+  const char *file    = req->get_String();
+  const char *aux     = req->get_String();
 
   struct tm tm_r;
   struct tm *time = localtime_r(&startTime, &tm_r);
@@ -1445,14 +1924,14 @@ bool cXVDRClient::processTIMER_Update() /* OPCODE 85 */
   if (!t.Parse(buffer))
   {
     ERRORLOG("Error in timer settings");
-    m_resp->put_U32(XVDR_RET_DATAINVALID);
+    resp->put_U32(XVDR_RET_DATAINVALID);
     return true;
   }
 
   *timer = t;
   Timers.SetModified();
 
-  m_resp->put_U32(XVDR_RET_OK);
+  resp->put_U32(XVDR_RET_OK);
 
   return true;
 }
@@ -1460,31 +1939,32 @@ bool cXVDRClient::processTIMER_Update() /* OPCODE 85 */
 
 /** OPCODE 100 - 119: XVDR network functions for recording access */
 
-bool cXVDRClient::processRECORDINGS_GetDiskSpace() /* OPCODE 100 */
+bool cXVDRClient::processRECORDINGS_GetDiskSpace(MsgPacket* req, MsgPacket* resp) /* OPCODE 100 */
 {
   int FreeMB;
   int Percent = VideoDiskSpace(&FreeMB);
   int Total   = (FreeMB / (100 - Percent)) * 100;
 
-  m_resp->put_U32(Total);
-  m_resp->put_U32(FreeMB);
-  m_resp->put_U32(Percent);
+  resp->put_U32(Total);
+  resp->put_U32(FreeMB);
+  resp->put_U32(Percent);
 
   return true;
 }
 
-bool cXVDRClient::processRECORDINGS_GetCount() /* OPCODE 101 */
+bool cXVDRClient::processRECORDINGS_GetCount(MsgPacket* req, MsgPacket* resp) /* OPCODE 101 */
 {
   Recordings.Load();
-  m_resp->put_U32(Recordings.Count());
+  resp->put_U32(Recordings.Count());
 
   return true;
 }
 
-bool cXVDRClient::processRECORDINGS_GetList() /* OPCODE 102 */
+bool cXVDRClient::processRECORDINGS_GetList(MsgPacket* req, MsgPacket* resp) /* OPCODE 102 */
 {
-  cMutexLock lock(&m_timerLock);
+  cTimedMutexLock lock(&m_timerLock);
   cRecordingsCache& reccache = cRecordingsCache::GetInstance();
+  cCharSetConv toUTF8;
 
   for (cRecording *recording = Recordings.First(); recording; recording = Recordings.Next(recording))
   {
@@ -1521,13 +2001,13 @@ bool cXVDRClient::processRECORDINGS_GetList() /* OPCODE 102 */
     DEBUGLOG("GRI: RC: recordingStart=%lu recordingDuration=%i", recordingStart, recordingDuration);
 
     // recording_time
-    m_resp->put_U32(recordingStart);
+    resp->put_U32(recordingStart);
 
     // duration
-    m_resp->put_U32(recordingDuration);
+    resp->put_U32(recordingDuration);
 
     // priority
-    m_resp->put_U32(
+    resp->put_U32(
 #if APIVERSNUM >= 10727
     recording->Priority()
 #else
@@ -1536,7 +2016,7 @@ bool cXVDRClient::processRECORDINGS_GetList() /* OPCODE 102 */
     );
 
     // lifetime
-    m_resp->put_U32(
+    resp->put_U32(
 #if APIVERSNUM >= 10727
     recording->Lifetime()
 #else
@@ -1545,7 +2025,7 @@ bool cXVDRClient::processRECORDINGS_GetList() /* OPCODE 102 */
     );
 
     // channel_name
-    m_resp->put_String(recording->Info()->ChannelName() ? m_toUTF8.Convert(recording->Info()->ChannelName()) : "");
+    resp->put_String(recording->Info()->ChannelName() ? toUTF8.Convert(recording->Info()->ChannelName()) : "");
 
     char* fullname = strdup(recording->Name());
     char* recname = strrchr(fullname, FOLDERDELIMCHAR);
@@ -1561,19 +2041,19 @@ bool cXVDRClient::processRECORDINGS_GetList() /* OPCODE 102 */
     }
 
     // title
-    m_resp->put_String(m_toUTF8.Convert(recname));
+    resp->put_String(toUTF8.Convert(recname));
 
     // subtitle
     if (!isempty(recording->Info()->ShortText()))
-      m_resp->put_String(m_toUTF8.Convert(recording->Info()->ShortText()));
+      resp->put_String(toUTF8.Convert(recording->Info()->ShortText()));
     else
-      m_resp->put_String("");
+      resp->put_String("");
 
     // description
     if (!isempty(recording->Info()->Description()))
-      m_resp->put_String(m_toUTF8.Convert(recording->Info()->Description()));
+      resp->put_String(toUTF8.Convert(recording->Info()->Description()));
     else
-      m_resp->put_String("");
+      resp->put_String("");
 
     // directory
     if(directory != NULL) {
@@ -1586,44 +2066,42 @@ bool cXVDRClient::processRECORDINGS_GetList() /* OPCODE 102 */
       while(*directory == '/') directory++;
     }
 
-    m_resp->put_String((isempty(directory)) ? "" : m_toUTF8.Convert(directory));
+    resp->put_String((isempty(directory)) ? "" : toUTF8.Convert(directory));
 
     // filename / uid of recording
     uint32_t uid = cRecordingsCache::GetInstance().Register(recording);
     char recid[9];
     snprintf(recid, sizeof(recid), "%08x", uid);
-    m_resp->put_String(recid);
+    resp->put_String(recid);
 
     // playcount
-    m_resp->put_U32(reccache.GetPlayCount(uid));
+    resp->put_U32(reccache.GetPlayCount(uid));
 
     // content
     if(event != NULL)
-      m_resp->put_U32(event->Contents());
+      resp->put_U32(event->Contents());
     else
-      m_resp->put_U32(0);
+      resp->put_U32(0);
 
     // thumbnail url - for future use
-    m_resp->put_String("");
+    resp->put_String("");
 
     // icon url - for future use
-    m_resp->put_String("");
+    resp->put_String("");
 
     free(fullname);
   }
 
-  m_resp->compress(m_compressionLevel);
-
   return true;
 }
 
-bool cXVDRClient::processRECORDINGS_Rename() /* OPCODE 103 */
+bool cXVDRClient::processRECORDINGS_Rename(MsgPacket* req, MsgPacket* resp) /* OPCODE 103 */
 {
   uint32_t uid = 0;
-  const char* recid = m_req->get_String();
+  const char* recid = req->get_String();
   uid = recid2uid(recid);
 
-  const char* newtitle     = m_req->get_String();
+  const char* newtitle     = req->get_String();
   cRecording* recording    = cRecordingsCache::GetInstance().Lookup(uid);
   int         r            = XVDR_RET_DATAINVALID;
 
@@ -1653,21 +2131,21 @@ bool cXVDRClient::processRECORDINGS_Rename() /* OPCODE 103 */
     free(filename_old);
   }
 
-  m_resp->put_U32(r);
+  resp->put_U32(r);
 
   return true;
 }
 
-bool cXVDRClient::processRECORDINGS_Delete() /* OPCODE 104 */
+bool cXVDRClient::processRECORDINGS_Delete(MsgPacket* req, MsgPacket* resp) /* OPCODE 104 */
 {
-  const char* recid = m_req->get_String();
+  const char* recid = req->get_String();
   uint32_t uid = recid2uid(recid);
   cRecording* recording = cRecordingsCache::GetInstance().Lookup(uid);
 
   if (recording == NULL)
   {
     ERRORLOG("Recording not found !");
-    m_resp->put_U32(XVDR_RET_DATAUNKNOWN);
+    resp->put_U32(XVDR_RET_DATAUNKNOWN);
     return true;
   }
 
@@ -1677,28 +2155,28 @@ bool cXVDRClient::processRECORDINGS_Delete() /* OPCODE 104 */
   if (rc != NULL)
   {
     ERRORLOG("Recording \"%s\" is in use by timer %d", recording->Name(), rc->Timer()->Index() + 1);
-    m_resp->put_U32(XVDR_RET_DATALOCKED);
+    resp->put_U32(XVDR_RET_DATALOCKED);
     return true;
   }
 
   if (!recording->Delete())
   {
     ERRORLOG("Error while deleting recording!");
-    m_resp->put_U32(XVDR_RET_ERROR);
+    resp->put_U32(XVDR_RET_ERROR);
     return true;
   }
 
   Recordings.DelByName(recording->FileName());
   INFOLOG("Recording \"%s\" deleted", recording->FileName());
-  m_resp->put_U32(XVDR_RET_OK);
+  resp->put_U32(XVDR_RET_OK);
 
   return true;
 }
 
-bool cXVDRClient::processRECORDINGS_SetPlayCount()
+bool cXVDRClient::processRECORDINGS_SetPlayCount(MsgPacket* req, MsgPacket* resp)
 {
-  const char* recid = m_req->get_String();
-  uint32_t count = m_req->get_U32();
+  const char* recid = req->get_String();
+  uint32_t count = req->get_U32();
 
   uint32_t uid = recid2uid(recid);
   cRecordingsCache::GetInstance().SetPlayCount(uid, count);
@@ -1707,10 +2185,10 @@ bool cXVDRClient::processRECORDINGS_SetPlayCount()
   return true;
 }
 
-bool cXVDRClient::processRECORDINGS_SetPosition()
+bool cXVDRClient::processRECORDINGS_SetPosition(MsgPacket* req, MsgPacket* resp)
 {
-  const char* recid = m_req->get_String();
-  uint64_t position = m_req->get_U64();
+  const char* recid = req->get_String();
+  uint64_t position = req->get_U64();
 
   uint32_t uid = recid2uid(recid);
   cRecordingsCache::GetInstance().SetLastPlayedPosition(uid, position);
@@ -1719,27 +2197,28 @@ bool cXVDRClient::processRECORDINGS_SetPosition()
   return true;
 }
 
-bool cXVDRClient::processRECORDINGS_GetPosition()
+bool cXVDRClient::processRECORDINGS_GetPosition(MsgPacket* req, MsgPacket* resp)
 {
-  const char* recid = m_req->get_String();
+  const char* recid = req->get_String();
 
   uint32_t uid = recid2uid(recid);
   uint64_t position = cRecordingsCache::GetInstance().GetLastPlayedPosition(uid);
 
-  m_resp->put_U64(position);
+  resp->put_U64(position);
   return true;
 }
 
 
 /** OPCODE 120 - 139: XVDR network functions for epg access and manipulating */
 
-bool cXVDRClient::processEPG_GetForChannel() /* OPCODE 120 */
+bool cXVDRClient::processEPG_GetForChannel(MsgPacket* req, MsgPacket* resp) /* OPCODE 120 */
 {
-  uint32_t channelUID = m_req->get_U32();
-  uint32_t startTime  = m_req->get_U32();
-  uint32_t duration   = m_req->get_U32();
+  cCharSetConv toUTF8;
+  uint32_t channelUID = req->get_U32();
+  uint32_t startTime  = req->get_U32();
+  uint32_t duration   = req->get_U32();
 
-  Channels.Lock(false);
+  LockChannels();
 
   const cChannel* channel = NULL;
 
@@ -1750,18 +2229,21 @@ bool cXVDRClient::processEPG_GetForChannel() /* OPCODE 120 */
 
   if (!channel)
   {
-    m_resp->put_U32(0);
+    resp->put_U32(0);
     Channels.Unlock();
 
     ERRORLOG("written 0 because channel = NULL");
     return true;
   }
 
+  uint64_t wait = cMetrics::Now();
   cSchedulesLock MutexLock;
+  cMetrics::AddLockWait(wait);
+
   const cSchedules *Schedules = cSchedules::Schedules(MutexLock);
   if (!Schedules)
   {
-    m_resp->put_U32(0);
+    resp->put_U32(0);
     Channels.Unlock();
 
     DEBUGLOG("written 0 because Schedule!s! = NULL");
@@ -1771,7 +2253,7 @@ bool cXVDRClient::processEPG_GetForChannel() /* OPCODE 120 */
   const cSchedule *Schedule = Schedules->GetSchedule(channel->GetChannelID());
   if (!Schedule)
   {
-    m_resp->put_U32(0);
+    resp->put_U32(0);
     Channels.Unlock();
 
     DEBUGLOG("written 0 because Schedule = NULL");
@@ -1821,15 +2303,15 @@ bool cXVDRClient::processEPG_GetForChannel() /* OPCODE 120 */
     if (!thisEventSubTitle)     thisEventSubTitle     = "";
     if (!thisEventDescription)  thisEventDescription  = "";
 
-    m_resp->put_U32(thisEventID);
-    m_resp->put_U32(thisEventTime);
-    m_resp->put_U32(thisEventDuration);
-    m_resp->put_U32(thisEventContent);
-    m_resp->put_U32(thisEventRating);
+    resp->put_U32(thisEventID);
+    resp->put_U32(thisEventTime);
+    resp->put_U32(thisEventDuration);
+    resp->put_U32(thisEventContent);
+    resp->put_U32(thisEventRating);
 
-    m_resp->put_String(m_toUTF8.Convert(thisEventTitle));
-    m_resp->put_String(m_toUTF8.Convert(thisEventSubTitle));
-    m_resp->put_String(m_toUTF8.Convert(thisEventDescription));
+    resp->put_String(toUTF8.Convert(thisEventTitle));
+    resp->put_String(toUTF8.Convert(thisEventSubTitle));
+    resp->put_String(toUTF8.Convert(thisEventDescription));
 
     atLeastOneEvent = true;
   }
@@ -1839,98 +2321,96 @@ bool cXVDRClient::processEPG_GetForChannel() /* OPCODE 120 */
 
   if (!atLeastOneEvent)
   {
-    m_resp->put_U32(0);
+    resp->put_U32(0);
     DEBUGLOG("Written 0 because no data");
   }
 
-  m_resp->compress(m_compressionLevel);
-
   return true;
 }
 
 
 /** OPCODE 140 - 169: XVDR network functions for channel scanning */
 
-bool cXVDRClient::processSCAN_ScanSupported() /* OPCODE 140 */
+bool cXVDRClient::processSCAN_ScanSupported(MsgPacket* req, MsgPacket* resp) /* OPCODE 140 */
 {
   /** Note: Using "WirbelScanService-StopScan-v1.0" to detect
             a present service interface in wirbelscan plugin,
             it returns true if supported */
   cPlugin *p = cPluginManager::GetPlugin("wirbelscan");
   if (p && p->Service("WirbelScanService-StopScan-v1.0", NULL))
-    m_resp->put_U32(XVDR_RET_OK);
+    resp->put_U32(XVDR_RET_OK);
   else
-    m_resp->put_U32(XVDR_RET_NOTSUPPORTED);
+    resp->put_U32(XVDR_RET_NOTSUPPORTED);
 
   return true;
 }
 
-bool cXVDRClient::processSCAN_GetCountries() /* OPCODE 141 */
+bool cXVDRClient::processSCAN_GetCountries(MsgPacket* req, MsgPacket* resp) /* OPCODE 141 */
 {
   if (!m_processSCAN_Response)
   {
-    m_processSCAN_Response = m_resp;
+    m_processSCAN_Response = resp;
     cPlugin *p = cPluginManager::GetPlugin("wirbelscan");
     if (p)
     {
-      m_resp->put_U32(XVDR_RET_OK);
+      resp->put_U32(XVDR_RET_OK);
       p->Service("WirbelScanService-GetCountries-v1.0", (void*) processSCAN_AddCountry);
     }
     else
     {
-      m_resp->put_U32(XVDR_RET_NOTSUPPORTED);
+      resp->put_U32(XVDR_RET_NOTSUPPORTED);
     }
     m_processSCAN_Response = NULL;
   }
   else
   {
-    m_resp->put_U32(XVDR_RET_DATALOCKED);
+    resp->put_U32(XVDR_RET_DATALOCKED);
   }
 
   return true;
 }
 
-bool cXVDRClient::processSCAN_GetSatellites() /* OPCODE 142 */
+bool cXVDRClient::processSCAN_GetSatellites(MsgPacket* req, MsgPacket* resp) /* OPCODE 142 */
 {
   if (!m_processSCAN_Response)
   {
-    m_processSCAN_Response = m_resp;
+    m_processSCAN_Response = resp;
     cPlugin *p = cPluginManager::GetPlugin("wirbelscan");
     if (p)
     {
-      m_resp->put_U32(XVDR_RET_OK);
+      resp->put_U32(XVDR_RET_OK);
       p->Service("WirbelScanService-GetSatellites-v1.0", (void*) processSCAN_AddSatellite);
     }
     else
     {
-      m_resp->put_U32(XVDR_RET_NOTSUPPORTED);
+      resp->put_U32(XVDR_RET_NOTSUPPORTED);
     }
     m_processSCAN_Response = NULL;
   }
   else
   {
-    m_resp->put_U32(XVDR_RET_DATALOCKED);
+    resp->put_U32(XVDR_RET_DATALOCKED);
   }
 
   return true;
 }
 
-bool cXVDRClient::processSCAN_Start() /* OPCODE 143 */
+bool cXVDRClient::processSCAN_Start(MsgPacket* req, MsgPacket* resp) /* OPCODE 143 */
 {
   WirbelScanService_DoScan_v1_0 svc;
-  svc.type              = (scantype_t)m_req->get_U32();
-  svc.scan_tv           = (bool)m_req->get_U8();
-  svc.scan_radio        = (bool)m_req->get_U8();
-  svc.scan_fta          = (bool)m_req->get_U8();
-  svc.scan_scrambled    = (bool)m_req->get_U8();
-  svc.scan_hd           = (bool)m_req->get_U8();
-  svc.CountryIndex      = (int)m_req->get_U32();
-  svc.DVBC_Inversion    = (int)m_req->get_U32();
-  svc.DVBC_Symbolrate   = (int)m_req->get_U32();
-  svc.DVBC_QAM          = (int)m_req->get_U32();
-  svc.DVBT_Inversion    = (int)m_req->get_U32();
-  svc.SatIndex          = (int)m_req->get_U32();
-  svc.ATSC_Type         = (int)m_req->get_U32();
+  svc.type              = (scantype_t)req->get_U32();
+  svc.scan_tv           = (bool)req->get_U8();
+  svc.scan_radio        = (bool)req->get_U8();
+  svc.scan_fta          = (bool)req->get_U8();
+  svc.scan_scrambled    = (bool)req->get_U8();
+  svc.scan_hd           = (bool)req->get_U8();
+  svc.CountryIndex      = (int)req->get_U32();
+  svc.DVBC_Inversion    = (int)req->get_U32();
+  svc.DVBC_Symbolrate   = (int)req->get_U32();
+  svc.DVBC_QAM          = (int)req->get_U32();
+  svc.DVBT_Inversion    = (int)req->get_U32();
+  svc.SatIndex          = (int)req->get_U32();
+  svc.ATSC_Type         = (int)req->get_U32();
   svc.SetPercentage     = processSCAN_SetPercentage;
   svc.SetSignalStrength = processSCAN_SetSignalStrength;
   svc.SetDeviceInfo     = processSCAN_SetDeviceInfo;
@@ -1938,41 +2418,60 @@ bool cXVDRClient::processSCAN_Start() /* OPCODE 143 */
   svc.NewChannel        = processSCAN_NewChannel;
   svc.IsFinished        = processSCAN_IsFinished;
   svc.SetStatus         = processSCAN_SetStatus;
-  m_processSCAN_Socket  = m_socket;
+
+  {
+    cMutexLock lock(&m_processSCAN_Lock);
+    m_processSCAN_Queue = m_sendqueue;
+  }
 
   cPlugin *p = cPluginManager::GetPlugin("wirbelscan");
   if (p)
   {
     if (p->Service("WirbelScanService-DoScan-v1.0", (void*) &svc))
-      m_resp->put_U32(XVDR_RET_OK);
+      resp->put_U32(XVDR_RET_OK);
     else
-      m_resp->put_U32(XVDR_RET_ERROR);
+      resp->put_U32(XVDR_RET_ERROR);
   }
   else
   {
-    m_resp->put_U32(XVDR_RET_NOTSUPPORTED);
+    resp->put_U32(XVDR_RET_NOTSUPPORTED);
   }
 
   return true;
 }
 
-bool cXVDRClient::processSCAN_Stop() /* OPCODE 144 */
+bool cXVDRClient::processSCAN_Stop(MsgPacket* req, MsgPacket* resp) /* OPCODE 144 */
 {
   cPlugin *p = cPluginManager::GetPlugin("wirbelscan");
   if (p)
   {
     p->Service("WirbelScanService-StopScan-v1.0", NULL);
-    m_resp->put_U32(XVDR_RET_OK);
+    resp->put_U32(XVDR_RET_OK);
   }
   else
   {
-    m_resp->put_U32(XVDR_RET_NOTSUPPORTED);
+    resp->put_U32(XVDR_RET_NOTSUPPORTED);
   }
   return true;
 }
 
 MsgPacket* cXVDRClient::m_processSCAN_Response = NULL;
-int cXVDRClient::m_processSCAN_Socket = -1;
+cSendQueue* cXVDRClient::m_processSCAN_Queue = NULL;
+cMutex cXVDRClient::m_processSCAN_Lock;
+
+void cXVDRClient::processSCAN_Send(MsgPacket* resp)
+{
+  cMutexLock lock(&m_processSCAN_Lock);
+
+  // the client has gone away
+  if(m_processSCAN_Queue == NULL)
+  {
+    delete resp;
+    return;
+  }
+
+  m_processSCAN_Queue->Send(resp);
+}
 
 void cXVDRClient::processSCAN_AddCountry(int index, const char *isoName, const char *longName)
 {
@@ -1990,18 +2489,15 @@ void cXVDRClient::processSCAN_AddSatellite(int index, const char *shortName, con
 
 void cXVDRClient::processSCAN_SetPercentage(int percent)
 {
-  cSocketLock locks(m_processSCAN_Socket);
   MsgPacket* resp = new MsgPacket(XVDR_SCANNER_PERCENTAGE, XVDR_CHANNEL_SCAN);
   resp->put_U32(percent);
 
-  resp->write(m_processSCAN_Socket, 3000);
-  delete resp;
+  processSCAN_Send(resp);
 }
 
 void cXVDRClient::processSCAN_SetSignalStrength(int strength, bool locked)
 {
-  cSocketLock locks(m_processSCAN_Socket);
-  MsgPacket*resp = new MsgPacket(XVDR_SCANNER_SIGNAL, XVDR_CHANNEL_SCAN);
+  MsgPacket* resp = new MsgPacket(XVDR_SCANNER_SIGNAL, XVDR_CHANNEL_SCAN);
 
   strength *= 100;
   strength /= 0xFFFF;
@@ -2009,35 +2505,29 @@ void cXVDRClient::processSCAN_SetSignalStrength(int strength, bool locked)
   resp->put_U32(strength);
   resp->put_U32(locked);
 
-  resp->write(m_processSCAN_Socket, 3000);
-  delete resp;
+  processSCAN_Send(resp);
 }
 
 void cXVDRClient::processSCAN_SetDeviceInfo(const char *Info)
 {
-  cSocketLock locks(m_processSCAN_Socket);
   MsgPacket* resp = new MsgPacket(XVDR_SCANNER_DEVICE, XVDR_CHANNEL_SCAN);
 
   resp->put_String(Info);
 
-  resp->write(m_processSCAN_Socket, 3000);
-  delete resp;
+  processSCAN_Send(resp);
 }
 
 void cXVDRClient::processSCAN_SetTransponder(const char *Info)
 {
-  cSocketLock locks(m_processSCAN_Socket);
   MsgPacket* resp = new MsgPacket(XVDR_SCANNER_TRANSPONDER, XVDR_CHANNEL_SCAN);
 
   resp->put_String(Info);
 
-  resp->write(m_processSCAN_Socket, 3000);
-  delete resp;
+  processSCAN_Send(resp);
 }
 
 void cXVDRClient::processSCAN_NewChannel(const char *Name, bool isRadio, bool isEncrypted, bool isHD)
 {
-  cSocketLock locks(m_processSCAN_Socket);
   MsgPacket* resp = new MsgPacket(XVDR_SCANNER_NEWCHANNEL, XVDR_CHANNEL_SCAN);
 
   resp->put_U32(isRadio);
@@ -2045,27 +2535,30 @@ void cXVDRClient::processSCAN_NewChannel(const char *Name, bool isRadio, bool is
   resp->put_U32(isHD);
   resp->put_String(Name);
 
-  resp->write(m_processSCAN_Socket, 3000);
-  delete resp;
+  processSCAN_Send(resp);
 }
 
 void cXVDRClient::processSCAN_IsFinished()
 {
-  cSocketLock locks(m_processSCAN_Socket);
   MsgPacket* resp = new MsgPacket(XVDR_SCANNER_FINISHED, XVDR_CHANNEL_SCAN);
 
-  resp->write(m_processSCAN_Socket, 3000);
-  delete resp;
-  m_processSCAN_Socket = -1;
+  cMutexLock lock(&m_processSCAN_Lock);
+
+  if(m_processSCAN_Queue == NULL)
+  {
+    delete resp;
+    return;
+  }
+
+  m_processSCAN_Queue->Send(resp);
+  m_processSCAN_Queue = NULL;
 }
 
 void cXVDRClient::processSCAN_SetStatus(int status)
 {
-  cSocketLock locks(m_processSCAN_Socket);
   MsgPacket* resp = new MsgPacket(XVDR_SCANNER_STATUS, XVDR_CHANNEL_SCAN);
 
   resp->put_U32(status);
 
-  resp->write(m_processSCAN_Socket, 3000);
-  delete resp;
+  processSCAN_Send(resp);
 }
@@ -28,6 +28,7 @@
 
 #include <map>
 #include <list>
+#include <queue>
 #include <string>
 
 #include <vdr/thread.h>
@@ -36,34 +37,50 @@
 #include <vdr/status.h>
 
 #include "demuxer/demuxer.h"
+#include "net/metrics.h"
+#include "net/reactor.h"
 
 class cChannel;
 class cDevice;
 class cLiveStreamer;
 class MsgPacket;
+class MsgCompressor;
+class MsgReader;
+class cSendQueue;
 class cRecPlayer;
 class cCmdControl;
+class cXVDRRequestJob;
 
-class cXVDRClient : public cThread
+class cXVDRClient : public cReactorHandler
                   , public cStatus
 {
 private:
 
   unsigned int     m_Id;
   int              m_socket;
+  bool             m_active;
   bool             m_loggedIn;
   bool             m_StatusInterfaceEnabled;
   cLiveStreamer   *m_Streamer;
   bool             m_isStreaming;
   cRecPlayer      *m_RecPlayer;
   MsgPacket       *m_req;
-  MsgPacket       *m_resp;
-  cCharSetConv     m_toUTF8;
+  MsgReader       *m_reader;
+  cSendQueue      *m_sendqueue;
   uint32_t         m_protocolVersion;
   cMutex           m_msgLock;
+  cMutex           m_jobLock;
+  cCondVar         m_jobDone;
+  int              m_inflight;
+  bool             m_throttled;
+  bool             m_serialRunning;
+  std::queue<MsgPacket*> m_serial;
   static cMutex    m_timerLock;
   static cMutex    m_switchLock;
+  static int       SlowRequestTime;
   int              m_compressionLevel;
+  MsgCompressor   *m_compressor;
+  uint32_t         m_features;
   int              m_LanguageIndex;
   eStreamType      m_LangStreamType;
   std::list<int>   m_caids;
@@ -71,12 +88,19 @@ private:
   bool             m_filterlanguage;
   int              m_channelCount;
   int              m_timeout;
+  cString          m_address;
+  cMetricSet       m_metrics;
 
 protected:
 
-  bool processRequest();
+  bool processRequest(MsgPacket* req);
+  bool DispatchRequest(MsgPacket* req);
+  void ProcessConcurrent(MsgPacket* req);
+  void ProcessSerial(MsgPacket* req);
+  void RequestDone();
+  void SendResponse(MsgPacket* resp, bool compress = false);
 
-  virtual void Action(void);
+  virtual void OnEvent(int events);
 
   virtual void TimerChange(const cTimer *Timer, eTimerChange Change);
   virtual void Recording(const cDevice *Device, const char *Name, const char *FileName, bool On);
@@ -84,7 +108,7 @@ protected:
 
 public:
 
-  cXVDRClient(int fd, unsigned int id);
+  cXVDRClient(int fd, unsigned int id, const char* address);
   virtual ~cXVDRClient();
 
   void ChannelChange();
@@ -92,16 +116,22 @@ public:
   void TimerChange();
 
   unsigned int GetID() { return m_Id; }
+  bool Active() { return m_active; }
+
+  // log requests taking longer (0 = off)
+  static void SetSlowRequestTime(int ms);
 
 protected:
 
   void SetLoggedIn(bool yesNo) { m_loggedIn = yesNo; }
   void SetStatusInterface(bool yesNo) { m_StatusInterfaceEnabled = yesNo; }
-  bool StartChannelStreaming(const cChannel *channel, uint32_t timeout, int32_t priority);
+  bool StartChannelStreaming(const cChannel *channel, uint32_t timeout, int32_t priority, MsgPacket* resp);
   void StopChannelStreaming();
 
 private:
 
+  friend class cXVDRRequestJob;
+
   typedef struct {
     bool automatic;
     bool radio;
@@ -115,59 +145,64 @@ private:
   int  ChannelsCount();
   cString CreateLogoURL(cChannel* channel);
 
-  bool process_Login();
-  bool process_GetTime();
-  bool process_EnableStatusInterface();
-  bool process_Ping();
-  bool process_UpdateChannels();
-  bool process_ChannelFilter();
-
-  bool processChannelStream_Open();
-  bool processChannelStream_Close();
-  bool processChannelStream_Pause();
-  bool processChannelStream_Request();
-
-  bool processRecStream_Open();
-  bool processRecStream_Close();
-  bool processRecStream_GetBlock();
-  bool processRecStream_Update();
-  bool processRecStream_PositionFromFrameNumber();
-  bool processRecStream_FrameNumberFromPosition();
-  bool processRecStream_GetIFrame();
-
-  bool processCHANNELS_GroupsCount();
-  bool processCHANNELS_ChannelsCount();
-  bool processCHANNELS_GroupList();
-  bool processCHANNELS_GetChannels();
-  bool processCHANNELS_GetGroupMembers();
+  bool process_Login(MsgPacket* req, MsgPacket* resp);
+  bool process_GetTime(MsgPacket* req, MsgPacket* resp);
+  bool process_EnableStatusInterface(MsgPacket* req, MsgPacket* resp);
+  bool process_Ping(MsgPacket* req, MsgPacket* resp);
+  bool process_UpdateChannels(MsgPacket* req, MsgPacket* resp);
+  bool process_ChannelFilter(MsgPacket* req, MsgPacket* resp);
+  bool process_GetStats(MsgPacket* req, MsgPacket* resp);
+
+  bool processChannelStream_Open(MsgPacket* req, MsgPacket* resp);
+  bool processChannelStream_Close(MsgPacket* req, MsgPacket* resp);
+  bool processChannelStream_Pause(MsgPacket* req, MsgPacket* resp);
+  bool processChannelStream_Request(MsgPacket* req, MsgPacket* resp);
+  bool processChannelStream_Seek(MsgPacket* req, MsgPacket* resp);
+  bool processChannelStream_Skip(MsgPacket* req, MsgPacket* resp);
+  bool processChannelStream_Live(MsgPacket* req, MsgPacket* resp);
+  bool processChannelStream_Window(MsgPacket* req, MsgPacket* resp);
+
+  bool processRecStream_Open(MsgPacket* req, MsgPacket* resp);
+  bool processRecStream_Close(MsgPacket* req, MsgPacket* resp);
+  bool processRecStream_GetBlock(MsgPacket* req, MsgPacket* resp);
+  bool processRecStream_Update(MsgPacket* req, MsgPacket* resp);
+  bool processRecStream_PositionFromFrameNumber(MsgPacket* req, MsgPacket* resp);
+  bool processRecStream_FrameNumberFromPosition(MsgPacket* req, MsgPacket* resp);
+  bool processRecStream_GetIFrame(MsgPacket* req, MsgPacket* resp);
+
+  bool processCHANNELS_GroupsCount(MsgPacket* req, MsgPacket* resp);
+  bool processCHANNELS_ChannelsCount(MsgPacket* req, MsgPacket* resp);
+  bool processCHANNELS_GroupList(MsgPacket* req, MsgPacket* resp);
+  bool processCHANNELS_GetChannels(MsgPacket* req, MsgPacket* resp);
+  bool processCHANNELS_GetGroupMembers(MsgPacket* req, MsgPacket* resp);
 
   void CreateChannelGroups(bool automatic);
 
-  bool processTIMER_GetCount();
-  bool processTIMER_Get();
-  bool processTIMER_GetList();
-  bool processTIMER_Add();
-  bool processTIMER_Delete();
-  bool processTIMER_Update();
-
-  bool processRECORDINGS_GetDiskSpace();
-  bool processRECORDINGS_GetCount();
-  bool processRECORDINGS_GetList();
-  bool processRECORDINGS_GetInfo();
-  bool processRECORDINGS_Rename();
-  bool processRECORDINGS_Delete();
-  bool processRECORDINGS_Move();
-  bool processRECORDINGS_SetPlayCount();
-  bool processRECORDINGS_SetPosition();
-  bool processRECORDINGS_GetPosition();
-
-  bool processEPG_GetForChannel();
-
-  bool processSCAN_ScanSupported();
-  bool processSCAN_GetCountries();
-  bool processSCAN_GetSatellites();
-  bool processSCAN_Start();
-  bool processSCAN_Stop();
+  bool processTIMER_GetCount(MsgPacket* req, MsgPacket* resp);
+  bool processTIMER_Get(MsgPacket* req, MsgPacket* resp);
+  bool processTIMER_GetList(MsgPacket* req, MsgPacket* resp);
+  bool processTIMER_Add(MsgPacket* req, MsgPacket* resp);
+  bool processTIMER_Delete(MsgPacket* req, MsgPacket* resp);
+  bool processTIMER_Update(MsgPacket* req, MsgPacket* resp);
+
+  bool processRECORDINGS_GetDiskSpace(MsgPacket* req, MsgPacket* resp);
+  bool processRECORDINGS_GetCount(MsgPacket* req, MsgPacket* resp);
+  bool processRECORDINGS_GetList(MsgPacket* req, MsgPacket* resp);
+  bool processRECORDINGS_GetInfo(MsgPacket* req, MsgPacket* resp);
+  bool processRECORDINGS_Rename(MsgPacket* req, MsgPacket* resp);
+  bool processRECORDINGS_Delete(MsgPacket* req, MsgPacket* resp);
+  bool processRECORDINGS_Move(MsgPacket* req, MsgPacket* resp);
+  bool processRECORDINGS_SetPlayCount(MsgPacket* req, MsgPacket* resp);
+  bool processRECORDINGS_SetPosition(MsgPacket* req, MsgPacket* resp);
+  bool processRECORDINGS_GetPosition(MsgPacket* req, MsgPacket* resp);
+
+  bool processEPG_GetForChannel(MsgPacket* req, MsgPacket* resp);
+
+  bool processSCAN_ScanSupported(MsgPacket* req, MsgPacket* resp);
+  bool processSCAN_GetCountries(MsgPacket* req, MsgPacket* resp);
+  bool processSCAN_GetSatellites(MsgPacket* req, MsgPacket* resp);
+  bool processSCAN_Start(MsgPacket* req, MsgPacket* resp);
+  bool processSCAN_Stop(MsgPacket* req, MsgPacket* resp);
 
   /** Static callback functions to interact with wirbelscan plugin over
       the plugin service interface */
@@ -180,8 +215,10 @@ private:
   static void processSCAN_NewChannel(const char *Name, bool isRadio, bool isEncrypted, bool isHD);
   static void processSCAN_IsFinished();
   static void processSCAN_SetStatus(int status);
+  static void processSCAN_Send(MsgPacket* resp);
   static MsgPacket* m_processSCAN_Response;
-  static int m_processSCAN_Socket;
+  static cSendQueue* m_processSCAN_Queue;
+  static cMutex m_processSCAN_Lock;         /*!> guards m_processSCAN_Queue */
 
 };
 
@@ -27,6 +27,20 @@
 #define XVDR_PROTOCOLVERSION          4
 
 
+/** Protocol features (negotiated at login) */
+#define XVDR_FEATURE_STREAMCOMPRESSION 0x00000001  /* persistent compression stream per connection */
+#define XVDR_FEATURE_COMPACTSTREAM     0x00000002  /* compact packet header for stream packets */
+#define XVDR_FEATURE_MUXBATCH          0x00000004  /* audio, subtitle and teletext frames batched (XVDR_STREAM_MUXBATCH) */
+#define XVDR_FEATURE_DELTATIMESTAMPS   0x00000008  /* compact mux packet records, see XVDR_MUXPKT_* */
+#define XVDR_FEATURE_QUEUESTATUS       0x00000010  /* live queue status every second (XVDR_STREAM_QUEUESTATUS) */
+
+
+/** Compression codecs (negotiated at login) */
+#define XVDR_CODEC_ZLIB               0
+#define XVDR_CODEC_LZ4                1
+#define XVDR_CODEC_ZSTD               2
+
+
 /** Packet types */
 #define XVDR_CHANNEL_REQUEST_RESPONSE 1
 #define XVDR_CHANNEL_STREAM           2
@@ -43,12 +57,17 @@
 #define XVDR_PING                  7
 #define XVDR_UPDATECHANNELS        8
 #define XVDR_CHANNELFILTER         9
+#define XVDR_GETSTATS              10
 
 /* OPCODE 20 - 39: XVDR network functions for live streaming */
 #define XVDR_CHANNELSTREAM_OPEN    20
 #define XVDR_CHANNELSTREAM_CLOSE   21
 #define XVDR_CHANNELSTREAM_REQUEST 22
 #define XVDR_CHANNELSTREAM_PAUSE   23
+#define XVDR_CHANNELSTREAM_SEEK    24  /* S64 pts -> U32 status, S64 pts of the keyframe */
+#define XVDR_CHANNELSTREAM_SKIP    25  /* S32 ms relative to the position -> U32 status, S64 pts of the keyframe */
+#define XVDR_CHANNELSTREAM_LIVE    26  /* -> U32 status, S64 pts of the newest keyframe */
+#define XVDR_CHANNELSTREAM_WINDOW  27  /* -> U32 status, S64 pts of the oldest keyframe, position, newest frame */
 
 /* OPCODE 40 - 59: XVDR network functions for recording streaming */
 #define XVDR_RECSTREAM_OPEN        40
@@ -98,10 +117,19 @@
 /** Stream packet types (server -> client) */
 #define XVDR_STREAM_CHANGE       1
 #define XVDR_STREAM_STATUS       2
-#define XVDR_STREAM_QUEUESTATUS  3
+#define XVDR_STREAM_QUEUESTATUS  3  /* U32 packets, bytes, byte budget, media ms, media budget ms, bitrate (bytes/s), dropped packets */
 #define XVDR_STREAM_MUXPKT       4
 #define XVDR_STREAM_SIGNALINFO   5
 #define XVDR_STREAM_CONTENTINFO  6
+#define XVDR_STREAM_MUXBATCH     7  /* records of XVDR_STREAM_MUXPKT (pid, pts, dts, size, data) up to the end of the packet */
+
+/** Compact mux packet record (XVDR_FEATURE_DELTATIMESTAMPS)
+ *  U8 flags, VarU pid, VarS dts, [VarS pts - dts], [VarU duration], VarU size, data
+ *  The dts of the first frame of a pid in a packet is absolute, following frames
+ *  of the pid in the same packet carry the difference to the previous one. */
+#define XVDR_MUXPKT_PTSEQUALSDTS   0x01  /* pts - dts is omitted */
+#define XVDR_MUXPKT_SAMEDURATION   0x02  /* duration is omitted, same as the previous frame of the pid */
+#define XVDR_MUXPKT_DELTADTS       0x04  /* dts relative to the previous frame of the pid */
 
 /** Stream status codes */
 #define XVDR_STREAM_STATUS_SIGNALLOST     111
@@ -42,6 +42,8 @@
 
 #include "xvdrserver.h"
 #include "xvdrclient.h"
+#include "net/bufferpool.h"
+#include "net/workerpool.h"
 #include "recordings/recordingscache.h"
 
 //#define ENABLE_CHANNELTRIGGER 1
@@ -70,9 +72,21 @@ public:
   }
 };
 
-cXVDRServer::cXVDRServer(int listenPort) : cThread("VDR XVDR Server")
+// interval of the housekeeping timer (ms)
+#define HOUSEKEEPING_INTERVAL 250
+
+cXVDRServer::cXVDRServer(int listenPort)
 {
   m_ServerPort  = listenPort;
+  m_channelReloadTrigger = false;
+
+  // get initial state of the recordings
+  m_recState = -1;
+  Recordings.StateChanged(m_recState);
+
+  // get initial state of the timers
+  m_timerState = -1;
+  Timers.Modified(m_timerState);
 
   if(*XVDRServerConfig.ConfigDirectory)
   {
@@ -108,8 +122,19 @@ cXVDRServer::cXVDRServer(int listenPort) : cThread("VDR XVDR Server")
   }
 
   listen(m_ServerFD, 10);
+  fcntl(m_ServerFD, F_SETFL, fcntl(m_ServerFD, F_GETFL) | O_NONBLOCK);
 
-  Start();
+  cReactor& reactor = cReactor::GetInstance();
+
+  if(!reactor.Start() || !cWorkerPool::GetInstance().Start() || !reactor.Add(this, m_ServerFD, cReactor::Readable))
+  {
+    close(m_ServerFD);
+    ERRORLOG("Unable to start XVDR Server");
+    m_ServerFD = -1;
+    return;
+  }
+
+  reactor.SetTimer(this, HOUSEKEEPING_INTERVAL);
 
   INFOLOG("XVDR Server started");
   INFOLOG("Channel streaming timeout: %i seconds", XVDRServerConfig.stream_timeout);
@@ -118,13 +143,14 @@ cXVDRServer::cXVDRServer(int listenPort) : cThread("VDR XVDR Server")
 
 cXVDRServer::~cXVDRServer()
 {
-  Cancel(-1);
+  cReactor::GetInstance().Remove(this);
   for (ClientList::iterator i = m_clients.begin(); i != m_clients.end(); i++)
   {
     delete (*i);
   }
   m_clients.erase(m_clients.begin(), m_clients.end());
-  Cancel();
+  cReactor::GetInstance().Stop();
+  cWorkerPool::GetInstance().Stop();
   INFOLOG("XVDR Server stopped");
 }
 
@@ -173,112 +199,119 @@ void cXVDRServer::NewClientConnected(int fd)
   setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
 
   INFOLOG("Client %s:%i with ID %d connected.", inet_ntoa(sin.sin_addr), sin.sin_port, m_IdCnt);
-  cXVDRClient *connection = new cXVDRClient(fd, m_IdCnt);
+  cXVDRClient *connection = new cXVDRClient(fd, m_IdCnt, inet_ntoa(sin.sin_addr));
   m_clients.push_back(connection);
   m_IdCnt++;
 }
 
-void cXVDRServer::Action(void)
+void cXVDRServer::LogBufferPoolStats()
 {
-  fd_set fds;
-  struct timeval tv;
-  cTimeMs channelReloadTimer;
-  bool channelReloadTrigger = false;
+  MsgBufferPool::Stats stats;
+  MsgBufferPool::getStats(stats);
 
-  // get initial state of the recordings
-  int recState = -1;
-  Recordings.StateChanged(recState);
+  uint64_t total = stats.hits + stats.misses;
 
-  // get initial state of the timers
-  int timerState = -1;
-  Timers.Modified(timerState);
+  INFOLOG("Packet buffer pool: %llu hits, %llu misses (%.1f%% hit rate), %llu oversize, %llu kB cached",
+          (unsigned long long)stats.hits,
+          (unsigned long long)stats.misses,
+          total ? (100.0 * stats.hits / total) : 0.0,
+          (unsigned long long)stats.oversize,
+          (unsigned long long)(stats.cached / 1024));
 
-  while (Running())
+  for (int i = 0; i < MsgBufferPool::ClassCount; i++)
   {
-    FD_ZERO(&fds);
-    FD_SET(m_ServerFD, &fds);
+    if (stats.classhits[i] + stats.classmisses[i] == 0)
+      continue;
 
-    tv.tv_sec = 0;
-    tv.tv_usec = 250*1000;
+    DEBUGLOG("  %6u bytes: %llu hits, %llu misses",
+             MsgBufferPool::classSize(i),
+             (unsigned long long)stats.classhits[i],
+             (unsigned long long)stats.classmisses[i]);
+  }
+}
 
-    int r = select(m_ServerFD + 1, &fds, NULL, NULL, &tv);
-    if (r == -1)
-    {
-      ERRORLOG("failed during select");
-      continue;
-    }
-    if (r == 0)
-    {
-      // remove disconnected clients
-      for (ClientList::iterator i = m_clients.begin(); i != m_clients.end();)
-      {
-        if (!(*i)->Active())
-        {
-          INFOLOG("Client with ID %u seems to be disconnected, removing from client list", (*i)->GetID());
-          delete (*i);
-          i = m_clients.erase(i);
-        }
-        else {
-          i++;
-        }
-      }
+void cXVDRServer::OnEvent(int events)
+{
+  cReactor& reactor = cReactor::GetInstance();
 
-      // trigger clients to reload the modified channel list
-      if(m_clients.size() > 0)
-      {
-        Channels.Lock(false);
-        if(Channels.Modified() != 0)
-        {
-          channelReloadTrigger = true;
-          channelReloadTimer.Set(0);
-        }
-        if(channelReloadTrigger && channelReloadTimer.Elapsed() >= 10*1000)
-        {
-          INFOLOG("Checking for channel updates ...");
-          for (ClientList::iterator i = m_clients.begin(); i != m_clients.end(); i++)
-            (*i)->ChannelChange();
-          channelReloadTrigger = false;
-          INFOLOG("Done.");
-        }
-        Channels.Unlock();
-      }
+  if(events & cReactor::Timeout)
+  {
+    Housekeeping();
+    reactor.SetTimer(this, HOUSEKEEPING_INTERVAL);
+  }
 
-      // reset inactivity timeout as long as there are clients connected
-      if(m_clients.size() > 0) {
-        ShutdownHandler.SetUserInactiveTimeout();
-      }
+  if(events & cReactor::Readable)
+  {
+    int fd;
+    while((fd = accept(m_ServerFD, 0, 0)) >= 0)
+      NewClientConnected(fd);
 
-      // update recordings
-      if(Recordings.StateChanged(recState) || cRecordingsCache::GetInstance().Changed())
-      {
-        INFOLOG("Recordings state changed (%i)", recState);
-        INFOLOG("Requesting clients to reload recordings list");
-        for (ClientList::iterator i = m_clients.begin(); i != m_clients.end(); i++)
-          (*i)->RecordingsChange();
-      }
+    if(errno != EAGAIN && errno != EINTR)
+      ERRORLOG("accept failed");
 
-      // update timers
-      if(Timers.Modified(timerState))
-      {
-        INFOLOG("Timers state changed (%i)", timerState);
-        INFOLOG("Requesting clients to reload timers");
-        for (ClientList::iterator i = m_clients.begin(); i != m_clients.end(); i++)
-        {
-         (*i)->TimerChange();
-        }
-      }
-      continue;
+    reactor.Arm(this, cReactor::Readable);
+  }
+}
+
+void cXVDRServer::Housekeeping()
+{
+  // remove disconnected clients
+  for (ClientList::iterator i = m_clients.begin(); i != m_clients.end();)
+  {
+    if (!(*i)->Active())
+    {
+      INFOLOG("Client with ID %u seems to be disconnected, removing from client list", (*i)->GetID());
+      delete (*i);
+      i = m_clients.erase(i);
+      LogBufferPoolStats();
+    }
+    else {
+      i++;
     }
+  }
 
-    int fd = accept(m_ServerFD, 0, 0);
-    if (fd >= 0)
+  // trigger clients to reload the modified channel list
+  if(m_clients.size() > 0)
+  {
+    Channels.Lock(false);
+    if(Channels.Modified() != 0)
     {
-      NewClientConnected(fd);
+      m_channelReloadTrigger = true;
+      m_channelReloadTimer.Set(0);
     }
-    else
+    if(m_channelReloadTrigger && m_channelReloadTimer.Elapsed() >= 10*1000)
     {
-      ERRORLOG("accept failed");
+      INFOLOG("Checking for channel updates ...");
+      for (ClientList::iterator i = m_clients.begin(); i != m_clients.end(); i++)
+        (*i)->ChannelChange();
+      m_channelReloadTrigger = false;
+      INFOLOG("Done.");
+    }
+    Channels.Unlock();
+  }
+
+  // reset inactivity timeout as long as there are clients connected
+  if(m_clients.size() > 0) {
+    ShutdownHandler.SetUserInactiveTimeout();
+  }
+
+  // update recordings
+  if(Recordings.StateChanged(m_recState) || cRecordingsCache::GetInstance().Changed())
+  {
+    INFOLOG("Recordings state changed (%i)", m_recState);
+    INFOLOG("Requesting clients to reload recordings list");
+    for (ClientList::iterator i = m_clients.begin(); i != m_clients.end(); i++)
+      (*i)->RecordingsChange();
+  }
+
+  // update timers
+  if(Timers.Modified(m_timerState))
+  {
+    INFOLOG("Timers state changed (%i)", m_timerState);
+    INFOLOG("Requesting clients to reload timers");
+    for (ClientList::iterator i = m_clients.begin(); i != m_clients.end(); i++)
+    {
+     (*i)->TimerChange();
     }
   }
-  return;
 }
@@ -30,22 +30,29 @@
 #include <vdr/thread.h>
 
 #include "config/config.h"
+#include "net/reactor.h"
 
 class cXVDRClient;
 
-class cXVDRServer : public cThread
+class cXVDRServer : public cReactorHandler
 {
 protected:
 
   typedef std::list<cXVDRClient*> ClientList;
 
-  virtual void Action(void);
+  virtual void OnEvent(int events);
+  void Housekeeping();
   void NewClientConnected(int fd);
+  void LogBufferPoolStats();
 
   int           m_ServerPort;
   int           m_ServerFD;
   cString       m_AllowedHostsFile;
   ClientList    m_clients;
+  cTimeMs       m_channelReloadTimer;
+  bool          m_channelReloadTrigger;
+  int           m_recState;
+  int           m_timerState;
 
   static unsigned int m_IdCnt;
 
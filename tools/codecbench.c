@@ -0,0 +1,339 @@
+/*
+ *      VDR Compression Codec Benchmark Tool
+ *
+ *      Copyright (C) 2012 Alexander Pipelka
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+// Compresses captured response payloads (xvdrcapture) with every compiled in
+// codec, in packet and in streaming mode, and reports the compression ratio
+// and the CPU time needed to compress (server) and decompress (client) them.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "net/msgcompressor.h"
+
+struct Sample {
+	uint8_t* data;
+	uint32_t size;
+};
+
+struct Codec {
+	int codec;
+	int level;
+	bool dictionary;
+};
+
+static const Codec codecs[] = {
+	{ MsgCompressor::Zlib, 1, false },
+	{ MsgCompressor::Zlib, 6, false },
+	{ MsgCompressor::Lz4, 1, false },
+	{ MsgCompressor::Zstd, 1, false },
+	{ MsgCompressor::Zstd, 3, false },
+	{ MsgCompressor::Zstd, 6, false },
+	{ MsgCompressor::Zstd, 1, true },
+	{ MsgCompressor::Zstd, 3, true },
+	{ MsgCompressor::Zstd, 6, true }
+};
+
+static double cputime() {
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool readFile(const char* filename, Sample& s) {
+	FILE* file = fopen(filename, "rb");
+
+	if(file == NULL) {
+		return false;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	s.data = (uint8_t*)malloc(size > 0 ? size : 1);
+	s.size = size;
+
+	bool rc = (size > 0 && s.data != NULL && fread(s.data, 1, size, file) == (size_t)size);
+	fclose(file);
+
+	return rc;
+}
+
+// decompress all payloads in order into one contiguous buffer (LZ4 streams need the history in place)
+static bool decompress(const Codec& c, bool streaming, const Sample& dictionary, std::vector<Sample>& in, std::vector<Sample>& samples, uint8_t* out) {
+	uint8_t* p = out;
+
+	switch(c.codec) {
+#ifdef HAVE_ZLIB
+		case MsgCompressor::Zlib: {
+			z_stream stream;
+			memset(&stream, 0, sizeof(stream));
+			inflateInit(&stream);
+
+			for(size_t i = 0; i < in.size(); i++) {
+				if(!streaming) {
+					inflateReset(&stream);
+				}
+
+				stream.next_in = in[i].data;
+				stream.avail_in = in[i].size;
+				stream.next_out = p;
+				stream.avail_out = samples[i].size;
+
+				int rc = inflate(&stream, streaming ? Z_SYNC_FLUSH : Z_FINISH);
+
+				if((rc != Z_OK && rc != Z_STREAM_END) || stream.avail_in != 0 || stream.avail_out != 0) {
+					inflateEnd(&stream);
+					return false;
+				}
+
+				p += samples[i].size;
+			}
+
+			inflateEnd(&stream);
+			return true;
+		}
+#endif
+#ifdef HAVE_LZ4
+		case MsgCompressor::Lz4: {
+			LZ4_streamDecode_t* stream = LZ4_createStreamDecode();
+
+			for(size_t i = 0; i < in.size(); i++) {
+				int rc = streaming ?
+					LZ4_decompress_safe_continue(stream, (const char*)in[i].data, (char*)p, in[i].size, samples[i].size) :
+					LZ4_decompress_safe((const char*)in[i].data, (char*)p, in[i].size, samples[i].size);
+
+				if(rc != (int)samples[i].size) {
+					LZ4_freeStreamDecode(stream);
+					return false;
+				}
+
+				p += samples[i].size;
+			}
+
+			LZ4_freeStreamDecode(stream);
+			return true;
+		}
+#endif
+#ifdef HAVE_ZSTD
+		case MsgCompressor::Zstd: {
+			ZSTD_DCtx* stream = ZSTD_createDCtx();
+
+			if(c.dictionary) {
+				ZSTD_DCtx_loadDictionary(stream, dictionary.data, dictionary.size);
+			}
+
+			for(size_t i = 0; i < in.size(); i++) {
+				if(!streaming) {
+					size_t rc = ZSTD_decompressDCtx(stream, p, samples[i].size, in[i].data, in[i].size);
+
+					if(rc != samples[i].size) {
+						ZSTD_freeDCtx(stream);
+						return false;
+					}
+
+					p += samples[i].size;
+					continue;
+				}
+
+				ZSTD_inBuffer input = { in[i].data, in[i].size, 0 };
+				ZSTD_outBuffer output = { p, samples[i].size, 0 };
+
+				while(input.pos < input.size) {
+					if(ZSTD_isError(ZSTD_decompressStream(stream, &output, &input))) {
+						ZSTD_freeDCtx(stream);
+						return false;
+					}
+				}
+
+				if(output.pos != output.size) {
+					ZSTD_freeDCtx(stream);
+					return false;
+				}
+
+				p += samples[i].size;
+			}
+
+			ZSTD_freeDCtx(stream);
+			return true;
+		}
+#endif
+		default:
+			return false;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	const char* dictionaryfile = NULL;
+	int iterations = 10;
+	int c;
+
+	while((c = getopt(argc, argv, "D:n:")) != -1) {
+		switch(c) {
+			case 'D':
+				dictionaryfile = optarg;
+				break;
+			case 'n':
+				iterations = atoi(optarg);
+				break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+
+	if(optind >= argc || iterations <= 0) {
+		fprintf(stderr, "usage: %s [-D zstd dictionary] [-n iterations] payload files ...\n", argv[0]);
+		return 1;
+	}
+
+	// load captured payloads
+	std::vector<Sample> samples;
+	uint64_t total = 0;
+
+	for(int i = optind; i < argc; i++) {
+		Sample s;
+
+		if(!readFile(argv[i], s)) {
+			fprintf(stderr, "unable to read %s\n", argv[i]);
+			return 1;
+		}
+
+		samples.push_back(s);
+		total += s.size;
+	}
+
+	Sample dictionary = { NULL, 0 };
+
+	if(dictionaryfile != NULL) {
+		if(!readFile(dictionaryfile, dictionary) || !MsgCompressor::loadDictionary(dictionaryfile)) {
+			fprintf(stderr, "unable to load dictionary %s\n", dictionaryfile);
+			return 1;
+		}
+	}
+
+	uint8_t* uncompressed = (uint8_t*)malloc(total);
+
+	printf("%i payloads, %llu bytes, %i iterations\n\n", (int)samples.size(), (unsigned long long)total, iterations);
+	printf("codec  level  mode    dict    ratio  compress ms    MB/s  decompress ms    MB/s\n");
+
+	for(size_t i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+		const Codec& codec = codecs[i];
+
+		if(!MsgCompressor::supported(codec.codec) || (codec.dictionary && dictionaryfile == NULL)) {
+			continue;
+		}
+
+		for(int mode = 0; mode < 2; mode++) {
+			bool streaming = (mode == 1);
+			std::vector<Sample> compressed(samples.size());
+			uint64_t compressedsize = 0;
+
+			for(size_t j = 0; j < samples.size(); j++) {
+				compressed[j].data = NULL;
+			}
+
+			// every iteration is a new connection
+			double start = cputime();
+
+			for(int n = 0; n < iterations; n++) {
+				MsgCompressor compressor(codec.codec, codec.level, streaming, codec.dictionary);
+				compressedsize = 0;
+
+				for(size_t j = 0; j < samples.size(); j++) {
+					uint32_t size = compressor.bound(samples[j].size);
+
+					if(compressed[j].data == NULL) {
+						compressed[j].data = (uint8_t*)malloc(size);
+					}
+
+					if(!compressor.compress(samples[j].data, samples[j].size, compressed[j].data, size)) {
+						fprintf(stderr, "%s: compression failed\n", MsgCompressor::name(codec.codec));
+						return 1;
+					}
+
+					compressed[j].size = size;
+					compressedsize += size;
+				}
+			}
+
+			double compresstime = (cputime() - start) / iterations;
+
+			start = cputime();
+
+			for(int n = 0; n < iterations; n++) {
+				if(!decompress(codec, streaming, dictionary, compressed, samples, uncompressed)) {
+					fprintf(stderr, "%s: decompression failed\n", MsgCompressor::name(codec.codec));
+					return 1;
+				}
+			}
+
+			double decompresstime = (cputime() - start) / iterations;
+
+			// verify
+			uint8_t* p = uncompressed;
+
+			for(size_t j = 0; j < samples.size(); j++) {
+				if(memcmp(p, samples[j].data, samples[j].size) != 0) {
+					fprintf(stderr, "%s: data mismatch\n", MsgCompressor::name(codec.codec));
+					return 1;
+				}
+
+				p += samples[j].size;
+			}
+
+			printf("%-5s  %5i  %-6s  %-4s  %7.3f  %11.2f  %6.1f  %13.2f  %6.1f\n",
+				MsgCompressor::name(codec.codec),
+				codec.level,
+				streaming ? "stream" : "packet",
+				codec.dictionary ? "yes" : "no",
+				(double)compressedsize / total,
+				compresstime * 1000,
+				total / compresstime / 1e6,
+				decompresstime * 1000,
+				total / decompresstime / 1e6);
+
+			for(size_t j = 0; j < compressed.size(); j++) {
+				free(compressed[j].data);
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,101 @@
+/*
+ *      VDR CRC32 Benchmark Tool
+ *
+ *      Copyright (C) 2012 Alexander Pipelka
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "net/crc32.h"
+
+// payload sizes we typically see: status packets, EPG / recording entries, stream packets, large lists
+static const size_t sizes[] = { 32, 256, 4096, 65536, 1048576 };
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[]) {
+	// total amount of data to checksum per engine and size (in MB)
+	size_t total = 512;
+
+	if(argc == 2) {
+		total = atoi(argv[1]);
+	}
+
+	if(total == 0) {
+		fprintf(stderr, "usage: %s [megabytes per run]\n", argv[0]);
+		return 1;
+	}
+
+	size_t maxsize = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+	uint8_t* buffer = (uint8_t*)malloc(maxsize + 1);
+
+	if(buffer == NULL) {
+		fprintf(stderr, "unable to allocate buffer\n");
+		return 1;
+	}
+
+	srand(1);
+
+	for(size_t i = 0; i < maxsize + 1; i++) {
+		buffer[i] = rand();
+	}
+
+	printf("active engine: %s\n\n", crc32_engine_name(crc32_engine()));
+	printf("%-12s %10s %10s  %s\n", "engine", "size", "GB/s", "crc");
+
+	for(int e = 0; e < Crc32EngineCount; e++) {
+		Crc32Engine engine = (Crc32Engine)e;
+
+		if(!crc32_engine_supported(engine)) {
+			printf("%-12s %10s\n", crc32_engine_name(engine), "n/a");
+			continue;
+		}
+
+		for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+			size_t size = sizes[s];
+			size_t loops = (total * 1024 * 1024) / size;
+
+			// odd offset, packet payloads are not aligned
+			const uint8_t* data = buffer + 1;
+
+			uint32_t crc = 0;
+			double start = now();
+
+			for(size_t i = 0; i < loops; i++) {
+				crc = crc32_update_engine(engine, crc, data, size);
+			}
+
+			double elapsed = now() - start;
+			double gbs = (double)loops * size / elapsed / 1e9;
+
+			printf("%-12s %10zu %10.2f  %08x\n", crc32_engine_name(engine), size, gbs, crc);
+		}
+	}
+
+	free(buffer);
+	return 0;
+}
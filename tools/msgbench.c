@@ -0,0 +1,431 @@
+/*
+ *      VDR Message Packet Benchmark Tool
+ *
+ *      Copyright (C) 2012 Alexander Pipelka
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+// Baseline of the protocol layer, measured without VDR: serialization (put / get),
+// freeze and checksums, compression at every zlib level and write / read round
+// trips over a socketpair and a loopback TCP connection.
+// Reports packets/s, MB/s and the p50 / p99 latency of a single operation for
+// packet sizes matching real traffic.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <vector>
+#include <algorithm>
+
+#include "net/msgpacket.h"
+
+struct Traffic {
+	const char* name;
+	uint32_t size;
+	bool text;
+};
+
+// status message, audio packet, video packet, EPG list
+static const Traffic traffic[] = {
+	{ "status", 32, true },
+	{ "audio", 200, false },
+	{ "video", 60 * 1024, false },
+	{ "epg", 2 * 1024 * 1024, true }
+};
+
+// upper limit of recorded latencies per test
+#define MAX_SAMPLES 1000000
+
+static double duration = 0.5;
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+class Samples {
+public:
+
+	Samples() : m_count(0), m_start(now()) {
+		m_samples.reserve(4096);
+	}
+
+	void add(double seconds) {
+		if(m_samples.size() < MAX_SAMPLES) {
+			m_samples.push_back(seconds);
+		}
+
+		m_count++;
+	}
+
+	// keep going until the test duration has passed (at least a few rounds)
+	bool more() {
+		return m_count < 3 || now() - m_start < duration;
+	}
+
+	void report(const char* test, const Traffic& t, uint64_t bytes) {
+		double elapsed = 0;
+
+		for(size_t i = 0; i < m_samples.size(); i++) {
+			elapsed += m_samples[i];
+		}
+
+		std::sort(m_samples.begin(), m_samples.end());
+
+		double p50 = m_samples[m_samples.size() / 2];
+		double p99 = m_samples[(m_samples.size() * 99) / 100];
+		double rate = m_samples.size() / elapsed;
+
+		printf("%-16s %-7s %9u %12.0f %10.1f %10.2f %10.2f\n", test, t.name, t.size, rate, rate * bytes / 1e6, p50 * 1e6, p99 * 1e6);
+	}
+
+private:
+
+	std::vector<double> m_samples;
+	uint64_t m_count;
+	double m_start;
+
+};
+
+// text of a typical EPG / status entry
+static const char* text = "Tagesschau - Nachrichten aus Deutschland und der Welt. Mit dem Wetter.";
+
+static uint8_t* blob = NULL;
+
+static void fill(MsgPacket* p, const Traffic& t) {
+	if(!t.text) {
+		p->put_Blob(blob, t.size);
+		return;
+	}
+
+	uint32_t id = 0;
+
+	while(p->getPayloadLength() + 4 <= t.size) {
+		p->put_U32(id++);
+
+		// cut the last string to the requested size
+		uint32_t left = t.size - p->getPayloadLength();
+
+		if(left > strlen(text)) {
+			p->put_String(text);
+		}
+		else if(left > 1) {
+			char buffer[128];
+			strncpy(buffer, text, left - 1);
+			buffer[left - 1] = 0;
+			p->put_String(buffer);
+		}
+	}
+}
+
+static void parse(MsgPacket* p, const Traffic& t) {
+	p->rewind();
+
+	if(!t.text) {
+		p->get_Blob(blob, t.size);
+		return;
+	}
+
+	while(!p->eop()) {
+		p->get_U32();
+
+		if(!p->eop()) {
+			p->get_String();
+		}
+	}
+}
+
+static void benchSerialize(const Traffic& t) {
+	Samples put;
+	Samples get;
+
+	while(put.more()) {
+		MsgPacket* p = new MsgPacket(1, 1, 1, t.size);
+
+		double start = now();
+		fill(p, t);
+		put.add(now() - start);
+
+		start = now();
+		parse(p, t);
+		get.add(now() - start);
+
+		delete p;
+	}
+
+	put.report("put", t, t.size);
+	get.report("get", t, t.size);
+}
+
+static void benchFreeze(const Traffic& t) {
+	Samples incremental;
+	Samples full;
+
+	while(incremental.more()) {
+		// checksum updated while adding the payload
+		MsgPacket* p = new MsgPacket(1, 1, 1, t.size);
+		fill(p, t);
+
+		double start = now();
+		p->freeze();
+		incremental.add(now() - start);
+
+		delete p;
+
+		// payload written into reserved space, checksum computed by freeze()
+		p = new MsgPacket(1, 1, 1, t.size);
+		uint8_t* data = p->reserve(t.size);
+		memcpy(data, blob, t.size);
+
+		start = now();
+		p->freeze();
+		full.add(now() - start);
+
+		delete p;
+	}
+
+	incremental.report("freeze", t, t.size);
+	full.report("freeze+crc", t, t.size);
+}
+
+static void benchCompress(const Traffic& t) {
+	for(int level = 1; level <= 9; level++) {
+		Samples compress;
+		Samples uncompress;
+		uint64_t compressed = 0;
+
+		while(compress.more()) {
+			MsgPacket* p = new MsgPacket(1, 1, 1, t.size);
+			fill(p, t);
+
+			double start = now();
+			p->compress(level);
+			compress.add(now() - start);
+
+			compressed = p->getPayloadLength();
+
+			start = now();
+			p->uncompress();
+			uncompress.add(now() - start);
+
+			delete p;
+		}
+
+		char name[32];
+		snprintf(name, sizeof(name), "compress %i", level);
+		compress.report(name, t, t.size);
+
+		snprintf(name, sizeof(name), "uncompress %i", level);
+		uncompress.report(name, t, t.size);
+
+		printf("%-16s %-7s %9u ratio %.3f\n", "", t.name, t.size, (double)compressed / t.size);
+	}
+}
+
+// echoes all packets back to the sender
+static void* echo(void* arg) {
+	int fd = *(int*)arg;
+	bool closed = false;
+
+	for(;;) {
+		MsgPacket* p = MsgPacket::read(fd, closed, 3000);
+
+		if(p == NULL) {
+			break;
+		}
+
+		p->write(fd, 3000);
+		delete p;
+	}
+
+	close(fd);
+	return NULL;
+}
+
+static bool benchRoundTrip(const char* test, int fd, const Traffic& t) {
+	Samples roundtrip;
+	bool closed = false;
+
+	MsgPacket* p = new MsgPacket(1, 1, 1, t.size);
+	fill(p, t);
+
+	while(roundtrip.more()) {
+		double start = now();
+
+		if(!p->write(fd, 3000)) {
+			fprintf(stderr, "%s: write failed\n", test);
+			delete p;
+			return false;
+		}
+
+		MsgPacket* r = MsgPacket::read(fd, closed, 3000);
+
+		if(r == NULL) {
+			fprintf(stderr, "%s: read failed\n", test);
+			delete p;
+			return false;
+		}
+
+		roundtrip.add(now() - start);
+		delete r;
+	}
+
+	delete p;
+
+	// a round trip transfers the packet twice
+	roundtrip.report(test, t, 2 * (t.size + MsgPacket::HeaderLength));
+	return true;
+}
+
+static bool connectPair(bool tcp, int fd[2]) {
+	if(!tcp) {
+		return (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) == 0);
+	}
+
+	int server = socket(AF_INET, SOCK_STREAM, 0);
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	socklen_t length = sizeof(addr);
+
+	if(bind(server, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(server, 1) != 0 || getsockname(server, (struct sockaddr*)&addr, &length) != 0) {
+		close(server);
+		return false;
+	}
+
+	fd[0] = socket(AF_INET, SOCK_STREAM, 0);
+
+	if(connect(fd[0], (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		close(server);
+		close(fd[0]);
+		return false;
+	}
+
+	fd[1] = accept(server, NULL, NULL);
+	close(server);
+
+	// the server disables nagle on client connections
+	int one = 1;
+	setsockopt(fd[0], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	setsockopt(fd[1], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	return (fd[1] != -1);
+}
+
+static bool benchTransport(bool tcp) {
+	const char* test = tcp ? "tcp roundtrip" : "unix roundtrip";
+	int fd[2];
+
+	if(!connectPair(tcp, fd)) {
+		fprintf(stderr, "%s: unable to connect\n", test);
+		return false;
+	}
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, echo, &fd[1]);
+
+	bool rc = true;
+
+	for(size_t i = 0; i < sizeof(traffic) / sizeof(traffic[0]) && rc; i++) {
+		rc = benchRoundTrip(test, fd[0], traffic[i]);
+	}
+
+	close(fd[0]);
+	pthread_join(thread, NULL);
+
+	return rc;
+}
+
+int main(int argc, char* argv[]) {
+	bool serialize = true;
+	bool compress = true;
+	bool transport = true;
+	int c;
+
+	while((c = getopt(argc, argv, "t:scr")) != -1) {
+		switch(c) {
+			case 't':
+				duration = atof(optarg);
+				break;
+			case 's':
+				compress = false;
+				transport = false;
+				break;
+			case 'c':
+				serialize = false;
+				transport = false;
+				break;
+			case 'r':
+				serialize = false;
+				compress = false;
+				break;
+			default:
+				optind = argc + 1;
+				break;
+		}
+	}
+
+	if(optind > argc || duration <= 0) {
+		fprintf(stderr, "usage: %s [-t seconds per test] [-s serialization only] [-c compression only] [-r round trips only]\n", argv[0]);
+		return 1;
+	}
+
+	uint32_t maxsize = traffic[sizeof(traffic) / sizeof(traffic[0]) - 1].size;
+	blob = (uint8_t*)malloc(maxsize);
+
+	srand(1);
+
+	for(uint32_t i = 0; i < maxsize; i++) {
+		blob[i] = rand();
+	}
+
+	printf("%-16s %-7s %9s %12s %10s %10s %10s\n", "test", "traffic", "size", "packets/s", "MB/s", "p50 us", "p99 us");
+
+	for(size_t i = 0; i < sizeof(traffic) / sizeof(traffic[0]); i++) {
+		const Traffic& t = traffic[i];
+
+		if(serialize) {
+			benchSerialize(t);
+			benchFreeze(t);
+		}
+
+		if(compress) {
+			benchCompress(t);
+		}
+	}
+
+	if(transport && (!benchTransport(false) || !benchTransport(true))) {
+		free(blob);
+		return 1;
+	}
+
+	free(blob);
+	return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ *      VDR Message Packet Tests
+ *
+ *      Copyright (C) 2012 Alexander Pipelka
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+// Checks of the protocol layer, run without VDR (make test).
+// Returns 0 if all checks passed.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "net/msgpacket.h"
+
+static int failed = 0;
+
+static void check(bool ok, const char* test) {
+	printf("%-48s %s\n", test, ok ? "ok" : "FAILED");
+
+	if(!ok) {
+		failed++;
+	}
+}
+
+// read exactly length bytes
+static bool receive(int fd, uint8_t* data, uint32_t length) {
+	while(length > 0) {
+		ssize_t rc = read(fd, data, length);
+
+		if(rc <= 0) {
+			return false;
+		}
+
+		data += rc;
+		length -= rc;
+	}
+
+	return true;
+}
+
+static MsgPacket* create(uint32_t size) {
+	MsgPacket* p = new MsgPacket(4, 5, 0);
+
+	for(uint32_t i = 0; i < size / 4; i++) {
+		p->put_U32(i * 2654435761U);
+	}
+
+	return p;
+}
+
+// a packet restored from its copy (timeshift storage) goes out byte by byte
+// as it has been stored, including the header and the checksums
+static void testRestore(int fd[2], bool modified) {
+	MsgPacket* p = create(16 * 1024);
+	uint32_t length = p->getPacketLength();
+	uint8_t* stored = (uint8_t*)malloc(length);
+
+	p->copy(stored);
+	delete p;
+
+	// a different payload checksum must not be recomputed on the way out
+	if(modified) {
+		stored[MsgPacket::PayloadCheckSumPos] ^= 0xFF;
+	}
+
+	p = MsgPacket::restore(stored, length);
+	check(p != NULL && p->getPacketLength() == length, "restore: length");
+
+	uint8_t* sent = (uint8_t*)malloc(length);
+	bool ok = (p != NULL && p->write(fd[0], 3000) && receive(fd[1], sent, length));
+
+	check(ok && memcmp(sent, stored, MsgPacket::HeaderLength) == 0, modified ? "restore: stored payload checksum sent unchanged" : "restore: header sent unchanged");
+	check(ok && memcmp(sent, stored, length) == 0, modified ? "restore: packet sent unchanged (modified)" : "restore: packet sent unchanged");
+
+	delete p;
+	free(sent);
+	free(stored);
+}
+
+// a restored packet is accepted by the receiver
+static void testRestoreRead(int fd[2]) {
+	MsgPacket* p = create(4 * 1024);
+	uint32_t length = p->getPacketLength();
+	uint8_t* stored = (uint8_t*)malloc(length);
+
+	p->copy(stored);
+	delete p;
+
+	p = MsgPacket::restore(stored, length);
+	bool closed = false;
+	MsgPacket* r = NULL;
+
+	if(p != NULL && p->write(fd[0], 3000)) {
+		r = MsgPacket::read(fd[1], closed, 3000);
+	}
+
+	check(r != NULL && r->getPayloadLength() == length - MsgPacket::HeaderLength && memcmp(r->getPayload(), stored + MsgPacket::HeaderLength, r->getPayloadLength()) == 0, "restore: read by the receiver");
+
+	delete r;
+	delete p;
+	free(stored);
+}
+
+int main(int argc, char* argv[]) {
+	int fd[2];
+
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, fd) != 0) {
+		fprintf(stderr, "unable to create socketpair\n");
+		return 1;
+	}
+
+	testRestore(fd, false);
+	testRestore(fd, true);
+	testRestoreRead(fd);
+
+	close(fd[0]);
+	close(fd[1]);
+
+	if(failed > 0) {
+		printf("%i checks failed\n", failed);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,230 @@
+/*
+ *      VDR XVDR Response Capture Tool
+ *
+ *      Copyright (C) 2012 Alexander Pipelka
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+// Captures the uncompressed payloads of the channel list, the recordings list
+// and the EPG of all channels. The files can be used to benchmark the compression
+// codecs (codecbench) and to train a zstd dictionary ("zstd --train").
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <vector>
+
+#include "net/msgpacket.h"
+#include "xvdr/xvdrcommand.h"
+
+static int connectServer(const char* host, const char* port) {
+	struct addrinfo hints;
+	struct addrinfo* result = NULL;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if(getaddrinfo(host, port, &hints, &result) != 0) {
+		return -1;
+	}
+
+	int fd = -1;
+
+	for(struct addrinfo* a = result; a != NULL; a = a->ai_next) {
+		fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+
+		if(fd == -1) {
+			continue;
+		}
+
+		if(connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+			break;
+		}
+
+		close(fd);
+		fd = -1;
+	}
+
+	freeaddrinfo(result);
+	return fd;
+}
+
+static MsgPacket* request(int fd, MsgPacket& req) {
+	req.setProtocolVersion(XVDR_PROTOCOLVERSION);
+
+	if(!req.write(fd, 10000)) {
+		return NULL;
+	}
+
+	// skip status packets
+	for(;;) {
+		MsgPacket* p = MsgPacket::read(fd, 60000);
+
+		if(p == NULL) {
+			return NULL;
+		}
+
+		if(p->getType() == XVDR_CHANNEL_REQUEST_RESPONSE && p->getUID() == req.getUID()) {
+			return p;
+		}
+
+		delete p;
+	}
+}
+
+static bool save(const char* directory, const char* name, MsgPacket* p) {
+	char filename[1024];
+	snprintf(filename, sizeof(filename), "%s/%s", directory, name);
+
+	FILE* file = fopen(filename, "wb");
+
+	if(file == NULL) {
+		fprintf(stderr, "unable to create %s\n", filename);
+		return false;
+	}
+
+	uint32_t length = p->getPayloadLength();
+	bool rc = (fwrite(p->getPayload(), 1, length, file) == length);
+	fclose(file);
+
+	return rc;
+}
+
+int main(int argc, char* argv[]) {
+	const char* port = "34891";
+	const char* directory = ".";
+	int days = 7;
+	int c;
+
+	while((c = getopt(argc, argv, "p:o:d:")) != -1) {
+		switch(c) {
+			case 'p':
+				port = optarg;
+				break;
+			case 'o':
+				directory = optarg;
+				break;
+			case 'd':
+				days = atoi(optarg);
+				break;
+			default:
+				optind = argc + 1;
+				break;
+		}
+	}
+
+	if(optind != argc - 1) {
+		fprintf(stderr, "usage: %s [-p port] [-o directory] [-d days of epg] host\n", argv[0]);
+		return 1;
+	}
+
+	int fd = connectServer(argv[optind], port);
+
+	if(fd == -1) {
+		fprintf(stderr, "unable to connect to %s:%s\n", argv[optind], port);
+		return 1;
+	}
+
+	// login without compression
+	MsgPacket login(XVDR_LOGIN, XVDR_CHANNEL_REQUEST_RESPONSE);
+	login.put_U8(0);
+	login.put_String("xvdrcapture");
+
+	MsgPacket* resp = request(fd, login);
+
+	if(resp == NULL) {
+		fprintf(stderr, "login failed\n");
+		close(fd);
+		return 1;
+	}
+
+	delete resp;
+
+	// channel lists (tv and radio)
+	std::vector<uint32_t> channels;
+	int count = 0;
+
+	for(uint32_t radio = 0; radio < 2; radio++) {
+		MsgPacket req(XVDR_CHANNELS_GETCHANNELS, XVDR_CHANNEL_REQUEST_RESPONSE);
+		req.put_U32(radio);
+
+		if((resp = request(fd, req)) == NULL) {
+			fprintf(stderr, "unable to get channel list\n");
+			close(fd);
+			return 1;
+		}
+
+		save(directory, radio ? "channels-radio.bin" : "channels-tv.bin", resp);
+		count++;
+
+		while(!resp->eop()) {
+			resp->get_U32();			// number
+			resp->get_String();			// name
+			channels.push_back(resp->get_U32());	// uid
+			resp->get_U32();			// ca
+			resp->get_String();			// logo url
+		}
+
+		delete resp;
+	}
+
+	// recordings
+	MsgPacket recordings(XVDR_RECORDINGS_GETLIST, XVDR_CHANNEL_REQUEST_RESPONSE);
+
+	if((resp = request(fd, recordings)) != NULL) {
+		save(directory, "recordings.bin", resp);
+		count++;
+		delete resp;
+	}
+
+	// epg of all channels
+	uint32_t start = time(NULL);
+
+	for(size_t i = 0; i < channels.size(); i++) {
+		MsgPacket req(XVDR_EPG_GETFORCHANNEL, XVDR_CHANNEL_REQUEST_RESPONSE);
+		req.put_U32(channels[i]);
+		req.put_U32(start);
+		req.put_U32(days * 24 * 60 * 60);
+
+		if((resp = request(fd, req)) == NULL) {
+			fprintf(stderr, "unable to get epg of channel %08x\n", channels[i]);
+			break;
+		}
+
+		// channels without epg return a single status code
+		if(resp->getPayloadLength() > sizeof(uint32_t)) {
+			char name[64];
+			snprintf(name, sizeof(name), "epg-%08x.bin", channels[i]);
+			save(directory, name, resp);
+			count++;
+		}
+
+		delete resp;
+	}
+
+	close(fd);
+
+	printf("%i responses of %i channels saved to %s\n", count, (int)channels.size(), directory);
+	return 0;
+}